@@ -1,24 +1,35 @@
+newoption {
+	trigger		= "shared",
+	description	= "Also build libgluac as a shared library, into bin/shared"
+}
+
 solution "gluac"
 	configurations { "Debug", "Release" }
 	platforms { "x32" }
 
 	language		"C++"
+	cppdialect		"C++11"
 	characterset	"MBCS"
 	location		"project"
 	targetdir		"bin"
 	architecture "x32"
 
-	project "gluac"
-		kind	"ConsoleApp"
-		targetname "gluac"
-		
-		flags { "NoPCH" }
-		symbols "On"
-		editandcontinue "Off"
-		staticruntime "On"
-		vectorextensions "SSE"
-
-		includedirs "scanning"
+	flags { "NoPCH" }
+	symbols "On"
+	editandcontinue "Off"
+	staticruntime "On"
+	vectorextensions "SSE"
+	includedirs "scanning"
+
+	if os.istarget( "linux" ) then
+		buildoptions { "-fPIC", "-pthread" }
+
+		linkoptions { "-pthread" }
+		--linkoptions { "-pthread", "-Wl,-rpath=\\$$ORIGIN" }
+	end
+
+	-- everything but the command line, for tools that compile in-process through src/gluac.h
+	function libgluac_files()
 		files {
 			"scanning/*.hpp",
 			"scanning/*.cpp"
@@ -28,12 +39,40 @@ solution "gluac"
 			["Symbol Scanning/Sources/*"] = "scanning/*.cpp"
 		}
 
-        if os.istarget( "linux" ) then
-                buildoptions { "-fPIC", "-pthread" }
+		files { "src/**.*" }
+		removefiles { "src/main.cpp" }
+	end
+
+	project "libgluac"
+		kind	"StaticLib"
+		targetname "libgluac"
+		targetprefix ""
+
+		libgluac_files()
+
+	if _OPTIONS["shared"] then
+		project "libgluac_shared"
+			kind	"SharedLib"
+			targetname "libgluac"
+			targetprefix ""
+			targetdir "bin/shared"
+			defines { "GLUAC_SHARED", "GLUAC_BUILD" }
+
+			libgluac_files()
+
+			if os.istarget( "linux" ) then
+				links { "dl" }
+			end
+	end
+
+	project "gluac"
+		kind	"ConsoleApp"
+		targetname "gluac"
 
-                linkoptions { "-pthread" }
-                --linkoptions { "-pthread", "-Wl,-rpath=\\$$ORIGIN" }
-                links { "dl" }
-        end
+		files { "src/main.cpp" }
+		links { "libgluac" }
 
-		files { "src/**.*" }
\ No newline at end of file
+		-- after libgluac, which is what needs it
+		if os.istarget( "linux" ) then
+			links { "dl" }
+		end
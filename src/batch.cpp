@@ -0,0 +1,145 @@
+#include "batch.h"
+#include "batchio.h"
+#include "compiler.h"
+#include "compress.h"
+#include "workpool.h"
+
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+
+std::string batch_output_path(const char *outdir, const char *input)
+{
+	std::string path = outdir;
+	if (!path.empty() && path[path.size() - 1] != '/')
+		path += '/';
+
+	// anything that would point outside of outdir is dropped: the root, a
+	// drive letter, and every . and .. wherever they are in the path
+	const char *start = input;
+	if (start[0] != '\0' && start[1] == ':')
+		start += 2;
+
+	bool first = true;
+	while (*start != '\0') {
+		const char *end = start;
+		while (*end != '\0' && *end != '/' && *end != '\\')
+			end++;
+
+		size_t len = (size_t)(end - start);
+		bool dots = (len == 1 && start[0] == '.') || (len == 2 && start[0] == '.' && start[1] == '.');
+		if (len > 0 && !dots) {
+			if (!first)
+				path += '/';
+			path.append(start, len);
+			first = false;
+		}
+
+		start = *end != '\0' ? end + 1 : end;
+	}
+
+	return path;
+}
+
+void batch_report(const char *mode, size_t files, size_t failed, double seconds)
+{
+	fprintf(stderr, "%s: %u files, %u failed, %.1f ms total, %.1f us/file\n", mode,
+		(unsigned int)files, (unsigned int)failed, seconds * 1000.0, files ? seconds * 1e6 / files : 0.0);
+}
+
+// compiles an input the io layer has read ahead and queues its output to be written
+static bool compile_item(lua_State *L, BatchIO *io, size_t index, const BatchItem &item, const BatchOptions &options)
+{
+	std::string source;
+	std::string err;
+
+	if (!io->Read(index, source, err)) {
+		fprintf(stderr, "%s\n", err.c_str());
+		return false;
+	}
+
+	std::string bytecode;
+	CompileJob job = { item.input.c_str(), source.data(), source.size(), item.chunkname.c_str(), options.strip, options.parseonly, write_dump_string, &bytecode };
+
+	if (!compile(L, &job, err)) {
+		fprintf(stderr, "%s\n", err.c_str());
+		return false;
+	}
+
+	if (options.parseonly)
+		return true;
+
+	// on the worker, so compressing runs as parallel as compiling does
+	if (options.compress != COMPRESS_NONE)
+		compress_frame(bytecode, options.compress);
+
+	io->Write(index, bytecode);
+
+	return true;
+}
+
+int batch_main(const std::vector<BatchItem> &items, const BatchOptions &options)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::atomic<size_t> failed(0);
+
+	size_t workers = options.workers ? options.workers : std::thread::hardware_concurrency();
+	if (workers > items.size())
+		workers = items.size();
+
+	size_t prefetch = options.prefetch ? options.prefetch : (workers > 8 ? workers * 4 : 32);
+	BatchIO *io = BatchIO::Create(items, prefetch, options.threadio);
+
+	if (workers <= 1) {
+		lua_State *L = compiler_newstate(&options.limits);
+		if (L == nullptr) {
+			delete io;
+			return 1;
+		}
+
+		for (size_t i = 0; i < items.size(); i++) {
+			if (!compile_item(L, io, i, items[i], options))
+				failed++;
+
+			if (compiler_exhausted(L)) {
+				lua_State *fresh = compiler_newstate(&options.limits);
+				if (fresh != nullptr) {
+					compiler_close(L);
+					L = fresh;
+				}
+			}
+		}
+
+		compiler_close(L);
+	} else {
+		WorkPool pool(workers, workers * 4, 0, options.limits);
+		if (!pool.Start()) {
+			delete io;
+			return 1;
+		}
+
+		for (size_t i = 0; i < items.size(); i++) {
+			const BatchItem *item = &items[i];
+
+			pool.Push([io, i, item, &options, &failed](lua_State *L) {
+				if (!compile_item(L, io, i, *item, options))
+					failed++;
+			});
+		}
+
+		pool.Wait();
+	}
+
+	failed += io->Finish();
+
+	if (options.stats) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::string mode = std::string(workers <= 1 ? "single" : "batch") + " (" + io->Name() + ")";
+		batch_report(mode.c_str(), items.size(), failed, elapsed.count());
+	}
+
+	delete io;
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,41 @@
+#ifndef GLUAC_BATCH_H
+#define GLUAC_BATCH_H
+
+#include "compiler.h"
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+typedef struct {
+	std::string input;
+	std::string output;
+	std::string chunkname;	// what errors and debug information call it, see make_chunkname
+} BatchItem;
+
+typedef struct {
+	bool strip;
+	bool parseonly;
+	size_t workers;		// 0 uses one per core
+	bool stats;			// print timings to stderr when done
+	CompileLimits limits;
+	size_t prefetch;	// inputs read ahead of the compiler, 0 picks from the worker count
+	bool threadio;		// read and write on plain threads even where io_uring works
+	int compress;		// COMPRESS_*, each output is framed by compress_frame when set
+} BatchOptions;
+
+// places input under outdir, keeping its relative path less any . and ..
+// components, so nothing it names can end up outside of outdir
+std::string batch_output_path(const char *outdir, const char *input);
+
+// compiles every item in this process, on a pool of worker states when
+// more than one worker is asked for. returns an exit code
+int batch_main(const std::vector<BatchItem> &items, const BatchOptions &options);
+
+// compiles every item in its own forked copy of one warm state, so a file
+// that crashes or runs away can only take its own child down
+int zygote_main(const std::vector<BatchItem> &items, const BatchOptions &options);
+
+void batch_report(const char *mode, size_t files, size_t failed, double seconds);
+
+#endif
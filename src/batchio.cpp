@@ -0,0 +1,796 @@
+#include "batchio.h"
+#include "compiler.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <thread>
+
+BatchIO::BatchIO(const std::vector<BatchItem> &items, size_t depth) :
+	m_Items(items),
+	m_iDepth(depth > 0 ? depth : 1),
+	m_bStopping(false),
+	m_Inputs(items.size()),
+	m_iNextRead(0),
+	m_iBuffered(0),
+	m_iWriting(0),
+	m_iFailedWrites(0)
+{
+	for (size_t i = 0; i < m_Inputs.size(); i++) {
+		m_Inputs[i].state = INPUT_WAITING;
+		m_Inputs[i].error = 0;
+	}
+}
+
+bool BatchIO::Read(size_t index, std::string &source, std::string &err)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	Input &input = m_Inputs[index];
+
+	while (input.state != INPUT_READY)
+		m_Changed.wait(lock);
+
+	int error = input.error;
+	source.swap(input.data);
+	std::string().swap(input.data);
+	input.state = INPUT_TAKEN;
+	m_iBuffered--;
+	lock.unlock();
+
+	// there's room for the next input now
+	Wake();
+
+	if (error != 0) {
+		err = "cannot read " + m_Items[index].input + ": " + strerror(error);
+		return false;
+	}
+
+	return true;
+}
+
+void BatchIO::Write(size_t index, std::string &data)
+{
+	const std::string &output = m_Items[index].output;
+	std::string dir = output.substr(0, output.find_last_of("/\\") + 1);
+
+	if (!dir.empty()) {
+		std::lock_guard<std::mutex> lock(m_DirMutex);
+		if (m_Dirs.find(dir) == m_Dirs.end()) {
+			if (!make_parent_dirs(output.c_str())) {
+				fprintf(stderr, "cannot write %s\n", output.c_str());
+				std::lock_guard<std::mutex> failedlock(m_Mutex);
+				m_iFailedWrites++;
+				return;
+			}
+
+			m_Dirs.insert(dir);
+		}
+	}
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	while (m_Writes.size() + m_iWriting >= m_iDepth)
+		m_Changed.wait(lock);
+
+	PendingWrite write = { index, std::string() };
+	write.data.swap(data);
+	m_Writes.push_back(std::move(write));
+	lock.unlock();
+
+	Wake();
+}
+
+size_t BatchIO::Finish()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	while (!m_Writes.empty() || m_iWriting > 0)
+		m_Changed.wait(lock);
+
+	lock.unlock();
+	Stop();
+
+	return m_iFailedWrites;
+}
+
+bool BatchIO::NextRead(size_t &index)
+{
+	if (m_bStopping || m_iNextRead >= m_Inputs.size() || m_iBuffered >= m_iDepth)
+		return false;
+
+	index = m_iNextRead++;
+	m_Inputs[index].state = INPUT_READING;
+	m_iBuffered++;
+	return true;
+}
+
+bool BatchIO::NextWrite(PendingWrite &write)
+{
+	if (m_Writes.empty())
+		return false;
+
+	write = std::move(m_Writes.front());
+	m_Writes.pop_front();
+	m_iWriting++;
+	return true;
+}
+
+void BatchIO::ReadDone(size_t index, std::string &data, int error)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	Input &input = m_Inputs[index];
+
+	input.data.swap(data);
+	input.error = error;
+	input.state = INPUT_READY;
+	m_Changed.notify_all();
+}
+
+void BatchIO::WriteDone(size_t index, int error)
+{
+	if (error != 0)
+		fprintf(stderr, "cannot write %s: %s\n", m_Items[index].output.c_str(), strerror(error));
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (error != 0)
+		m_iFailedWrites++;
+
+	m_iWriting--;
+	m_Changed.notify_all();
+}
+
+void BatchIO::Serve()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	for (;;) {
+		size_t index;
+		PendingWrite write;
+
+		if (NextWrite(write)) {
+			lock.unlock();
+			const BatchItem &item = m_Items[write.index];
+			bool ok = write_file_atomic(item.output.c_str(), write.data.data(), write.data.size());
+			WriteDone(write.index, ok ? 0 : errno != 0 ? errno : EIO);
+			lock.lock();
+		} else if (NextRead(index)) {
+			lock.unlock();
+			std::string data;
+			errno = 0;
+			bool ok = read_file(m_Items[index].input.c_str(), data);
+			ReadDone(index, data, ok ? 0 : errno != 0 ? errno : EIO);
+			lock.lock();
+		} else if (m_bStopping) {
+			return;
+		} else {
+			m_Changed.wait(lock);
+		}
+	}
+}
+
+// plain blocking reads and writes spread over a few threads, for where
+// io_uring isn't available. enough of them run to keep the window busy
+class ThreadIO : public BatchIO
+{
+public:
+	ThreadIO(const std::vector<BatchItem> &items, size_t depth) : BatchIO(items, depth)
+	{
+		size_t threads = m_iDepth < 16 ? m_iDepth : 16;
+		for (size_t i = 0; i < threads; i++)
+			m_Threads.push_back(std::thread(&ThreadIO::Serve, this));
+	}
+
+	~ThreadIO()
+	{
+		Stop();
+	}
+
+	const char *Name() const { return "threads"; }
+
+protected:
+	void Wake()
+	{
+		m_Changed.notify_all();
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_bStopping = true;
+		}
+
+		m_Changed.notify_all();
+
+		for (size_t i = 0; i < m_Threads.size(); i++)
+			m_Threads[i].join();
+
+		m_Threads.clear();
+	}
+
+private:
+	std::vector<std::thread> m_Threads;
+};
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define GLUAC_HAVE_IO_URING
+#endif
+#endif
+
+#ifdef GLUAC_HAVE_IO_URING
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup		425
+#define __NR_io_uring_enter		426
+#define __NR_io_uring_register	427
+#endif
+
+// the submission and completion rings mapped straight from the kernel, one
+// thread submits and reaps so only the kernel's side needs barriers
+class Ring
+{
+public:
+	Ring() : m_iFd(-1), m_pSq(MAP_FAILED), m_pCq(MAP_FAILED), m_pSqes(MAP_FAILED), m_iSqTail(0), m_iToSubmit(0) {}
+
+	~Ring()
+	{
+		if (m_pSqes != MAP_FAILED)
+			munmap(m_pSqes, m_iSqesSize);
+		if (m_pCq != MAP_FAILED && m_pCq != m_pSq)
+			munmap(m_pCq, m_iCqSize);
+		if (m_pSq != MAP_FAILED)
+			munmap(m_pSq, m_iSqSize);
+		if (m_iFd >= 0)
+			close(m_iFd);
+	}
+
+	bool Init(unsigned int entries)
+	{
+		struct io_uring_params params;
+		memset(&params, 0, sizeof(params));
+
+		m_iFd = (int)syscall(__NR_io_uring_setup, entries, &params);
+		if (m_iFd < 0)
+			return false;
+
+		m_iSqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+		m_iCqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		m_iSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+		bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single && m_iCqSize > m_iSqSize)
+			m_iSqSize = m_iCqSize;
+
+		m_pSq = mmap(nullptr, m_iSqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_iFd, IORING_OFF_SQ_RING);
+		if (m_pSq == MAP_FAILED)
+			return false;
+
+		m_pCq = single ? m_pSq : mmap(nullptr, m_iCqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_iFd, IORING_OFF_CQ_RING);
+		if (m_pCq == MAP_FAILED)
+			return false;
+
+		m_pSqes = mmap(nullptr, m_iSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_iFd, IORING_OFF_SQES);
+		if (m_pSqes == MAP_FAILED)
+			return false;
+
+		char *sq = (char *)m_pSq;
+		m_pSqHead = (unsigned int *)(sq + params.sq_off.head);
+		m_pSqTailShared = (unsigned int *)(sq + params.sq_off.tail);
+		m_iSqMask = *(unsigned int *)(sq + params.sq_off.ring_mask);
+		m_pSqArray = (unsigned int *)(sq + params.sq_off.array);
+		m_iSqEntries = params.sq_entries;
+		m_iSqTail = *m_pSqTailShared;
+
+		char *cq = (char *)m_pCq;
+		m_pCqHead = (unsigned int *)(cq + params.cq_off.head);
+		m_pCqTail = (unsigned int *)(cq + params.cq_off.tail);
+		m_iCqMask = *(unsigned int *)(cq + params.cq_off.ring_mask);
+		m_pCqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+		return true;
+	}
+
+	// true if the kernel knows every opcode given
+	bool Supports(const int *ops, size_t count)
+	{
+		size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+		std::vector<char> buffer(size, 0);
+		struct io_uring_probe *probe = (struct io_uring_probe *)&buffer[0];
+
+		if (syscall(__NR_io_uring_register, m_iFd, IORING_REGISTER_PROBE, probe, 256) < 0)
+			return false;
+
+		for (size_t i = 0; i < count; i++) {
+			if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+				return false;
+		}
+
+		return true;
+	}
+
+	unsigned int Entries() const { return m_iSqEntries; }
+
+	// a cleared entry to fill in, null when the ring is full
+	struct io_uring_sqe *Get()
+	{
+		unsigned int head = __atomic_load_n(m_pSqHead, __ATOMIC_ACQUIRE);
+		if (m_iSqTail - head >= m_iSqEntries)
+			return nullptr;
+
+		unsigned int slot = m_iSqTail & m_iSqMask;
+		struct io_uring_sqe *sqe = &((struct io_uring_sqe *)m_pSqes)[slot];
+		memset(sqe, 0, sizeof(*sqe));
+		m_pSqArray[slot] = slot;
+		m_iSqTail++;
+		m_iToSubmit++;
+		return sqe;
+	}
+
+	// submits everything prepared and waits for at least one completion
+	bool SubmitAndWait()
+	{
+		__atomic_store_n(m_pSqTailShared, m_iSqTail, __ATOMIC_RELEASE);
+
+		for (;;) {
+			int n = (int)syscall(__NR_io_uring_enter, m_iFd, m_iToSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+			if (n >= 0) {
+				m_iToSubmit -= n;
+				return true;
+			}
+
+			if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+				return false;
+
+			// the completion ring is full, the caller needs to drain it first
+			if (errno == EBUSY)
+				return true;
+		}
+	}
+
+	bool Peek(struct io_uring_cqe &cqe)
+	{
+		unsigned int head = *m_pCqHead;
+		if (head == __atomic_load_n(m_pCqTail, __ATOMIC_ACQUIRE))
+			return false;
+
+		cqe = m_pCqes[head & m_iCqMask];
+		__atomic_store_n(m_pCqHead, head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+private:
+	int m_iFd;
+	void *m_pSq;
+	void *m_pCq;
+	void *m_pSqes;
+	size_t m_iSqSize;
+	size_t m_iCqSize;
+	size_t m_iSqesSize;
+
+	unsigned int *m_pSqHead;
+	unsigned int *m_pSqTailShared;
+	unsigned int *m_pSqArray;
+	unsigned int m_iSqMask;
+	unsigned int m_iSqEntries;
+	unsigned int m_iSqTail;
+	unsigned int m_iToSubmit;
+
+	unsigned int *m_pCqHead;
+	unsigned int *m_pCqTail;
+	unsigned int m_iCqMask;
+	struct io_uring_cqe *m_pCqes;
+};
+
+// every file is a short chain of operations: reads open and statx the input
+// together then read it in one go, writes open a temporary, write, close and
+// rename it into place. one thread keeps the ring full and hands results back
+class UringIO : public BatchIO
+{
+public:
+	UringIO(const std::vector<BatchItem> &items, size_t depth) :
+		BatchIO(items, depth),
+		m_iEventFd(-1),
+		m_iOps(0),
+		m_bRename(false)
+	{
+	}
+
+	~UringIO()
+	{
+		Stop();
+
+		if (m_iEventFd >= 0)
+			close(m_iEventFd);
+	}
+
+	const char *Name() const { return "io_uring"; }
+
+	bool Init()
+	{
+		// room for every read and write in the window to have two operations out at once
+		unsigned int entries = 8;
+		while (entries < m_iDepth * 4 + 2)
+			entries <<= 1;
+
+		if (!m_Ring.Init(entries))
+			return false;
+
+		static const int required[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_POLL_ADD };
+		if (!m_Ring.Supports(required, sizeof(required) / sizeof(required[0])))
+			return false;
+
+		static const int rename[] = { IORING_OP_RENAMEAT };
+		m_bRename = m_Ring.Supports(rename, 1);
+
+		m_iEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (m_iEventFd < 0)
+			return false;
+
+		m_Thread = std::thread(&UringIO::Run, this);
+		return true;
+	}
+
+protected:
+	void Wake()
+	{
+		uint64_t one = 1;
+		ssize_t n = write(m_iEventFd, &one, sizeof(one));
+		(void)n;
+
+		// for when the ring failed and Serve is waiting instead
+		m_Changed.notify_all();
+	}
+
+	void Stop()
+	{
+		if (!m_Thread.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_bStopping = true;
+		}
+
+		Wake();
+		m_Thread.join();
+	}
+
+private:
+	// packed into the low bits of each request's address in user_data
+	enum {
+		OP_WAKE = 0,
+		OP_OPEN,
+		OP_STATX,
+		OP_READ,
+		OP_WRITE,
+		OP_CLOSE,
+		OP_RENAME
+	};
+
+	typedef struct {
+		bool write;
+		size_t index;
+		int fd;
+		int pending;	// operations still out for the open and statx pair
+		int error;
+		size_t done;
+		std::string data;
+		std::string tmp;
+		struct statx stx;
+	} Request;
+
+	struct io_uring_sqe *Prepare(int opcode, Request *req, int tag)
+	{
+		struct io_uring_sqe *sqe = m_Ring.Get();
+		sqe->opcode = (uint8_t)opcode;
+		sqe->user_data = (uint64_t)(uintptr_t)req | (uint64_t)tag;
+		m_iOps++;
+		return sqe;
+	}
+
+	void ArmWake()
+	{
+		struct io_uring_sqe *sqe = m_Ring.Get();
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = m_iEventFd;
+		sqe->poll_events = POLLIN;
+		sqe->user_data = OP_WAKE;
+	}
+
+	void StartRead(size_t index)
+	{
+		Request *req = new Request();
+		m_Live.insert(req);
+		req->write = false;
+		req->index = index;
+		req->fd = -1;
+		req->pending = 2;
+		req->error = 0;
+		req->done = 0;
+
+		const char *path = m_Items[index].input.c_str();
+
+		struct io_uring_sqe *sqe = Prepare(IORING_OP_OPENAT, req, OP_OPEN);
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uint64_t)(uintptr_t)path;
+		sqe->open_flags = O_RDONLY | O_CLOEXEC;
+
+		// the size comes from a statx in the same submission rather than after the open
+		sqe = Prepare(IORING_OP_STATX, req, OP_STATX);
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uint64_t)(uintptr_t)path;
+		sqe->len = STATX_SIZE;
+		sqe->off = (uint64_t)(uintptr_t)&req->stx;
+	}
+
+	void StartWrite(PendingWrite &write)
+	{
+		Request *req = new Request();
+		m_Live.insert(req);
+		req->write = true;
+		req->index = write.index;
+		req->fd = -1;
+		req->pending = 1;
+		req->error = 0;
+		req->done = 0;
+		req->data.swap(write.data);
+		req->tmp = temp_filename(m_Items[write.index].output.c_str());
+
+		struct io_uring_sqe *sqe = Prepare(IORING_OP_OPENAT, req, OP_OPEN);
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uint64_t)(uintptr_t)req->tmp.c_str();
+		sqe->len = 0644;
+		sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	}
+
+	void Transfer(Request *req)
+	{
+		struct io_uring_sqe *sqe = Prepare(req->write ? IORING_OP_WRITE : IORING_OP_READ, req, req->write ? OP_WRITE : OP_READ);
+		sqe->fd = req->fd;
+		sqe->addr = (uint64_t)(uintptr_t)(&req->data[0] + req->done);
+		sqe->len = (uint32_t)(req->data.size() - req->done);
+		sqe->off = req->done;
+	}
+
+	void Close(Request *req)
+	{
+		struct io_uring_sqe *sqe = Prepare(IORING_OP_CLOSE, req, OP_CLOSE);
+		sqe->fd = req->fd;
+		req->fd = -1;
+	}
+
+	void Rename(Request *req)
+	{
+		struct io_uring_sqe *sqe = Prepare(IORING_OP_RENAMEAT, req, OP_RENAME);
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uint64_t)(uintptr_t)req->tmp.c_str();
+		sqe->len = (uint32_t)AT_FDCWD;
+		sqe->addr2 = (uint64_t)(uintptr_t)m_Items[req->index].output.c_str();
+	}
+
+	// hands the request's result back and frees it once nothing else is out for it
+	void Complete(Request *req)
+	{
+		m_Live.erase(req);
+
+		if (req->write) {
+			if (req->error != 0)
+				unlink(req->tmp.c_str());
+
+			WriteDone(req->index, req->error);
+		} else {
+			if (req->error != 0)
+				req->data.clear();
+
+			ReadDone(req->index, req->data, req->error);
+		}
+
+		delete req;
+	}
+
+	// finishes with the file, closing it first if it's open
+	void Finish(Request *req)
+	{
+		if (req->fd >= 0)
+			Close(req);
+		else
+			Complete(req);
+	}
+
+	void Handle(const struct io_uring_cqe &cqe)
+	{
+		Request *req = (Request *)(uintptr_t)(cqe.user_data & ~(uint64_t)7);
+		int tag = (int)(cqe.user_data & 7);
+		int res = cqe.res;
+
+		m_iOps--;
+
+		switch (tag) {
+		case OP_OPEN:
+		case OP_STATX:
+			if (res < 0 && req->error == 0)
+				req->error = -res;
+			else if (tag == OP_OPEN && res >= 0)
+				req->fd = res;
+
+			if (--req->pending > 0)
+				return;
+
+			if (req->error != 0) {
+				Finish(req);
+			} else if (!req->write) {
+				// a byte past the size statx gave, so the read that comes back
+				// empty is what ends it rather than the size, which may be stale
+				req->data.resize((size_t)req->stx.stx_size + 1);
+				Transfer(req);
+			} else if (!req->data.empty()) {
+				Transfer(req);
+			} else {
+				Close(req);
+			}
+			break;
+
+		case OP_READ:
+		case OP_WRITE:
+			if (res < 0 && res != -EINTR && res != -EAGAIN) {
+				req->error = -res;
+				Finish(req);
+				return;
+			}
+
+			if (res > 0)
+				req->done += res;
+
+			if (tag == OP_READ) {
+				if (res == 0) {
+					req->data.resize(req->done);
+					Finish(req);
+					return;
+				}
+
+				// the file grew since the statx, keep going until it ends
+				if (req->done == req->data.size())
+					req->data.resize(req->data.size() + (req->data.size() > 8192 ? req->data.size() / 2 : 4096));
+
+				Transfer(req);
+				return;
+			}
+
+			if (res == 0)
+				req->error = EIO;
+
+			if (req->error == 0 && req->done < req->data.size())
+				Transfer(req);
+			else
+				Finish(req);
+			break;
+
+		case OP_CLOSE:
+			if (res < 0 && req->error == 0)
+				req->error = -res;
+
+			if (req->write && req->error == 0) {
+				if (m_bRename) {
+					Rename(req);
+					return;
+				}
+
+				if (rename(req->tmp.c_str(), m_Items[req->index].output.c_str()) != 0)
+					req->error = errno;
+			}
+
+			Complete(req);
+			break;
+
+		case OP_RENAME:
+			if (res < 0)
+				req->error = -res;
+
+			Complete(req);
+			break;
+		}
+	}
+
+	// the ring is unusable, so whatever it still has out is failed. the
+	// requests are leaked rather than freed, the kernel may yet write into
+	// their buffers. the rest of the batch goes through blocking io
+	void Abandon()
+	{
+		std::set<Request *> live;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			live.swap(m_Live);
+			m_iOps = 0;
+		}
+
+		for (std::set<Request *>::iterator it = live.begin(); it != live.end(); ++it) {
+			Request *req = *it;
+			if (req->write) {
+				unlink(req->tmp.c_str());
+				WriteDone(req->index, EIO);
+			} else {
+				std::string none;
+				ReadDone(req->index, none, EIO);
+			}
+		}
+	}
+
+	void Run()
+	{
+		unsigned int limit = m_Ring.Entries() - 1;
+		ArmWake();
+
+		for (;;) {
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+
+				// writes first, they free up memory and unblock the compiler
+				PendingWrite write;
+				while (m_iOps + 1 <= limit && NextWrite(write))
+					StartWrite(write);
+
+				size_t index;
+				while (m_iOps + 2 <= limit && NextRead(index))
+					StartRead(index);
+
+				if (m_bStopping && m_iOps == 0)
+					break;
+			}
+
+			if (!m_Ring.SubmitAndWait()) {
+				fprintf(stderr, "io_uring: %s, falling back to blocking io\n", strerror(errno));
+				Abandon();
+				Serve();
+				return;
+			}
+
+			struct io_uring_cqe cqe;
+			while (m_Ring.Peek(cqe)) {
+				if (cqe.user_data == OP_WAKE) {
+					uint64_t count;
+					ssize_t n = read(m_iEventFd, &count, sizeof(count));
+					(void)n;
+					ArmWake();
+				} else {
+					Handle(cqe);
+				}
+			}
+		}
+	}
+
+	Ring m_Ring;
+	int m_iEventFd;
+	unsigned int m_iOps;	// operations submitted and not yet completed, besides the wake poll
+	bool m_bRename;
+	std::set<Request *> m_Live;	// requests with operations out
+	std::thread m_Thread;
+};
+
+#endif
+
+BatchIO *BatchIO::Create(const std::vector<BatchItem> &items, size_t depth, bool threads)
+{
+	#ifdef GLUAC_HAVE_IO_URING
+	if (!threads) {
+		UringIO *io = new UringIO(items, depth);
+		if (io->Init())
+			return io;
+
+		delete io;
+	}
+	#endif
+
+	return new ThreadIO(items, depth);
+}
@@ -0,0 +1,94 @@
+#ifndef GLUAC_BATCHIO_H
+#define GLUAC_BATCHIO_H
+
+#include "batch.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+// reads batch inputs ahead of the compiler and writes its outputs behind it,
+// so a slow volume costs latency once per window instead of once per file.
+// inputs are read in item order, at most depth of them held at a time
+class BatchIO
+{
+public:
+	// io_uring where the kernel has what's needed unless threads is set, reader threads otherwise
+	static BatchIO *Create(const std::vector<BatchItem> &items, size_t depth, bool threads);
+
+	virtual ~BatchIO() {}
+
+	virtual const char *Name() const = 0;
+
+	// waits for the item's source. each input can only be taken once
+	bool Read(size_t index, std::string &source, std::string &err);
+
+	// queues the item's output to be written atomically, blocking while depth writes are already queued
+	void Write(size_t index, std::string &data);
+
+	// waits for every queued write then stops, returns how many writes failed
+	size_t Finish();
+
+protected:
+	typedef struct {
+		size_t index;
+		std::string data;
+	} PendingWrite;
+
+	BatchIO(const std::vector<BatchItem> &items, size_t depth);
+
+	// lets the transport know there is room to read further ahead or something to write
+	virtual void Wake() = 0;
+
+	// stops and joins the transport once everything has been written
+	virtual void Stop() = 0;
+
+	// called under m_Mutex by the transport to pick up its next piece of work
+	bool NextRead(size_t &index);
+	bool NextWrite(PendingWrite &write);
+
+	void ReadDone(size_t index, std::string &data, int error);
+	void WriteDone(size_t index, int error);
+
+	// plain blocking reads and writes on the calling thread until stopped,
+	// woken through m_Changed
+	void Serve();
+
+	const std::vector<BatchItem> &m_Items;
+	size_t m_iDepth;
+	bool m_bStopping;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_Changed;
+
+private:
+	enum {
+		INPUT_WAITING = 0,
+		INPUT_READING,
+		INPUT_READY,
+		INPUT_TAKEN
+	};
+
+	typedef struct {
+		int state;
+		int error;
+		std::string data;
+	} Input;
+
+	std::vector<Input> m_Inputs;
+	size_t m_iNextRead;
+	size_t m_iBuffered;		// inputs being read or waiting to be taken
+
+	std::deque<PendingWrite> m_Writes;
+	size_t m_iWriting;
+	size_t m_iFailedWrites;
+
+	// directories already created, so each is only made once per batch
+	std::mutex m_DirMutex;
+	std::set<std::string> m_Dirs;
+};
+
+#endif
@@ -0,0 +1,354 @@
+#include "bundle.h"
+#include "compiler.h"
+#include "compress.h"
+#include "embed.h"
+#include "gluac_bundle.h"
+#include "lazy.h"
+#include "order.h"
+#include "workpool.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+
+// blobs start on a page so the data can be mapped or read ahead on its own
+#define BUNDLE_DATA_ALIGN 4096
+
+// displacements tried per bucket before giving up, far more than a real set of names needs
+#define BUNDLE_MAX_DISPLACEMENT (1u << 24)
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+std::string bundle_name(const std::string &path)
+{
+	// the host looks files up by their game path, which never climbs out of
+	// anything, so a ../ left on the front of an input would never match
+	std::string name = batch_output_path("", path.c_str());
+	name.resize(gluac_bundle_normalize(&name[0]));
+	return name;
+}
+
+// hash and displace: names are split into small buckets and each bucket, the
+// biggest first, gets the first displacement that lands all of its names in
+// free slots. a lookup is then one hash, one displacement and one slot
+static bool build_index(const std::vector<uint64_t> &hashes, uint32_t buckets, uint32_t slots, std::vector<uint32_t> &displacements, std::vector<uint32_t> &slotof)
+{
+	std::vector<std::vector<uint32_t> > members(buckets);
+	for (size_t i = 0; i < hashes.size(); i++)
+		members[hashes[i] % buckets].push_back((uint32_t)i);
+
+	std::vector<uint32_t> order(buckets);
+	for (uint32_t i = 0; i < buckets; i++)
+		order[i] = i;
+
+	std::stable_sort(order.begin(), order.end(), [&members](uint32_t a, uint32_t b) {
+		return members[a].size() > members[b].size();
+	});
+
+	displacements.assign(buckets, 0);
+	slotof.assign(hashes.size(), 0);
+
+	std::vector<bool> taken(slots, false);
+	std::vector<uint32_t> tried;
+
+	for (uint32_t b = 0; b < buckets; b++) {
+		const std::vector<uint32_t> &bucket = members[order[b]];
+		if (bucket.empty())
+			break;
+
+		uint32_t d = 0;
+		for (; d < BUNDLE_MAX_DISPLACEMENT; d++) {
+			tried.clear();
+
+			bool fits = true;
+			for (size_t i = 0; i < bucket.size() && fits; i++) {
+				uint32_t slot = gluac_bundle_slot(hashes[bucket[i]], d, slots);
+				fits = !taken[slot] && std::find(tried.begin(), tried.end(), slot) == tried.end();
+				tried.push_back(slot);
+			}
+
+			if (fits)
+				break;
+		}
+
+		if (d == BUNDLE_MAX_DISPLACEMENT)
+			return false;
+
+		displacements[order[b]] = d;
+		for (size_t i = 0; i < bucket.size(); i++) {
+			taken[tried[i]] = true;
+			slotof[bucket[i]] = tried[i];
+		}
+	}
+
+	return true;
+}
+
+bool bundle_build(const std::vector<BundleFile> &files, std::string &image, std::string &err)
+{
+	uint32_t count = (uint32_t)files.size();
+
+	std::unordered_set<std::string> seen;
+	std::vector<uint64_t> hashes(count);
+	uint64_t namebytes = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (files[i].name.empty() || !seen.insert(files[i].name).second) {
+			err = files[i].name.empty() ? "a file has no name in the bundle" : files[i].name + " is in the bundle twice";
+			return false;
+		}
+
+		hashes[i] = gluac_bundle_hash(files[i].name.data(), files[i].name.size());
+		namebytes += files[i].name.size();
+	}
+
+	// a little slack in the slots keeps the search for displacements short
+	uint32_t buckets = count > 0 ? (count + 3) / 4 : 0;
+	uint32_t slots = count > 0 ? count + count / 8 + 1 : 0;
+
+	std::vector<uint32_t> displacements;
+	std::vector<uint32_t> slotof;
+	if (!build_index(hashes, buckets, slots, displacements, slotof)) {
+		err = "cannot build the bundle index";
+		return false;
+	}
+
+	gluac_bundle_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, GLUAC_BUNDLE_MAGIC, 8);
+	header.version = GLUAC_BUNDLE_VERSION;
+	header.count = count;
+	header.buckets = buckets;
+	header.slots = slots;
+	header.displacements = sizeof(header);
+	header.entries = align_up(header.displacements + (uint64_t)buckets * 4, 8);
+	header.order = header.entries + (uint64_t)slots * sizeof(gluac_bundle_entry);
+	header.names = header.order + (uint64_t)count * 4;
+	header.data = align_up(header.names + namebytes, BUNDLE_DATA_ALIGN);
+
+	std::vector<gluac_bundle_entry> entries(slots);
+	memset(entries.data(), 0, entries.size() * sizeof(gluac_bundle_entry));
+
+	std::vector<uint32_t> order(count);
+	uint64_t name = 0;
+	uint64_t offset = header.data;
+
+	for (uint32_t i = 0; i < count; i++) {
+		gluac_bundle_entry &entry = entries[slotof[i]];
+		entry.offset = offset;
+		entry.length = files[i].data.size();
+		entry.rawlength = files[i].rawsize;
+		entry.codec = files[i].codec;
+		entry.hash = gluac_bundle_hash(files[i].data.data(), files[i].data.size());
+		entry.name = (uint32_t)name;
+		entry.namelen = (uint32_t)files[i].name.size();
+
+		order[i] = slotof[i];
+		name += files[i].name.size();
+		offset = align_up(offset + files[i].data.size(), GLUAC_BUNDLE_ALIGN);
+	}
+
+	header.size = count > 0 ? entries[order[count - 1]].offset + entries[order[count - 1]].length : header.data;
+
+	image.clear();
+	image.reserve((size_t)header.size);
+
+	// pads out to the next offset the layout above decided on
+	auto pad_to = [&image](uint64_t to) {
+		if (to > image.size())
+			image.append((size_t)(to - image.size()), '\0');
+	};
+
+	image.append((const char *)&header, sizeof(header));
+	image.append((const char *)displacements.data(), (size_t)buckets * 4);
+
+	pad_to(header.entries);
+	image.append((const char *)entries.data(), slots * sizeof(gluac_bundle_entry));
+	image.append((const char *)order.data(), (size_t)count * 4);
+
+	for (uint32_t i = 0; i < count; i++)
+		image += files[i].name;
+
+	for (uint32_t i = 0; i < count; i++) {
+		pad_to(entries[order[i]].offset);
+		image += files[i].data;
+	}
+
+	pad_to(header.size);
+	return true;
+}
+
+bool bundle_write(const char *path, const std::vector<BundleFile> &files, std::string &err)
+{
+	std::string image;
+	if (!bundle_build(files, image, err))
+		return false;
+
+	if (!write_file_atomic(path, image.data(), image.size())) {
+		err = std::string("cannot write ") + path;
+		return false;
+	}
+
+	return true;
+}
+
+int bundle_main(const std::vector<BatchItem> &items, const char *path, const BundleOptions &options)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<BundleFile> files(items.size());
+	std::vector<BundleFile> stubs(items.size());
+	std::vector<std::vector<std::string> > includes(items.size());
+	std::atomic<size_t> failed(0);
+
+	std::vector<std::string> trace;
+	if (options.order != nullptr && !read_load_trace(options.order, trace)) {
+		fprintf(stderr, "cannot open %s\n", options.order);
+		return 1;
+	}
+
+	std::vector<LazyModule> lazy;
+	std::string err;
+	if (options.lazy != nullptr && !read_lazy_config(options.lazy, lazy, err)) {
+		fprintf(stderr, "%s\n", err.c_str());
+		return 1;
+	}
+
+	std::unordered_map<std::string, const LazyModule *> lazyof;
+	for (size_t i = 0; i < lazy.size(); i++)
+		lazyof[lazy[i].name] = &lazy[i];
+
+	size_t workers = options.batch.workers ? options.batch.workers : std::thread::hardware_concurrency();
+	if (workers > items.size())
+		workers = items.size();
+
+	WorkPool pool(workers ? workers : 1, workers * 4 + 4, 0, options.batch.limits);
+	if (!pool.Start())
+		return 1;
+
+	for (size_t i = 0; i < items.size(); i++) {
+		const BatchItem *item = &items[i];
+		BundleFile *file = &files[i];
+		BundleFile *stub = &stubs[i];
+		std::vector<std::string> *calls = &includes[i];
+
+		pool.Push([item, file, stub, calls, &lazyof, &options, &failed](lua_State *L) {
+			std::string source;
+			std::string err;
+
+			if (!read_file(item->input.c_str(), source)) {
+				fprintf(stderr, "cannot open %s\n", item->input.c_str());
+				failed++;
+				return;
+			}
+
+			CompileJob job = { item->input.c_str(), source.data(), source.size(), item->chunkname.c_str(), options.batch.strip, options.batch.parseonly, write_dump_string, &file->data };
+			if (!compile(L, &job, err)) {
+				fprintf(stderr, "%s\n", err.c_str());
+				failed++;
+				return;
+			}
+
+			file->rawsize = file->data.size();
+			file->codec = compress_blob(file->data, options.batch.compress);
+			file->name = bundle_name(item->output);
+			*calls = lua_includes(source.data(), source.size());
+
+			// the stub is compiled under the module's own chunkname, it's what the server sees of it
+			std::unordered_map<std::string, const LazyModule *>::const_iterator it = lazyof.find(file->name);
+			if (it == lazyof.end())
+				return;
+
+			std::string stubsource = lazy_stub(*it->second);
+			CompileJob stubjob = { item->input.c_str(), stubsource.data(), stubsource.size(), item->chunkname.c_str(), options.batch.strip, options.batch.parseonly, write_dump_string, &stub->data };
+			if (!compile(L, &stubjob, err)) {
+				fprintf(stderr, "%s\n", err.c_str());
+				failed++;
+				return;
+			}
+
+			stub->name = file->name;
+			stub->rawsize = stub->data.size();
+			stub->codec = compress_blob(stub->data, options.batch.compress);
+		});
+	}
+
+	pool.Wait();
+
+	// a module named in the config that isn't here is most likely a typo, and would load eagerly
+	for (size_t i = 0; i < lazy.size() && failed == 0; i++) {
+		bool found = false;
+		for (size_t j = 0; j < files.size() && !found; j++)
+			found = files[j].name == lazy[i].name;
+
+		if (!found) {
+			fprintf(stderr, "lazy module %s isn't in the bundle\n", lazy[i].name.c_str());
+			return 1;
+		}
+	}
+
+	if (failed == 0 && !options.batch.parseonly) {
+		std::vector<std::string> names(files.size());
+		for (size_t i = 0; i < files.size(); i++)
+			names[i] = files[i].name;
+
+		// a lazy module's stub is laid out where the module would be, the
+		// module itself goes at the end with everything that's rarely loaded
+		std::vector<size_t> order = load_order(names, includes, trace);
+		std::vector<BundleFile> laidout;
+		std::vector<BundleFile> cold;
+		laidout.reserve(files.size() + lazy.size());
+
+		for (size_t i = 0; i < order.size(); i++) {
+			BundleFile &file = files[order[i]];
+			if (stubs[order[i]].name.empty()) {
+				laidout.push_back(std::move(file));
+				continue;
+			}
+
+			laidout.push_back(std::move(stubs[order[i]]));
+			file.name += LAZY_SUFFIX;
+			cold.push_back(std::move(file));
+		}
+
+		for (size_t i = 0; i < cold.size(); i++)
+			laidout.push_back(std::move(cold[i]));
+
+		files.swap(laidout);
+
+		std::string image;
+		bool ok = options.symbol != nullptr ?
+			bundle_build(files, image, err) && embed_write(path, image, options.symbol, err) :
+			bundle_write(path, files, err);
+
+		if (!ok) {
+			fprintf(stderr, "%s\n", err.c_str());
+			return 1;
+		}
+	}
+
+	if (options.batch.stats) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		batch_report("bundle", items.size(), failed, elapsed.count());
+
+		if (options.batch.compress != COMPRESS_NONE && failed == 0) {
+			uint64_t raw = 0;
+			uint64_t stored = 0;
+			for (size_t i = 0; i < files.size(); i++) {
+				raw += files[i].rawsize;
+				stored += files[i].data.size();
+			}
+
+			fprintf(stderr, "bundle: %.1f KB of bytecode stored in %.1f KB\n", raw / 1024.0, stored / 1024.0);
+		}
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,41 @@
+#ifndef GLUAC_BUNDLE_H
+#define GLUAC_BUNDLE_H
+
+#include "batch.h"
+
+#include <string>
+#include <vector>
+
+typedef struct {
+	std::string name;	// normalized as gluac_bundle_normalize would
+	std::string data;	// as stored
+	size_t rawsize;		// before compress_blob, the same as data's size when not compressed
+	uint32_t codec;		// GLUAC_CODEC_*
+} BundleFile;
+
+typedef struct {
+	BatchOptions batch;
+	const char *order;		// load order trace to lay files out by, null to work it out from includes
+	const char *lazy;		// config of modules to store behind stubs (see lazy.h), null for none
+	const char *symbol;		// embeds the bundle under this symbol in an object or source file at path (see embed.h), null writes it as it is
+} BundleOptions;
+
+// lays files out as a bundle (see gluac_bundle.h) in image, in the order
+// given. false with err set if they can't be
+bool bundle_build(const std::vector<BundleFile> &files, std::string &image, std::string &err);
+
+// writes files into a bundle at path (see gluac_bundle.h), laid out in the
+// order given. the file is replaced atomically, false with err set on failure
+bool bundle_write(const char *path, const std::vector<BundleFile> &files, std::string &err);
+
+// puts a name into the form bundles store them in, without any . or ..
+std::string bundle_name(const std::string &path);
+
+// compiles every item into one bundle at path, each item's output being its
+// name in the bundle, laid out in load order (see load_order). lazy modules
+// are stored under their name with LAZY_SUFFIX, after everything else, and
+// their stubs take their place. nothing is written if any item fails.
+// returns an exit code
+int bundle_main(const std::vector<BatchItem> &items, const char *path, const BundleOptions &options);
+
+#endif
@@ -0,0 +1,51 @@
+#include "cache.h"
+
+bool ResultCache::Get(uint64_t key, std::string &bytecode)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	std::unordered_map<uint64_t, EntryList::iterator>::iterator it = m_Index.find(key);
+	if (it == m_Index.end())
+		return false;
+
+	m_Entries.splice(m_Entries.begin(), m_Entries, it->second);
+	bytecode = it->second->second;
+	return true;
+}
+
+void ResultCache::Put(uint64_t key, const std::string &bytecode)
+{
+	if (bytecode.size() > m_iMaxBytes)
+		return;
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	std::unordered_map<uint64_t, EntryList::iterator>::iterator it = m_Index.find(key);
+	if (it != m_Index.end()) {
+		m_iBytes -= it->second->second.size();
+		m_Entries.erase(it->second);
+		m_Index.erase(it);
+	}
+
+	m_Entries.push_front(std::make_pair(key, bytecode));
+	m_Index[key] = m_Entries.begin();
+	m_iBytes += bytecode.size();
+
+	while (m_iBytes > m_iMaxBytes) {
+		m_iBytes -= m_Entries.back().second.size();
+		m_Index.erase(m_Entries.back().first);
+		m_Entries.pop_back();
+	}
+}
+
+size_t ResultCache::Bytes()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_iBytes;
+}
+
+size_t ResultCache::Entries()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Entries.size();
+}
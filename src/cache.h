@@ -0,0 +1,35 @@
+#ifndef GLUAC_CACHE_H
+#define GLUAC_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// compiled bytecode kept in memory by key, least recently used entries are
+// dropped once the total size goes over the limit
+class ResultCache
+{
+public:
+	ResultCache(size_t maxbytes) : m_iMaxBytes(maxbytes), m_iBytes(0) {}
+
+	bool Get(uint64_t key, std::string &bytecode);
+	void Put(uint64_t key, const std::string &bytecode);
+
+	size_t Bytes();
+	size_t Entries();
+
+private:
+	typedef std::list<std::pair<uint64_t, std::string> > EntryList;
+
+	size_t m_iMaxBytes;
+	size_t m_iBytes;
+	EntryList m_Entries;	// most recently used first
+	std::unordered_map<uint64_t, EntryList::iterator> m_Index;
+	std::mutex m_Mutex;
+};
+
+#endif
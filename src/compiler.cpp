@@ -0,0 +1,568 @@
+#include "compiler.h"
+#include "lua_jit.h"
+#include "sigscan.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <symbolfinder.hpp>
+
+lua_All_functions LuaFunctions;
+
+typedef int(__cdecl *lj_bcwrite_t) (lua_State *L, void *gcproto, lua_Writer, void *data, int strip);
+lj_bcwrite_t lj_bcwrite = NULL;
+
+#ifdef _WIN32
+// tried in order, the exact prologue first then one with the stack offsets wildcarded
+static const Signature LuaJIT_bcwrite_sigs[] = {
+	{ "\x83\xEC\x24\x8B\x4C\x24\x2C\x8B\x54\x24\x30\x8B\x44\x24\x28\x89", "xxxxxxxxxxxxxxxx", 16 },
+	{ "\x83\xEC\x00\x8B\x4C\x24\x00\x8B\x54\x24\x00\x8B\x44\x24\x00\x89", "xx?xxx?xxx?xxx?x", 16 },
+};
+#else
+static const char *LuaJIT_bcwrite_sym = "@lj_bcwrite";
+static const size_t LuaJIT_bcwrite_symlen = 0;
+#endif
+
+int write_dump(lua_State *L, const void* p, size_t sz, void* ud)
+{
+	wdata *wd = (wdata *)ud;
+
+	char *newData = (char *)realloc(*(wd->data), (*(wd->len)) + sz);
+
+	if (newData)
+	{
+		memcpy(newData + (*(wd->len)), p, sz);
+		*(wd->data) = newData;
+		*(wd->len) += sz;
+	}
+	else {
+		free(newData);
+		return 1;
+	}
+
+	return 0;
+}
+
+int write_dump_string(lua_State *L, const void* p, size_t sz, void* ud)
+{
+	((std::string *)ud)->append((const char *)p, sz);
+	return 0;
+}
+
+int lua_bcwrite(lua_State *L, lua_Writer writer, void *data, bool strip)
+{
+	cTValue *o = L->top - 1;
+	return lj_bcwrite(L, (GCproto *)(mref((&gcval(o)->fn)->l.pc, char) - sizeof(GCproto)), writer, data, strip);
+}
+
+bool load_lua_shared()
+{
+	#ifdef _WIN32
+	HMODULE module = LoadLibrary("lua_shared.dll");
+
+	if (module == nullptr) {
+		fprintf(stderr, "could not find lua_shared\n");
+		return false;
+	}
+	#else
+	void* module = dlopen("lua_shared_srv.so", RTLD_LAZY);
+
+	if (module == nullptr) {
+		fprintf(stderr, "%s\n", dlerror());
+		return false;
+	}
+
+	#endif
+
+	#ifdef _WIN32
+	bool ambiguous;
+	lj_bcwrite = reinterpret_cast<lj_bcwrite_t>(sigscan_module(module, LuaJIT_bcwrite_sigs, sizeof(LuaJIT_bcwrite_sigs) / sizeof(LuaJIT_bcwrite_sigs[0]), &ambiguous));
+	if (ambiguous) {
+		fprintf(stderr, "failed to resolve lj_bcwrite, its signature matches more than one function\n");
+		return false;
+	}
+	#else
+	SymbolFinder symfinder;
+	lj_bcwrite = reinterpret_cast<lj_bcwrite_t>(symfinder.Resolve(module, LuaJIT_bcwrite_sym, LuaJIT_bcwrite_symlen));
+	#endif
+
+	if (lj_bcwrite == nullptr) {
+		fprintf(stderr, "failed to resolve lj_bcwrite\n");
+		return false;
+	}
+
+	return luaL_loadfunctions(module, &LuaFunctions, sizeof(LuaFunctions));
+}
+
+enum {
+	BUDGET_OK = 0,
+	BUDGET_MEMORY,
+	BUDGET_TIME
+};
+
+// sits between a state and its own allocator, counting what the state holds
+// and refusing to grow it once a compile is over its limits
+typedef struct {
+	lua_Alloc allocf;
+	void *allocud;
+	CompileLimits limits;
+	size_t used;
+	size_t ceiling;				// 0 outside of a compile or with no memory limit
+	std::atomic<bool> expired;	// set by the watchdog when the compile's time is up
+	int tripped;
+} StateBudget;
+
+static void *budget_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	StateBudget *budget = (StateBudget *)ud;
+
+	// lua can't cope with a shrink or free failing, so only growth is refused.
+	// the parser allocates constantly, which makes this a cheap place to stop it
+	if (nsize > osize) {
+		if (budget->expired.load(std::memory_order_relaxed)) {
+			budget->tripped = BUDGET_TIME;
+			return nullptr;
+		}
+
+		if (budget->ceiling != 0 && budget->used - osize + nsize > budget->ceiling) {
+			budget->tripped = BUDGET_MEMORY;
+			return nullptr;
+		}
+	}
+
+	void *p = budget->allocf(budget->allocud, ptr, osize, nsize);
+	if (p != nullptr || nsize == 0)
+		budget->used = budget->used - osize + nsize;
+
+	return p;
+}
+
+// one thread shared by every state, it flags compiles that run past their deadline
+class Watchdog
+{
+public:
+	Watchdog() : m_bStarted(false) {}
+
+	void Arm(StateBudget *budget, std::chrono::steady_clock::time_point deadline)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Deadlines[budget] = deadline;
+
+		if (!m_bStarted) {
+			std::thread(&Watchdog::Run, this).detach();
+			m_bStarted = true;
+		}
+
+		m_Changed.notify_one();
+	}
+
+	// once this returns the watchdog won't touch budget again
+	void Disarm(StateBudget *budget)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Deadlines.erase(budget);
+	}
+
+private:
+	void Run()
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+
+		for (;;) {
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			std::chrono::steady_clock::time_point next = std::chrono::steady_clock::time_point::max();
+
+			std::map<StateBudget *, std::chrono::steady_clock::time_point>::iterator it = m_Deadlines.begin();
+			while (it != m_Deadlines.end()) {
+				if (it->second <= now) {
+					it->first->expired = true;
+					it = m_Deadlines.erase(it);
+				} else {
+					if (it->second < next)
+						next = it->second;
+					++it;
+				}
+			}
+
+			if (next == std::chrono::steady_clock::time_point::max())
+				m_Changed.wait(lock);
+			else
+				m_Changed.wait_until(lock, next);
+		}
+	}
+
+	std::mutex m_Mutex;
+	std::condition_variable m_Changed;
+	std::map<StateBudget *, std::chrono::steady_clock::time_point> m_Deadlines;
+	bool m_bStarted;
+};
+
+// never destroyed, its thread is detached and may still be waiting at exit
+static Watchdog *g_pWatchdog = new Watchdog();
+
+static StateBudget *state_budget(lua_State *L)
+{
+	void *ud;
+	if (lua_getallocf(L, &ud) != budget_alloc)
+		return nullptr;
+
+	return (StateBudget *)ud;
+}
+
+static void budget_begin(StateBudget *budget)
+{
+	budget->tripped = BUDGET_OK;
+	budget->expired = false;
+
+	if (budget->limits.memory != 0)
+		budget->ceiling = budget->used + budget->limits.memory;
+
+	if (budget->limits.milliseconds != 0)
+		g_pWatchdog->Arm(budget, std::chrono::steady_clock::now() + std::chrono::milliseconds(budget->limits.milliseconds));
+}
+
+static void budget_end(StateBudget *budget)
+{
+	if (budget->limits.milliseconds != 0)
+		g_pWatchdog->Disarm(budget);
+
+	budget->ceiling = 0;
+	budget->expired = false;
+}
+
+lua_State *compiler_newstate(const CompileLimits *limits)
+{
+	lua_State* L = lua_open();
+	if (L == nullptr) {
+		fprintf(stderr, "cannot create lua state: not enough memory.\n");
+		return nullptr;
+	}
+
+	luaL_openlibs(L);
+
+	if (limits != nullptr && (limits->memory != 0 || limits->milliseconds != 0)) {
+		// wrapping the state's own allocator rather than handing lua_newstate
+		// a new one, which 64-bit luajit refuses
+		StateBudget *budget = new StateBudget();
+		budget->allocf = lua_getallocf(L, &budget->allocud);
+		budget->limits = *limits;
+		budget->used = (size_t)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+		budget->ceiling = 0;
+		budget->expired = false;
+		budget->tripped = BUDGET_OK;
+		lua_setallocf(L, budget_alloc, budget);
+	}
+
+	return L;
+}
+
+void compiler_close(lua_State *L)
+{
+	StateBudget *budget = state_budget(L);
+	lua_close(L);
+	delete budget;
+}
+
+bool compiler_exhausted(lua_State *L)
+{
+	StateBudget *budget = state_budget(L);
+	return budget != nullptr && budget->tripped != BUDGET_OK;
+}
+
+static int compile_protected(lua_State* L)
+{
+	const CompileJob *job = (const CompileJob *)lua_touserdata(L, 1);
+
+	// load our Lua file as a chunk on the stack (if filename is NULL it loads from stdin)
+	int status;
+	if (job->buffer != nullptr) {
+		status = luaL_loadbuffer(L, job->buffer, job->size, job->chunkname);
+	} else {
+		status = luaL_loadfile(L, job->filename);
+	}
+
+	if (status != 0) {
+		return lua_error(L);
+	}
+
+	// return early if we only want parsing
+	if (job->parseonly) {
+		return 0;
+	}
+
+	if (lua_bcwrite(L, job->writer, job->data, job->strip)) {
+		lua_pushstring(L, "failed to dump bytecode");
+		return lua_error(L);
+	}
+
+	return 0;
+}
+
+bool compile(lua_State *L, const CompileJob *job, std::string &err)
+{
+	StateBudget *budget = state_budget(L);
+	if (budget != nullptr)
+		budget_begin(budget);
+
+	int top = lua_gettop(L);
+	bool ok = lua_cpcall(L, compile_protected, (void *)job) == 0;
+
+	if (budget != nullptr)
+		budget_end(budget);
+
+	if (!ok && budget != nullptr && budget->tripped != BUDGET_OK) {
+		// lua only knows an allocation failed, say which limit it was
+		const char *name = job->buffer != nullptr ? job->chunkname : job->filename;
+		if (name == nullptr)
+			name = "stdin";
+		else if (*name == '@' || *name == '=')
+			name++;
+
+		char msg[64];
+		if (budget->tripped == BUDGET_TIME)
+			snprintf(msg, sizeof(msg), "exceeded the %u ms time limit", budget->limits.milliseconds);
+		else
+			snprintf(msg, sizeof(msg), "exceeded the %u MB memory limit", (unsigned int)(budget->limits.memory >> 20));
+
+		err = std::string(name) + ": " + msg;
+	} else if (!ok) {
+		const char *msg = lua_tostring(L, -1);
+		err = msg != nullptr ? msg : "unknown error";
+	}
+
+	lua_settop(L, top);
+	return ok;
+}
+
+bool compile_to_file(lua_State *L, const char *input, const char *output, bool strip, bool parseonly, std::string &err, const char *chunkname)
+{
+	char* bytecode = 0L;
+	size_t len = 0;
+	wdata wd = { &len, &bytecode };
+
+	CompileJob job = { input, nullptr, 0, nullptr, strip, parseonly, write_dump, &wd };
+
+	// luaL_loadfile names it after input, anything else has to go through a buffer
+	std::string source;
+	if (chunkname != nullptr) {
+		if (!read_file(input, source)) {
+			err = std::string("cannot open ") + input;
+			return false;
+		}
+
+		job.buffer = source.data();
+		job.size = source.size();
+		job.chunkname = chunkname;
+	}
+
+	bool ok = compile(L, &job, err);
+	if (ok && !parseonly && !(make_parent_dirs(output) && write_file_atomic(output, bytecode, len))) {
+		err = std::string("cannot write ") + output;
+		ok = false;
+	}
+
+	free(bytecode);
+	return ok;
+}
+
+static bool is_absolute(const std::string &path)
+{
+	return (!path.empty() && path[0] == '/') || (path.size() > 1 && path[1] == ':');
+}
+
+// resolves "." and ".." without touching the filesystem, so it means the same on any machine
+static std::string clean_path(std::string path)
+{
+	for (size_t i = 0; i < path.size(); i++) {
+		if (path[i] == '\\')
+			path[i] = '/';
+	}
+
+	bool absolute = is_absolute(path);
+	std::vector<std::string> parts;
+	size_t pos = 0;
+
+	while (pos <= path.size()) {
+		size_t end = path.find('/', pos);
+		if (end == std::string::npos)
+			end = path.size();
+
+		std::string part = path.substr(pos, end - pos);
+		pos = end + 1;
+
+		if (part.empty() || part == ".")
+			continue;
+
+		if (part == ".." && !parts.empty() && parts.back() != "..")
+			parts.pop_back();
+		else if (part != ".." || !absolute)
+			parts.push_back(part);
+	}
+
+	std::string clean = absolute && path[0] == '/' ? "/" : "";
+	for (size_t i = 0; i < parts.size(); i++) {
+		if (i > 0)
+			clean += '/';
+		clean += parts[i];
+	}
+
+	return clean;
+}
+
+static std::string absolute_path(const std::string &path)
+{
+	if (is_absolute(path))
+		return clean_path(path);
+
+	char cwd[4096];
+	#ifdef _WIN32
+	if (GetCurrentDirectoryA(sizeof(cwd), cwd) == 0)
+	#else
+	if (getcwd(cwd, sizeof(cwd)) == nullptr)
+	#endif
+		return clean_path(path);
+
+	return clean_path(std::string(cwd) + "/" + path);
+}
+
+std::string make_chunkname(const char *path, const ChunknameOptions &options)
+{
+	if (!options.name.empty())
+		return options.name;
+
+	if (path == nullptr)
+		return "=stdin";
+
+	if (options.relative.empty() && options.strip.empty())
+		return std::string("@") + path;
+
+	std::string name = clean_path(path);
+
+	if (!options.relative.empty()) {
+		std::string from = absolute_path(name);
+		std::string base = absolute_path(options.relative);
+		if (base.size() > 1)
+			base += '/';
+
+		// walk up out of base until what's left is a prefix of the path
+		std::string up;
+		while (from.compare(0, base.size(), base) != 0) {
+			size_t slash = base.find_last_of('/', base.size() - 2);
+			if (slash == std::string::npos)
+				break;
+
+			base.erase(slash + 1);
+			up += "../";
+		}
+
+		name = up + from.substr(from.compare(0, base.size(), base) == 0 ? base.size() : 0);
+	}
+
+	for (size_t i = 0; i < options.strip.size(); i++) {
+		std::string prefix = clean_path(options.strip[i]);
+
+		// whole directories only, "lua" doesn't strip "luarocks/"
+		if (!prefix.empty() && name.compare(0, prefix.size(), prefix) == 0 &&
+			(name.size() == prefix.size() || name[prefix.size()] == '/' || prefix[prefix.size() - 1] == '/')) {
+			name.erase(0, prefix.size());
+			while (!name.empty() && name[0] == '/')
+				name.erase(0, 1);
+			break;
+		}
+	}
+
+	return "@" + name;
+}
+
+bool read_file(const char *filename, std::string &out)
+{
+	FILE *f = fopen(filename, "rb");
+	if (f == nullptr)
+		return false;
+
+	char buffer[16384];
+	size_t n;
+	out.clear();
+
+	while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		out.append(buffer, n);
+
+	bool ok = ferror(f) == 0;
+	fclose(f);
+	return ok;
+}
+
+std::string temp_filename(const char *filename, const char *tag)
+{
+	static std::atomic<unsigned int> counter(0);
+
+	// unique per process and per call so parallel writers never share a temporary
+	#ifdef _WIN32
+	unsigned long pid = GetCurrentProcessId();
+	#else
+	unsigned long pid = (unsigned long)getpid();
+	#endif
+
+	std::string tmp = filename;
+	tmp += ".tmp." + (tag != nullptr ? std::string(tag) : std::to_string(pid));
+	tmp += "." + std::to_string(counter++);
+
+	return tmp;
+}
+
+bool write_file_atomic(const char *filename, const char *data, size_t len, const char *tag)
+{
+	std::string tmp = temp_filename(filename, tag);
+
+	FILE *f = fopen(tmp.c_str(), "wb");
+	if (f == nullptr)
+		return false;
+
+	bool ok = fwrite(data, 1, len, f) == len;
+	ok = fclose(f) == 0 && ok;
+
+	#ifdef _WIN32
+	ok = ok && MoveFileEx(tmp.c_str(), filename, MOVEFILE_REPLACE_EXISTING);
+	#else
+	ok = ok && rename(tmp.c_str(), filename) == 0;
+	#endif
+
+	if (!ok)
+		remove(tmp.c_str());
+
+	return ok;
+}
+
+bool make_parent_dirs(const char *filename)
+{
+	std::string path = filename;
+
+	for (size_t i = 1; i < path.size(); i++) {
+		if (path[i] != '/' && path[i] != '\\')
+			continue;
+
+		std::string dir = path.substr(0, i);
+		#ifdef _WIN32
+		if (!CreateDirectory(dir.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+			return false;
+		#else
+		if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+			return false;
+		#endif
+	}
+
+	return true;
+}
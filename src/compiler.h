@@ -0,0 +1,89 @@
+#ifndef GLUAC_COMPILER_H
+#define GLUAC_COMPILER_H
+
+#include "lua_dyn.h"
+
+#include <string>
+#include <vector>
+
+#define LUA_PREFIX LuaFunctions.
+extern lua_All_functions LuaFunctions;
+
+typedef struct {
+	size_t *len;
+	char **data;
+} wdata;
+
+// a single chunk to compile, either from memory or from a file on disk
+typedef struct {
+	const char *filename;	// read when buffer is null, null reads stdin
+	const char *buffer;
+	size_t size;
+	const char *chunkname;	// only used with buffer, e.g "@lua/autorun/init.lua"
+	bool strip;
+	bool parseonly;
+	lua_Writer writer;
+	void *data;
+} CompileJob;
+
+// limits each compile on a state is held to, zero leaves that one unlimited
+typedef struct {
+	size_t memory;				// bytes a compile may allocate on top of what the state already holds
+	unsigned int milliseconds;	// wall-clock time a compile may run for
+} CompileLimits;
+
+// how inputs are named in errors and debug information. left empty a file
+// is "@path" with the path as it was given, which is what luaL_loadfile does.
+// the chunkname is the only thing about an input besides its source and the
+// strip flag that ends up in the bytecode, so pinning it down makes output
+// the same whichever machine, directory or worker it was compiled from
+typedef struct {
+	std::string name;					// used for every input when set
+	std::string relative;				// paths are made relative to this directory
+	std::vector<std::string> strip;		// leading directories removed from the path, the first that matches
+} ChunknameOptions;
+
+bool load_lua_shared();
+
+// creates a state ready for compiling, prints an error and returns null on failure.
+// a compile that goes over the limits fails with an error saying which one
+lua_State *compiler_newstate(const CompileLimits *limits = nullptr);
+
+// closes a state made by compiler_newstate
+void compiler_close(lua_State *L);
+
+// true when the last compile on L was cut off by its limits. the state may
+// have been stopped part way through anything, so it should be replaced
+bool compiler_exhausted(lua_State *L);
+
+// appends dumped bytecode to the wdata buffer passed as ud
+int write_dump(lua_State *L, const void* p, size_t sz, void* ud);
+
+// appends dumped bytecode to the std::string passed as ud
+int write_dump_string(lua_State *L, const void* p, size_t sz, void* ud);
+
+// parses the job's source and dumps its bytecode through the job's writer.
+// the stack is left as it was, on failure the error is copied into err
+bool compile(lua_State *L, const CompileJob *job, std::string &err);
+
+// compiles input and writes the bytecode to output. a null chunkname names it as luaL_loadfile would
+bool compile_to_file(lua_State *L, const char *input, const char *output, bool strip, bool parseonly, std::string &err, const char *chunkname = nullptr);
+
+// names path per options, null being stdin. with relative or strip set the
+// path is cleaned up first: forward slashes, no "." or "dir/.." segments
+std::string make_chunkname(const char *path, const ChunknameOptions &options);
+
+bool read_file(const char *filename, std::string &out);
+
+// a name next to filename that no other writer will pick. the pid only
+// tells writers on the same machine apart, a directory other machines write
+// into too needs a tag naming this one (the spool passes host.pid)
+std::string temp_filename(const char *filename, const char *tag = nullptr);
+
+// writes to a temporary file next to filename then renames it into place, tag as for temp_filename
+bool write_file_atomic(const char *filename, const char *data, size_t len, const char *tag = nullptr);
+
+// creates every missing directory leading up to filename
+bool make_parent_dirs(const char *filename);
+
+#endif
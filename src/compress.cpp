@@ -0,0 +1,256 @@
+#include "compress.h"
+#include "gluac_bundle.h"
+
+#include <string.h>
+
+#include <vector>
+
+// the lz4 block format: runs of literals each followed by a match of at
+// least 4 bytes up to 64 KB back. the last 5 bytes are always literals and
+// the last match starts at least 12 bytes before the end, which decoders
+// that copy in words rely on
+#define LZ4_MIN_MATCH		4
+#define LZ4_LAST_LITERALS	5
+#define LZ4_MATCH_LIMIT		12
+#define LZ4_MAX_OFFSET		65535
+
+#define LZ4_FAST_HASH_BITS	12
+#define LZ4_HIGH_HASH_BITS	16
+#define LZ4_HIGH_ATTEMPTS	256
+
+bool parse_compress_level(const char *name, int &level)
+{
+	if (strcmp(name, "fast") == 0)
+		level = COMPRESS_FAST;
+	else if (strcmp(name, "high") == 0)
+		level = COMPRESS_HIGH;
+	else
+		return false;
+
+	return true;
+}
+
+static uint32_t read32(const unsigned char *p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint32_t hash4(const unsigned char *p, int bits)
+{
+	return (read32(p) * 2654435761u) >> (32 - bits);
+}
+
+static void write_length(std::string &out, size_t length)
+{
+	while (length >= 255) {
+		out.push_back((char)255);
+		length -= 255;
+	}
+
+	out.push_back((char)length);
+}
+
+// literals then a match, or just literals when length is 0
+static void write_sequence(std::string &out, const unsigned char *literals, size_t count, size_t offset, size_t length)
+{
+	size_t extra = length ? length - LZ4_MIN_MATCH : 0;
+	out.push_back((char)(((count >= 15 ? 15 : count) << 4) | (extra >= 15 ? 15 : extra)));
+
+	if (count >= 15)
+		write_length(out, count - 15);
+
+	out.append((const char *)literals, count);
+
+	if (length == 0)
+		return;
+
+	out.push_back((char)(offset & 0xff));
+	out.push_back((char)(offset >> 8));
+
+	if (extra >= 15)
+		write_length(out, extra - 15);
+}
+
+static size_t match_length(const unsigned char *src, size_t p, size_t candidate, size_t limit)
+{
+	size_t length = 0;
+	while (p + length < limit && src[p + length] == src[candidate + length])
+		length++;
+
+	return length;
+}
+
+static void compress_fast(const unsigned char *src, size_t len, std::string &out)
+{
+	std::vector<uint32_t> table((size_t)1 << LZ4_FAST_HASH_BITS, 0);
+	size_t limit = len - LZ4_LAST_LITERALS;
+	size_t anchor = 0;
+	size_t p = 0;
+
+	while (p + LZ4_MATCH_LIMIT <= len) {
+		uint32_t h = hash4(src + p, LZ4_FAST_HASH_BITS);
+		size_t candidate = table[h];
+		table[h] = (uint32_t)p;
+
+		if (candidate >= p || p - candidate > LZ4_MAX_OFFSET || read32(src + candidate) != read32(src + p)) {
+			// the longer nothing matches the faster it skips ahead, as lz4 does
+			p += 1 + ((p - anchor) >> 6);
+			continue;
+		}
+
+		while (p > anchor && candidate > 0 && src[p - 1] == src[candidate - 1]) {
+			p--;
+			candidate--;
+		}
+
+		size_t length = match_length(src, p, candidate, limit);
+		write_sequence(out, src + anchor, p - anchor, p - candidate, length);
+
+		p += length;
+		anchor = p;
+
+		if (p + LZ4_MATCH_LIMIT <= len)
+			table[hash4(src + p - 2, LZ4_FAST_HASH_BITS)] = (uint32_t)(p - 2);
+	}
+
+	write_sequence(out, src + anchor, len - anchor, 0, 0);
+}
+
+// every position is chained to the last one with the same hash, and each
+// chain is followed back up to LZ4_HIGH_ATTEMPTS times for the longest match.
+// the tables are sized to the input, most bytecode is a few KB
+class MatchFinder
+{
+public:
+	MatchFinder(const unsigned char *src, size_t len) :
+		m_pSrc(src),
+		m_iNext(0),
+		m_iBits(10),
+		m_iMask(1023)
+	{
+		while (m_iBits < LZ4_HIGH_HASH_BITS && ((size_t)1 << m_iBits) < len)
+			m_iBits++;
+		while (m_iMask < LZ4_MAX_OFFSET && m_iMask < len)
+			m_iMask = m_iMask * 2 + 1;
+
+		m_Head.assign((size_t)1 << m_iBits, -1);
+		m_Chain.assign(m_iMask + 1, -1);
+	}
+
+	size_t Find(size_t p, size_t limit, size_t &offset)
+	{
+		for (; m_iNext < p; m_iNext++) {
+			uint32_t h = hash4(m_pSrc + m_iNext, m_iBits);
+			m_Chain[m_iNext & m_iMask] = m_Head[h];
+			m_Head[h] = (int64_t)m_iNext;
+		}
+
+		size_t best = 0;
+		int64_t candidate = m_Head[hash4(m_pSrc + p, m_iBits)];
+
+		for (int attempts = LZ4_HIGH_ATTEMPTS; candidate >= 0 && attempts > 0; attempts--) {
+			size_t c = (size_t)candidate;
+			if (p - c > LZ4_MAX_OFFSET)
+				break;
+
+			// checking the byte that would make it longer first skips most candidates cheaply
+			if (p + best < limit && m_pSrc[c + best] == m_pSrc[p + best] && read32(m_pSrc + c) == read32(m_pSrc + p)) {
+				size_t length = match_length(m_pSrc, p, c, limit);
+				if (length > best) {
+					best = length;
+					offset = p - c;
+				}
+			}
+
+			// slots are reused every 64 KB, an entry newer than this one means the chain has run out
+			int64_t next = m_Chain[c & m_iMask];
+			if (next >= candidate)
+				break;
+			candidate = next;
+		}
+
+		return best >= LZ4_MIN_MATCH ? best : 0;
+	}
+
+private:
+	const unsigned char *m_pSrc;
+	size_t m_iNext;
+	int m_iBits;
+	size_t m_iMask;
+	std::vector<int64_t> m_Head;
+	std::vector<int64_t> m_Chain;
+};
+
+static void compress_high(const unsigned char *src, size_t len, std::string &out)
+{
+	MatchFinder finder(src, len);
+	size_t limit = len - LZ4_LAST_LITERALS;
+	size_t anchor = 0;
+	size_t p = 0;
+
+	while (p + LZ4_MATCH_LIMIT <= len) {
+		size_t offset = 0;
+		size_t length = finder.Find(p, limit, offset);
+		if (length == 0) {
+			p++;
+			continue;
+		}
+
+		// a longer match starting one byte later is worth a literal
+		while (p + 1 + LZ4_MATCH_LIMIT <= len) {
+			size_t nextoffset = 0;
+			size_t next = finder.Find(p + 1, limit, nextoffset);
+			if (next <= length)
+				break;
+
+			p++;
+			length = next;
+			offset = nextoffset;
+		}
+
+		write_sequence(out, src + anchor, p - anchor, offset, length);
+		p += length;
+		anchor = p;
+	}
+
+	write_sequence(out, src + anchor, len - anchor, 0, 0);
+}
+
+bool lz4_compress(const char *data, size_t len, int level, std::string &out)
+{
+	out.clear();
+	if (len <= LZ4_MATCH_LIMIT)
+		return false;
+
+	out.reserve(len);
+
+	if (level == COMPRESS_HIGH)
+		compress_high((const unsigned char *)data, len, out);
+	else
+		compress_fast((const unsigned char *)data, len, out);
+
+	return out.size() < len;
+}
+
+uint32_t compress_blob(std::string &data, int level)
+{
+	std::string compressed;
+	if (level == COMPRESS_NONE || !lz4_compress(data.data(), data.size(), level, compressed))
+		return GLUAC_CODEC_NONE;
+
+	data.swap(compressed);
+	return GLUAC_CODEC_LZ4;
+}
+
+void compress_frame(std::string &data, int level)
+{
+	gluac_frame_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, GLUAC_FRAME_MAGIC, 8);
+	header.rawlength = data.size();
+	header.codec = compress_blob(data, level);
+
+	data.insert(0, (const char *)&header, sizeof(header));
+}
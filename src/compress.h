@@ -0,0 +1,30 @@
+#ifndef GLUAC_COMPRESS_H
+#define GLUAC_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+enum {
+	COMPRESS_NONE = 0,
+	COMPRESS_FAST,	// greedy, one probe per position, for loading
+	COMPRESS_HIGH	// hash chains and lazy matching, for shipping
+};
+
+// parses the argument to --compress, false if it isn't fast or high
+bool parse_compress_level(const char *name, int &level);
+
+// compresses data into an lz4 block (readable by gluac_lz4_decompress).
+// false when that wouldn't make it any smaller
+bool lz4_compress(const char *data, size_t len, int level, std::string &out);
+
+// replaces data with its compressed form if that's smaller, and returns the
+// codec (GLUAC_CODEC_*) it ended up stored with
+uint32_t compress_blob(std::string &data, int level);
+
+// compresses data as compress_blob does and puts a frame header in front,
+// so a loader can tell it from plain bytecode with gluac_frame_open
+void compress_frame(std::string &data, int level);
+
+#endif
@@ -0,0 +1,96 @@
+#include "coprocess.h"
+#include "daemon.h"
+#include "frame.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+static bool coprocess_respond(uint32_t id, uint32_t status, const std::string &data)
+{
+	std::string payload;
+	payload.reserve(data.size() + 8);
+	frame_put_u32(payload, id);
+	frame_put_u32(payload, status);
+	payload += data;
+
+	return frame_write(1, payload);
+}
+
+// compiles the request into bytecode, or fills err with the diagnostics
+static bool coprocess_compile(lua_State *L, DaemonRequest &req, std::string &bytecode, std::string &err)
+{
+	if (!(req.flags & DAEMON_FLAG_INLINE) && !read_file(req.path.c_str(), req.source)) {
+		err = "cannot open " + req.path;
+		return false;
+	}
+
+	// named as the plain file and stdin paths would name it
+	if (req.chunkname.empty())
+		req.chunkname = (req.flags & DAEMON_FLAG_INLINE) ? "=stdin" : "@" + req.path;
+
+	CompileJob job = { nullptr, req.source.data(), req.source.size(), req.chunkname.c_str(),
+		(req.flags & DAEMON_FLAG_STRIP) != 0, (req.flags & DAEMON_FLAG_PARSEONLY) != 0, write_dump_string, &bytecode };
+
+	if (!compile(L, &job, err))
+		return false;
+
+	if (!req.outpath.empty() && !job.parseonly) {
+		if (!(make_parent_dirs(req.outpath.c_str()) && write_file_atomic(req.outpath.c_str(), bytecode.data(), bytecode.size()))) {
+			err = "cannot write " + req.outpath;
+			return false;
+		}
+
+		bytecode.clear();
+	}
+
+	return true;
+}
+
+int coprocess_main(const CompileLimits &limits)
+{
+	#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+	#endif
+
+	lua_State *L = compiler_newstate(&limits);
+	if (L == nullptr)
+		return 1;
+
+	std::string frame;
+	int status = 0;
+
+	// a closed stdin is the normal way to be told to stop
+	while (frame_read(0, frame)) {
+		DaemonRequest req;
+		if (!daemon_parse_request(frame, req)) {
+			fprintf(stderr, "coprocess: malformed request\n");
+			status = 1;
+			break;
+		}
+
+		std::string bytecode;
+		std::string err;
+		bool ok = coprocess_compile(L, req, bytecode, err);
+
+		if (!coprocess_respond(req.id, ok ? DAEMON_STATUS_OK : DAEMON_STATUS_ERROR, ok ? bytecode : err)) {
+			status = 1;
+			break;
+		}
+
+		if (compiler_exhausted(L)) {
+			lua_State *fresh = compiler_newstate(&limits);
+			if (fresh != nullptr) {
+				compiler_close(L);
+				L = fresh;
+			}
+		}
+	}
+
+	compiler_close(L);
+	return status;
+}
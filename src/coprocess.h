@@ -0,0 +1,13 @@
+#ifndef GLUAC_COPROCESS_H
+#define GLUAC_COPROCESS_H
+
+#include "compiler.h"
+
+// answers requests framed as described in daemon.h, read from stdin with the
+// responses written to stdout, one at a time on a single state. this lets a
+// build tool keep one gluac alive over a pair of pipes instead of a socket.
+// DAEMON_FLAG_MEMFD and DAEMON_FLAG_INTERACTIVE are ignored. returns an exit
+// code once stdin is closed
+int coprocess_main(const CompileLimits &limits);
+
+#endif
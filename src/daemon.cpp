@@ -0,0 +1,762 @@
+#include "daemon.h"
+#include "compiler.h"
+#include "frame.h"
+
+#include <stdio.h>
+
+bool daemon_parse_request(const std::string &frame, DaemonRequest &req)
+{
+	FrameReader reader(frame);
+
+	return reader.GetU32(req.id) && reader.GetU32(req.flags) &&
+		reader.GetStr(req.chunkname) && reader.GetStr(req.path) &&
+		reader.GetStr(req.source) && reader.GetStr(req.outpath);
+}
+
+#ifdef _WIN32
+
+std::string daemon_default_socket()
+{
+	return std::string();
+}
+
+int daemon_main(const DaemonOptions &options)
+{
+	fprintf(stderr, "daemon mode is not supported on this platform\n");
+	return 1;
+}
+
+int daemon_remote(const char *socketpath, const char *input, const char *output, const std::string &chunkname, bool strip, bool parseonly, bool interactive)
+{
+	return -1;
+}
+
+int daemon_remote_batch(const char *socketpath, const std::vector<BatchItem> &items, const BatchOptions &options, bool interactive)
+{
+	return -1;
+}
+
+#else
+
+#include "cache.h"
+#include "hash.h"
+#include "lexer.h"
+#include "metrics.h"
+#include "workpool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <set>
+
+// how long a worker waits on a client that isn't reading its responses
+#define DAEMON_SEND_TIMEOUT_SECONDS 10
+
+class Connection
+{
+public:
+	Connection(int fd) : m_iFd(fd) {}
+	~Connection() { close(m_iFd); }
+
+	int Fd() const { return m_iFd; }
+
+	// responses from different workers may interleave, so each one is sent whole
+	void Respond(uint32_t id, uint32_t status, const char *data, size_t len)
+	{
+		std::string payload;
+		payload.reserve(len + 8);
+		frame_put_u32(payload, id);
+		frame_put_u32(payload, status);
+		payload.append(data, len);
+
+		std::lock_guard<std::mutex> lock(m_WriteLock);
+		if (!frame_write(m_iFd, payload))
+			Drop();
+	}
+
+	void RespondFd(uint32_t id, int fd, size_t len)
+	{
+		std::string payload;
+		frame_put_u32(payload, id);
+		frame_put_u32(payload, DAEMON_STATUS_OK_FD);
+		frame_put_u32(payload, (uint32_t)len);
+
+		std::lock_guard<std::mutex> lock(m_WriteLock);
+		if (!frame_write_fd(m_iFd, payload, fd))
+			Drop();
+	}
+
+private:
+	// a client that stopped reading (the send timed out) or went away gets
+	// nothing more, the reader sees the connection end and later responses
+	// fail straight away instead of each holding a worker for the timeout
+	void Drop()
+	{
+		shutdown(m_iFd, SHUT_RDWR);
+	}
+
+	int m_iFd;
+	std::mutex m_WriteLock;
+};
+
+typedef struct {
+	std::atomic<unsigned long long> requests[PRIORITY_COUNT];
+	std::atomic<unsigned long long> failures[PRIORITY_COUNT];
+	std::atomic<unsigned long long> cachehits;
+	std::atomic<unsigned long long> cachemisses;
+	std::atomic<unsigned long long> bytesin;
+	std::atomic<unsigned long long> bytesout;
+	Histogram latency[PRIORITY_COUNT];
+} DaemonMetrics;
+
+static DaemonMetrics g_Metrics;
+static ResultCache *g_pCache = nullptr;
+
+static volatile sig_atomic_t g_bDaemonStop = 0;
+
+static std::mutex g_ReadersLock;
+static std::condition_variable g_ReadersDone;
+static std::set<Connection *> g_Readers;
+
+static void daemon_signal(int)
+{
+	g_bDaemonStop = 1;
+}
+
+static int memfd_open()
+{
+#ifdef SYS_memfd_create
+	return (int)syscall(SYS_memfd_create, "gluac", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+typedef struct {
+	int fd;
+	std::string *copy;	// also kept here for the cache, may be null
+} MemfdSink;
+
+static int memfd_dump(lua_State *L, const void* p, size_t sz, void* ud)
+{
+	MemfdSink *sink = (MemfdSink *)ud;
+
+	if (sink->copy != nullptr)
+		sink->copy->append((const char *)p, sz);
+
+	return write_all(sink->fd, p, sz) ? 0 : 1;
+}
+
+static uint64_t cache_key(const DaemonRequest &req)
+{
+	bool strip = (req.flags & DAEMON_FLAG_STRIP) != 0;
+
+	// keyed on the tokens rather than the bytes, so an edit to comments or
+	// spacing (or to lines, when stripping) is still a hit
+	uint64_t key = token_hash(req.source.data(), req.source.size(), strip, strip);
+
+	// stripped bytecode doesn't carry the chunkname so it can be shared
+	if (!strip)
+		key = hash64(req.chunkname.c_str(), req.chunkname.size() + 1, key);
+
+	return key;
+}
+
+static void respond_error(Connection &conn, const DaemonRequest &req, const std::string &err)
+{
+	conn.Respond(req.id, DAEMON_STATUS_ERROR, err.data(), err.size());
+}
+
+// dumps into a memfd so the bytecode never passes through our own buffers or
+// the socket, returns false if memfds aren't available and the caller should
+// fall back to sending the bytes
+static bool handle_request_memfd(lua_State *L, Connection &conn, DaemonRequest &req, const CompileJob &base, std::string &bytecode, uint64_t key, bool cached, bool &ok)
+{
+	int fd = memfd_open();
+	if (fd < 0)
+		return false;
+
+	if (cached) {
+		ok = write_all(fd, bytecode.data(), bytecode.size());
+	} else {
+		MemfdSink sink = { fd, g_pCache != nullptr ? &bytecode : nullptr };
+		CompileJob job = base;
+		job.writer = memfd_dump;
+		job.data = &sink;
+
+		std::string err;
+		ok = compile(L, &job, err);
+		if (!ok) {
+			respond_error(conn, req, err);
+			close(fd);
+			return true;
+		}
+
+		if (g_pCache != nullptr)
+			g_pCache->Put(key, bytecode);
+	}
+
+	off_t len = lseek(fd, 0, SEEK_CUR);
+	g_Metrics.bytesout += len;
+
+	// the client gets a read only view it can trust not to change under it
+	#ifdef F_ADD_SEALS
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+	#endif
+
+	if (ok)
+		conn.RespondFd(req.id, fd, (size_t)len);
+	else
+		respond_error(conn, req, "failed to write bytecode");
+
+	close(fd);
+	return true;
+}
+
+static bool process_request(lua_State *L, Connection &conn, DaemonRequest &req)
+{
+	if (!(req.flags & DAEMON_FLAG_INLINE) && !read_file(req.path.c_str(), req.source)) {
+		respond_error(conn, req, "cannot open " + req.path);
+		return false;
+	}
+
+	g_Metrics.bytesin += req.source.size();
+
+	std::string bytecode;
+	CompileJob job = { nullptr, req.source.data(), req.source.size(), req.chunkname.c_str(),
+		(req.flags & DAEMON_FLAG_STRIP) != 0, (req.flags & DAEMON_FLAG_PARSEONLY) != 0, write_dump_string, &bytecode };
+
+	std::string err;
+	if (job.parseonly) {
+		if (!compile(L, &job, err)) {
+			respond_error(conn, req, err);
+			return false;
+		}
+
+		conn.Respond(req.id, DAEMON_STATUS_OK, nullptr, 0);
+		return true;
+	}
+
+	uint64_t key = g_pCache != nullptr ? cache_key(req) : 0;
+	bool cached = g_pCache != nullptr && g_pCache->Get(key, bytecode);
+	if (cached)
+		g_Metrics.cachehits++;
+	else
+		g_Metrics.cachemisses++;
+
+	bool ok;
+	if ((req.flags & DAEMON_FLAG_MEMFD) && req.outpath.empty() && handle_request_memfd(L, conn, req, job, bytecode, key, cached, ok))
+		return ok;
+
+	if (!cached) {
+		if (!compile(L, &job, err)) {
+			respond_error(conn, req, err);
+			return false;
+		}
+
+		if (g_pCache != nullptr)
+			g_pCache->Put(key, bytecode);
+	}
+
+	g_Metrics.bytesout += bytecode.size();
+
+	if (req.outpath.empty()) {
+		conn.Respond(req.id, DAEMON_STATUS_OK, bytecode.data(), bytecode.size());
+		return true;
+	}
+
+	if (!write_file_atomic(req.outpath.c_str(), bytecode.data(), bytecode.size())) {
+		respond_error(conn, req, "cannot write " + req.outpath);
+		return false;
+	}
+
+	conn.Respond(req.id, DAEMON_STATUS_OK, nullptr, 0);
+	return true;
+}
+
+static void handle_request(lua_State *L, Connection &conn, DaemonRequest &req)
+{
+	int lane = (req.flags & DAEMON_FLAG_INTERACTIVE) ? PRIORITY_INTERACTIVE : PRIORITY_BATCH;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	if (!process_request(L, conn, req))
+		g_Metrics.failures[lane]++;
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	g_Metrics.requests[lane]++;
+	g_Metrics.latency[lane].Observe(elapsed.count());
+}
+
+static void connection_reader(std::shared_ptr<Connection> conn, WorkPool *pool)
+{
+	std::string frame;
+
+	while (frame_read(conn->Fd(), frame)) {
+		std::shared_ptr<DaemonRequest> req(new DaemonRequest);
+		if (!daemon_parse_request(frame, *req)) {
+			fprintf(stderr, "daemon: malformed request\n");
+			break;
+		}
+
+		// blocks when the queue is full, which stops us reading from this client
+		pool->Push([conn, req](lua_State *L) {
+			handle_request(L, *conn, *req);
+		}, (req->flags & DAEMON_FLAG_INTERACTIVE) ? PRIORITY_INTERACTIVE : PRIORITY_BATCH);
+	}
+
+	std::lock_guard<std::mutex> lock(g_ReadersLock);
+	g_Readers.erase(conn.get());
+	g_ReadersDone.notify_all();
+}
+
+static bool fill_address(const char *socketpath, struct sockaddr_un &addr)
+{
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if (strlen(socketpath) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "socket path too long: %s\n", socketpath);
+		return false;
+	}
+
+	strcpy(addr.sun_path, socketpath);
+	return true;
+}
+
+static int connect_socket(const char *socketpath)
+{
+	struct sockaddr_un addr;
+	if (!fill_address(socketpath, addr))
+		return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+std::string daemon_default_socket()
+{
+	const char *env = getenv("GLUAC_SOCKET");
+	if (env != nullptr && *env)
+		return env;
+
+	const char *runtime = getenv("XDG_RUNTIME_DIR");
+	if (runtime != nullptr && *runtime)
+		return std::string(runtime) + "/gluac.sock";
+
+	return "/tmp/gluac-" + std::to_string(getuid()) + ".sock";
+}
+
+static void report_lane(const char *name, const LaneStats &stats)
+{
+	double jobs = stats.jobs ? (double)stats.jobs : 1.0;
+
+	fprintf(stderr, "%s: %llu requests, queue wait avg %.2f ms max %.2f ms, compile avg %.2f ms\n", name,
+		stats.jobs, stats.waitseconds * 1000.0 / jobs, stats.maxwaitseconds * 1000.0, stats.runseconds * 1000.0 / jobs);
+}
+
+static std::string render_metrics(WorkPool *pool)
+{
+	static const char *lanes[PRIORITY_COUNT] = { "lane=\"interactive\"", "lane=\"batch\"" };
+	std::string out;
+
+	metrics_header(out, "gluac_requests_total", "counter", "Compile requests handled.");
+	for (int i = 0; i < PRIORITY_COUNT; i++)
+		metrics_sample(out, "gluac_requests_total", lanes[i], (double)g_Metrics.requests[i]);
+
+	metrics_header(out, "gluac_request_failures_total", "counter", "Compile requests that failed.");
+	for (int i = 0; i < PRIORITY_COUNT; i++)
+		metrics_sample(out, "gluac_request_failures_total", lanes[i], (double)g_Metrics.failures[i]);
+
+	metrics_header(out, "gluac_queue_depth", "gauge", "Requests waiting for a worker.");
+	for (int i = 0; i < PRIORITY_COUNT; i++)
+		metrics_sample(out, "gluac_queue_depth", lanes[i], (double)pool->QueueDepth(i));
+
+	metrics_header(out, "gluac_queue_wait_seconds", "summary", "Time requests spent queued before a worker took them.");
+	for (int i = 0; i < PRIORITY_COUNT; i++) {
+		LaneStats stats = pool->GetStats(i);
+		metrics_sample(out, "gluac_queue_wait_seconds_sum", lanes[i], stats.waitseconds);
+		metrics_sample(out, "gluac_queue_wait_seconds_count", lanes[i], (double)stats.jobs);
+	}
+
+	metrics_header(out, "gluac_compile_seconds", "histogram", "Time from a worker taking a request to its response.");
+	for (int i = 0; i < PRIORITY_COUNT; i++)
+		g_Metrics.latency[i].Write(out, "gluac_compile_seconds", lanes[i]);
+
+	metrics_header(out, "gluac_cache_hits_total", "counter", "Requests answered from the result cache.");
+	metrics_sample(out, "gluac_cache_hits_total", "", (double)g_Metrics.cachehits);
+	metrics_header(out, "gluac_cache_misses_total", "counter", "Requests that had to be compiled.");
+	metrics_sample(out, "gluac_cache_misses_total", "", (double)g_Metrics.cachemisses);
+	metrics_header(out, "gluac_cache_bytes", "gauge", "Bytecode held in the result cache.");
+	metrics_sample(out, "gluac_cache_bytes", "", g_pCache != nullptr ? (double)g_pCache->Bytes() : 0.0);
+
+	metrics_header(out, "gluac_source_bytes_total", "counter", "Source bytes received.");
+	metrics_sample(out, "gluac_source_bytes_total", "", (double)g_Metrics.bytesin);
+	metrics_header(out, "gluac_bytecode_bytes_total", "counter", "Bytecode bytes returned or written.");
+	metrics_sample(out, "gluac_bytecode_bytes_total", "", (double)g_Metrics.bytesout);
+
+	std::vector<WorkerStatus> workers = pool->GetWorkers();
+
+	metrics_header(out, "gluac_worker_memory_bytes", "gauge", "Memory used by each worker's lua_State after its last request.");
+	for (size_t i = 0; i < workers.size(); i++) {
+		std::string labels = "worker=\"" + std::to_string(i) + "\"";
+		metrics_sample(out, "gluac_worker_memory_bytes", labels.c_str(), (double)workers[i].memory);
+	}
+
+	metrics_header(out, "gluac_worker_busy", "gauge", "Whether each worker is compiling right now.");
+	for (size_t i = 0; i < workers.size(); i++) {
+		std::string labels = "worker=\"" + std::to_string(i) + "\",reserved=\"" + (workers[i].reserved ? "1" : "0") + "\"";
+		metrics_sample(out, "gluac_worker_busy", labels.c_str(), workers[i].busy ? 1.0 : 0.0);
+	}
+
+	metrics_header(out, "gluac_worker_recycled_total", "counter", "States each worker replaced after a request went over its time or memory limit.");
+	for (size_t i = 0; i < workers.size(); i++) {
+		std::string labels = "worker=\"" + std::to_string(i) + "\"";
+		metrics_sample(out, "gluac_worker_recycled_total", labels.c_str(), (double)workers[i].recycled);
+	}
+
+	return out;
+}
+
+int daemon_main(const DaemonOptions &options)
+{
+	const char *socketpath = options.socketpath;
+	size_t workers = options.workers;
+	int reserved = options.reserved;
+
+	struct sockaddr_un addr;
+	if (!fill_address(socketpath, addr))
+		return 1;
+
+	// a socket file nobody answers on is left over from a daemon that died
+	int existing = connect_socket(socketpath);
+	if (existing >= 0) {
+		close(existing);
+		fprintf(stderr, "a daemon is already listening on %s\n", socketpath);
+		return 1;
+	}
+	unlink(socketpath);
+
+	// the socket is created owner-only, there's no moment another user could connect
+	int listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	mode_t mask = umask(077);
+	bool bound = listenfd >= 0 && bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+	int binderr = errno;
+	umask(mask);
+
+	if (!bound || chmod(socketpath, 0600) != 0 || listen(listenfd, 64) != 0) {
+		fprintf(stderr, "cannot listen on %s: %s\n", socketpath, strerror(bound ? errno : binderr));
+		if (bound)
+			unlink(socketpath);
+		if (listenfd >= 0)
+			close(listenfd);
+		return 1;
+	}
+
+	// only the main thread takes the stop signals, it waits for them in ppoll
+	sigset_t blocked, original;
+	sigemptyset(&blocked);
+	sigaddset(&blocked, SIGINT);
+	sigaddset(&blocked, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &blocked, &original);
+	sigdelset(&original, SIGINT);
+	sigdelset(&original, SIGTERM);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = daemon_signal;
+	sigaction(SIGINT, &sa, nullptr);
+	sigaction(SIGTERM, &sa, nullptr);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (workers == 0)
+		workers = std::thread::hardware_concurrency();
+
+	if (reserved < 0)
+		reserved = workers > 1 ? 1 : 0;
+
+	WorkPool *pool = new WorkPool(workers, workers * 4, (size_t)reserved, options.limits);
+	if (!pool->Start()) {
+		delete pool;
+		unlink(socketpath);
+		return 1;
+	}
+
+	if (options.cachebytes > 0)
+		g_pCache = new ResultCache(options.cachebytes);
+
+	MetricsServer metrics;
+	if (options.metrics != nullptr && !metrics.Start(options.metrics, [pool]() { return render_metrics(pool); })) {
+		delete pool;
+		unlink(socketpath);
+		return 1;
+	}
+
+	fprintf(stderr, "gluac daemon listening on %s with %u workers\n", socketpath, (unsigned int)pool->Size());
+
+	while (!g_bDaemonStop) {
+		struct pollfd pfd = { listenfd, POLLIN, 0 };
+		if (ppoll(&pfd, 1, nullptr, &original) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		int fd = accept4(listenfd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		struct timeval timeout = { DAEMON_SEND_TIMEOUT_SECONDS, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		std::shared_ptr<Connection> conn(new Connection(fd));
+		{
+			std::lock_guard<std::mutex> lock(g_ReadersLock);
+			g_Readers.insert(conn.get());
+		}
+
+		std::thread(connection_reader, conn, pool).detach();
+	}
+
+	unlink(socketpath);
+	close(listenfd);
+
+	// wake every reader up so nothing can push into the pool once it's gone
+	{
+		std::unique_lock<std::mutex> lock(g_ReadersLock);
+		for (std::set<Connection *>::iterator it = g_Readers.begin(); it != g_Readers.end(); ++it)
+			shutdown((*it)->Fd(), SHUT_RDWR);
+
+		while (!g_Readers.empty())
+			g_ReadersDone.wait(lock);
+	}
+
+	metrics.Stop();
+
+	report_lane("interactive", pool->GetStats(PRIORITY_INTERACTIVE));
+	report_lane("batch", pool->GetStats(PRIORITY_BATCH));
+
+	delete pool;
+	delete g_pCache;
+	g_pCache = nullptr;
+	return 0;
+}
+
+static std::string absolute_path(const char *path)
+{
+	if (path[0] == '/')
+		return path;
+
+	char cwd[4096];
+	if (getcwd(cwd, sizeof(cwd)) == nullptr)
+		return path;
+
+	return std::string(cwd) + "/" + path;
+}
+
+// copies within the kernel where it can, falling back to read/write for
+// destinations sendfile doesn't support
+static bool copy_fd(int in, int out, size_t len)
+{
+	off_t offset = 0;
+
+	while ((size_t)offset < len) {
+		ssize_t n = sendfile(out, in, &offset, len - (size_t)offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+	}
+
+	char buffer[16384];
+	while ((size_t)offset < len) {
+		ssize_t n = pread(in, buffer, sizeof(buffer), offset);
+		if (n <= 0 || !write_all(out, buffer, (size_t)n))
+			return false;
+		offset += n;
+	}
+
+	return true;
+}
+
+int daemon_remote(const char *socketpath, const char *input, const char *output, const std::string &chunkname, bool strip, bool parseonly, bool interactive)
+{
+	int fd = connect_socket(socketpath);
+	if (fd < 0)
+		return -1;
+
+	uint32_t flags = (strip ? DAEMON_FLAG_STRIP : 0) | (parseonly ? DAEMON_FLAG_PARSEONLY : 0) | (interactive ? DAEMON_FLAG_INTERACTIVE : 0);
+	std::string path, source, outpath;
+
+	if (input != nullptr) {
+		path = absolute_path(input);
+	} else {
+		char buffer[16384];
+		size_t n;
+		while ((n = fread(buffer, 1, sizeof(buffer), stdin)) > 0)
+			source.append(buffer, n);
+
+		flags |= DAEMON_FLAG_INLINE;
+	}
+
+	if (output != nullptr)
+		outpath = absolute_path(output);
+	else
+		flags |= DAEMON_FLAG_MEMFD;
+
+	std::string request;
+	frame_put_u32(request, 1);
+	frame_put_u32(request, flags);
+	frame_put_str(request, chunkname);
+	frame_put_str(request, path);
+	frame_put_str(request, source);
+	frame_put_str(request, outpath);
+
+	std::string response;
+	int resultfd = -1;
+	if (!frame_write(fd, request) || !frame_read_fd(fd, response, &resultfd)) {
+		close(fd);
+		fprintf(stderr, "lost connection to the daemon\n");
+		return 1;
+	}
+	close(fd);
+
+	FrameReader reader(response);
+	uint32_t id, status;
+	if (!reader.GetU32(id) || !reader.GetU32(status)) {
+		fprintf(stderr, "malformed response from the daemon\n");
+		return 1;
+	}
+
+	if (status == DAEMON_STATUS_OK_FD) {
+		uint32_t len;
+		bool ok = resultfd >= 0 && reader.GetU32(len) && copy_fd(resultfd, STDOUT_FILENO, len);
+
+		if (resultfd >= 0)
+			close(resultfd);
+
+		if (!ok) {
+			fprintf(stderr, "failed to copy bytecode from the daemon\n");
+			return 1;
+		}
+
+		return 0;
+	}
+
+	if (resultfd >= 0)
+		close(resultfd);
+
+	if (status != DAEMON_STATUS_OK) {
+		fprintf(stderr, "%.*s\n", (int)reader.RestSize(), reader.Rest());
+		return 1;
+	}
+
+	if (outpath.empty() && !parseonly) {
+		fwrite(reader.Rest(), reader.RestSize(), 1, stdout);
+		fflush(stdout);
+	}
+
+	return 0;
+}
+
+int daemon_remote_batch(const char *socketpath, const std::vector<BatchItem> &items, const BatchOptions &options, bool interactive)
+{
+	int fd = connect_socket(socketpath);
+	if (fd < 0)
+		return -1;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	uint32_t flags = (options.strip ? DAEMON_FLAG_STRIP : 0) | (options.parseonly ? DAEMON_FLAG_PARSEONLY : 0) | (interactive ? DAEMON_FLAG_INTERACTIVE : 0);
+
+	// items whose output directory can't be made are failed here, before
+	// anything is sent, so the receiver knows how many responses to expect
+	size_t failed = 0;
+	std::vector<bool> skip(items.size(), false);
+	for (size_t i = 0; i < items.size(); i++) {
+		if (!make_parent_dirs(items[i].output.c_str())) {
+			fprintf(stderr, "cannot write %s\n", items[i].output.c_str());
+			skip[i] = true;
+			failed++;
+		}
+	}
+
+	size_t expected = items.size() - failed;
+
+	// requests are sent from another thread so the daemon is never stuck
+	// writing responses to us while we are stuck writing requests to it
+	std::thread sender([&]() {
+		for (size_t i = 0; i < items.size(); i++) {
+			if (skip[i])
+				continue;
+
+			std::string request;
+			frame_put_u32(request, (uint32_t)i);
+			frame_put_u32(request, flags);
+			frame_put_str(request, items[i].chunkname);
+			frame_put_str(request, absolute_path(items[i].input.c_str()));
+			frame_put_str(request, "");
+			frame_put_str(request, absolute_path(items[i].output.c_str()));
+
+			// wakes the receiver, which counts everything unanswered as lost
+			if (!frame_write(fd, request)) {
+				shutdown(fd, SHUT_RDWR);
+				break;
+			}
+		}
+	});
+
+	size_t received = 0;
+	std::string response;
+
+	for (; received < expected && frame_read(fd, response); received++) {
+		FrameReader reader(response);
+		uint32_t id, status;
+		if (!reader.GetU32(id) || !reader.GetU32(status))
+			break;
+
+		if (status != DAEMON_STATUS_OK) {
+			fprintf(stderr, "%.*s\n", (int)reader.RestSize(), reader.Rest());
+			failed++;
+		}
+	}
+
+	if (received < expected) {
+		fprintf(stderr, "lost connection to the daemon\n");
+		failed += expected - received;
+	}
+
+	shutdown(fd, SHUT_RDWR);
+	sender.join();
+	close(fd);
+
+	if (options.stats) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		batch_report("remote", items.size(), failed, elapsed.count());
+	}
+
+	return failed ? 1 : 0;
+}
+
+#endif
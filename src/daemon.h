@@ -0,0 +1,66 @@
+#ifndef GLUAC_DAEMON_H
+#define GLUAC_DAEMON_H
+
+#include "batch.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// request: u32 id, u32 flags, str chunkname, str path, str source, str outpath
+// response: u32 id, u32 status, then the bytecode or error message
+//
+// requests may be pipelined, responses come back in completion order and are
+// matched up by id. when outpath is set the daemon writes the bytecode there
+// itself and the response carries no payload
+//
+// with DAEMON_FLAG_MEMFD the bytecode is dumped straight into a sealed memfd
+// that is passed back with the response (status DAEMON_STATUS_OK_FD, payload
+// is the u32 size) so the client can sendfile it wherever it needs to go
+
+#define DAEMON_FLAG_STRIP		(1 << 0)
+#define DAEMON_FLAG_PARSEONLY	(1 << 1)
+#define DAEMON_FLAG_INLINE		(1 << 2)	// compile source instead of reading path
+#define DAEMON_FLAG_MEMFD		(1 << 3)
+#define DAEMON_FLAG_INTERACTIVE	(1 << 4)	// jumps ahead of queued batch requests
+
+#define DAEMON_STATUS_OK		0
+#define DAEMON_STATUS_ERROR		1
+#define DAEMON_STATUS_OK_FD		2
+
+typedef struct {
+	uint32_t id;
+	uint32_t flags;
+	std::string chunkname;
+	std::string path;
+	std::string source;
+	std::string outpath;
+} DaemonRequest;
+
+// decodes a request frame, false if it is malformed
+bool daemon_parse_request(const std::string &frame, DaemonRequest &req);
+
+std::string daemon_default_socket();
+
+typedef struct {
+	const char *socketpath;
+	size_t workers;		// 0 uses one per core
+	int reserved;		// workers that only take interactive requests, -1 reserves one when there are several
+	const char *metrics;	// where to serve prometheus metrics, null for nowhere
+	size_t cachebytes;	// memory for caching results, 0 disables the cache
+	CompileLimits limits;
+} DaemonOptions;
+
+// serves compile requests on the options' socket until interrupted
+int daemon_main(const DaemonOptions &options);
+
+// compiles input (null for stdin) through a running daemon, writing to output
+// or stdout. returns -1 if no daemon could be reached, otherwise an exit code
+int daemon_remote(const char *socketpath, const char *input, const char *output, const std::string &chunkname, bool strip, bool parseonly, bool interactive);
+
+// pipelines every item to a running daemon, which writes the outputs itself.
+// returns -1 if no daemon could be reached, otherwise an exit code
+int daemon_remote_batch(const char *socketpath, const std::vector<BatchItem> &items, const BatchOptions &options, bool interactive);
+
+#endif
@@ -0,0 +1,564 @@
+#include "delta.h"
+#include "compiler.h"
+#include "compress.h"
+#include "gluac_bundle.h"
+#include "hash.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define DELTA_MAGIC			"GLUACDLT"
+#define DELTA_VERSION		1
+
+// bytes per indexed block of the old file, doubled for big files to keep the index small
+#define DELTA_BLOCK			16
+#define DELTA_MAX_BLOCKS	(1 << 20)
+#define DELTA_CANDIDATES	8
+
+// multiplier of the polynomial rolling hash
+#define DELTA_PRIME			0x01000193u
+
+enum {
+	DELTA_ADD = 1,
+	DELTA_REMOVE,
+	DELTA_PATCH,	// changed, stored as a delta against the old file
+	DELTA_REPLACE	// changed so much the delta wasn't any smaller
+};
+
+typedef struct {
+	int op;
+	std::string path;
+	uint64_t oldhash;
+	uint64_t newhash;
+	uint64_t newsize;
+	std::string payload;	// the new file, or the delta to it
+} DeltaRecord;
+
+static void put_varint(std::string &out, uint64_t value)
+{
+	while (value >= 0x80) {
+		out.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+
+	out.push_back((char)value);
+}
+
+static bool get_varint(const char *&p, const char *end, uint64_t &value)
+{
+	value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (p == end)
+			return false;
+
+		unsigned char c = (unsigned char)*p++;
+		value |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+static void put_u64(std::string &out, uint64_t value)
+{
+	out.append((const char *)&value, 8);
+}
+
+static bool get_u64(const char *&p, const char *end, uint64_t &value)
+{
+	if (end - p < 8)
+		return false;
+
+	memcpy(&value, p, 8);
+	p += 8;
+	return true;
+}
+
+static uint32_t block_hash(const unsigned char *p, size_t len)
+{
+	uint32_t h = 0;
+	for (size_t i = 0; i < len; i++)
+		h = h * DELTA_PRIME + p[i];
+
+	return h;
+}
+
+// the hash's low bits only see the low bits of each byte, so buckets come from the top ones
+static size_t hash_bucket(uint32_t h, int bits)
+{
+	return (size_t)((h * 2654435761u) >> (32 - bits));
+}
+
+// ops are a varint of length << 1 | kind: kind 0 is that many literal bytes
+// following, kind 1 a copy of that many bytes from the varint offset in old
+static void put_literal(std::string &out, const unsigned char *p, size_t len)
+{
+	if (len == 0)
+		return;
+
+	put_varint(out, (uint64_t)len << 1);
+	out.append((const char *)p, len);
+}
+
+void delta_encode(const std::string &old, const std::string &now, std::string &out)
+{
+	const unsigned char *src = (const unsigned char *)old.data();
+	const unsigned char *dst = (const unsigned char *)now.data();
+	size_t oldlen = old.size();
+	size_t newlen = now.size();
+
+	size_t block = DELTA_BLOCK;
+	while (oldlen / block > DELTA_MAX_BLOCKS)
+		block *= 2;
+
+	if (oldlen < block || newlen < block) {
+		put_literal(out, dst, newlen);
+		return;
+	}
+
+	// every whole block of old, chained by hash
+	size_t blocks = oldlen / block;
+	int bits = 4;
+	while (((size_t)1 << bits) < blocks * 2)
+		bits++;
+
+	std::vector<int64_t> heads((size_t)1 << bits, -1);
+	std::vector<int64_t> chain(blocks, -1);
+	for (size_t b = 0; b < blocks; b++) {
+		size_t bucket = hash_bucket(block_hash(src + b * block, block), bits);
+		chain[b] = heads[bucket];
+		heads[bucket] = (int64_t)b;
+	}
+
+	// P^(block-1), to take the byte leaving the window back out of the hash
+	uint32_t top = 1;
+	for (size_t i = 1; i < block; i++)
+		top *= DELTA_PRIME;
+
+	size_t literal = 0;
+	size_t pos = 0;
+	uint32_t h = block_hash(dst, block);
+
+	while (pos + block <= newlen) {
+		size_t bestlen = 0;
+		size_t bestold = 0;
+		size_t bestnew = 0;
+		int tries = DELTA_CANDIDATES;
+
+		for (int64_t b = heads[hash_bucket(h, bits)]; b >= 0 && tries > 0; b = chain[(size_t)b], tries--) {
+			size_t o = (size_t)b * block;
+			if (memcmp(src + o, dst + pos, block) != 0)
+				continue;
+
+			// grow the match both ways, backwards only into bytes not yet written out
+			size_t start = pos;
+			size_t from = o;
+			while (start > literal && from > 0 && src[from - 1] == dst[start - 1]) {
+				start--;
+				from--;
+			}
+
+			size_t length = pos - start + block;
+			while (start + length < newlen && from + length < oldlen && src[from + length] == dst[start + length])
+				length++;
+
+			if (length > bestlen) {
+				bestlen = length;
+				bestold = from;
+				bestnew = start;
+			}
+		}
+
+		if (bestlen == 0) {
+			if (pos + block < newlen)
+				h = (h - dst[pos] * top) * DELTA_PRIME + dst[pos + block];
+			pos++;
+			continue;
+		}
+
+		put_literal(out, dst + literal, bestnew - literal);
+		put_varint(out, ((uint64_t)bestlen << 1) | 1);
+		put_varint(out, bestold);
+
+		pos = bestnew + bestlen;
+		literal = pos;
+		if (pos + block <= newlen)
+			h = block_hash(dst + pos, block);
+	}
+
+	put_literal(out, dst + literal, newlen - literal);
+}
+
+bool delta_decode(const std::string &old, const char *delta, size_t len, std::string &now)
+{
+	const char *p = delta;
+	const char *end = delta + len;
+	now.clear();
+
+	while (p < end) {
+		uint64_t op;
+		if (!get_varint(p, end, op))
+			return false;
+
+		uint64_t length = op >> 1;
+		if (op & 1) {
+			uint64_t offset;
+			if (!get_varint(p, end, offset) || offset > old.size() || length > old.size() - offset)
+				return false;
+
+			now.append(old, (size_t)offset, (size_t)length);
+		} else {
+			if (length > (uint64_t)(end - p))
+				return false;
+
+			now.append(p, (size_t)length);
+			p += length;
+		}
+	}
+
+	return true;
+}
+
+// diffs one file that is in both trees, leaving op at 0 when it's unchanged
+static bool diff_file(const std::string &oldpath, const std::string &newpath, DeltaRecord &record)
+{
+	std::string old, now;
+	if (!read_file(oldpath.c_str(), old)) {
+		fprintf(stderr, "cannot open %s\n", oldpath.c_str());
+		return false;
+	}
+
+	if (!read_file(newpath.c_str(), now)) {
+		fprintf(stderr, "cannot open %s\n", newpath.c_str());
+		return false;
+	}
+
+	record.oldhash = hash64(old.data(), old.size());
+	record.newhash = hash64(now.data(), now.size());
+	record.newsize = now.size();
+
+	if (old == now) {
+		record.op = 0;
+		return true;
+	}
+
+	delta_encode(old, now, record.payload);
+	record.op = DELTA_PATCH;
+
+	if (record.payload.size() >= now.size()) {
+		record.payload.swap(now);
+		record.op = DELTA_REPLACE;
+	}
+
+	return true;
+}
+
+static std::string tree_path(const char *dir, const std::string &relative)
+{
+	std::string path = dir;
+	if (!path.empty() && path[path.size() - 1] != '/')
+		path += '/';
+
+	return path + relative;
+}
+
+int delta_main(const char *olddir, const char *newdir, const char *patch, const DeltaOptions &options)
+{
+	std::vector<std::string> oldfiles, newfiles;
+	if (!walk_tree(olddir, options.walk, oldfiles) || !walk_tree(newdir, options.walk, newfiles))
+		return 1;
+
+	// both lists are sorted, so one pass pairs them up
+	std::vector<DeltaRecord> records;
+	size_t i = 0, j = 0;
+	while (i < oldfiles.size() || j < newfiles.size()) {
+		DeltaRecord record = { 0, "", 0, 0, 0, "" };
+
+		if (j == newfiles.size() || (i < oldfiles.size() && oldfiles[i] < newfiles[j])) {
+			record.op = DELTA_REMOVE;
+			record.path = oldfiles[i++];
+		} else if (i == oldfiles.size() || newfiles[j] < oldfiles[i]) {
+			record.op = DELTA_ADD;
+			record.path = newfiles[j++];
+		} else {
+			record.op = DELTA_PATCH;
+			record.path = newfiles[j++];
+			i++;
+		}
+
+		records.push_back(record);
+	}
+
+	size_t workers = options.workers ? options.workers : std::thread::hardware_concurrency();
+	if (workers == 0)
+		workers = 1;
+
+	std::atomic<size_t> next(0);
+	std::atomic<size_t> failed(0);
+	std::vector<std::thread> threads;
+
+	for (size_t t = 0; t < workers; t++) {
+		threads.push_back(std::thread([&]() {
+			for (size_t k = next++; k < records.size(); k = next++) {
+				DeltaRecord &record = records[k];
+				bool ok = true;
+
+				if (record.op == DELTA_PATCH) {
+					ok = diff_file(tree_path(olddir, record.path), tree_path(newdir, record.path), record);
+				} else if (record.op == DELTA_ADD) {
+					ok = read_file(tree_path(newdir, record.path).c_str(), record.payload);
+					record.newhash = hash64(record.payload.data(), record.payload.size());
+					record.newsize = record.payload.size();
+				} else {
+					std::string old;
+					ok = read_file(tree_path(olddir, record.path).c_str(), old);
+					record.oldhash = hash64(old.data(), old.size());
+				}
+
+				if (!ok) {
+					fprintf(stderr, "cannot diff %s\n", record.path.c_str());
+					failed++;
+				}
+			}
+		}));
+	}
+
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+
+	if (failed)
+		return 1;
+
+	size_t counts[DELTA_REPLACE + 1] = { 0 };
+	size_t stored = 0;
+
+	std::string out(DELTA_MAGIC);
+	uint32_t version = DELTA_VERSION;
+	out.append((const char *)&version, 4);
+	put_varint(out, records.size());
+
+	for (size_t k = 0; k < records.size(); k++) {
+		const DeltaRecord &record = records[k];
+		counts[record.op]++;
+		if (record.op == 0)
+			continue;
+
+		out.push_back((char)record.op);
+		put_varint(out, record.path.size());
+		out += record.path;
+
+		if (record.op != DELTA_ADD)
+			put_u64(out, record.oldhash);
+
+		if (record.op != DELTA_REMOVE) {
+			put_u64(out, record.newhash);
+			put_varint(out, record.newsize);
+			put_varint(out, record.payload.size());
+			out += record.payload;
+			stored += record.payload.size();
+		}
+	}
+
+	// a record with op 0 ends the list, the count up front is only a size hint
+	out.push_back(0);
+
+	if (options.compress != COMPRESS_NONE)
+		compress_frame(out, options.compress);
+
+	if (!write_file_atomic(patch, out.data(), out.size())) {
+		fprintf(stderr, "cannot write %s\n", patch);
+		return 1;
+	}
+
+	if (options.stats) {
+		fprintf(stderr, "delta: %u added, %u removed, %u patched, %u replaced, %u unchanged, %.1f KB of data in a %.1f KB patch\n",
+			(unsigned int)counts[DELTA_ADD], (unsigned int)counts[DELTA_REMOVE], (unsigned int)counts[DELTA_PATCH],
+			(unsigned int)counts[DELTA_REPLACE], (unsigned int)counts[0], stored / 1024.0, out.size() / 1024.0);
+	}
+
+	return 0;
+}
+
+// patches name paths relative to the tree, anything that could leave it is refused
+static bool safe_path(const std::string &path)
+{
+	if (path.empty() || path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'))
+		return false;
+
+	size_t start = 0;
+	while (start <= path.size()) {
+		size_t end = path.find_first_of("/\\", start);
+		if (end == std::string::npos)
+			end = path.size();
+
+		if (path.compare(start, end - start, "..") == 0)
+			return false;
+
+		start = end + 1;
+	}
+
+	return true;
+}
+
+static bool parse_patch(const std::string &data, std::vector<DeltaRecord> &records)
+{
+	const char *p = data.data();
+	const char *end = p + data.size();
+	uint32_t version;
+	uint64_t count;
+
+	if (data.size() < 12 || memcmp(p, DELTA_MAGIC, 8) != 0)
+		return false;
+
+	memcpy(&version, p + 8, 4);
+	p += 12;
+	if (version != DELTA_VERSION || !get_varint(p, end, count))
+		return false;
+
+	for (;;) {
+		if (p == end)
+			return false;
+
+		DeltaRecord record = { (unsigned char)*p++, "", 0, 0, 0, "" };
+		if (record.op == 0)
+			return p == end;
+		if (record.op > DELTA_REPLACE)
+			return false;
+
+		uint64_t len;
+		if (!get_varint(p, end, len) || len > (uint64_t)(end - p))
+			return false;
+
+		record.path.assign(p, (size_t)len);
+		p += len;
+		if (!safe_path(record.path))
+			return false;
+
+		if (record.op != DELTA_ADD && !get_u64(p, end, record.oldhash))
+			return false;
+
+		if (record.op != DELTA_REMOVE) {
+			if (!get_u64(p, end, record.newhash) || !get_varint(p, end, record.newsize) || !get_varint(p, end, len) || len > (uint64_t)(end - p))
+				return false;
+
+			record.payload.assign(p, (size_t)len);
+			p += len;
+		}
+
+		records.push_back(record);
+	}
+}
+
+int delta_apply(const char *patch, const char *dir, bool stats)
+{
+	std::string data;
+	if (!read_file(patch, data)) {
+		fprintf(stderr, "cannot open %s\n", patch);
+		return 1;
+	}
+
+	gluac_bundle_file frame;
+	if (gluac_frame_open(data.data(), data.size(), &frame)) {
+		// lz4 can't expand a block more than 255 times, anything claiming
+		// more is corrupt and mustn't get as far as the allocation
+		if (frame.rawsize / 255 > frame.size) {
+			fprintf(stderr, "%s is corrupt\n", patch);
+			return 1;
+		}
+
+		std::string raw(frame.rawsize, '\0');
+		if (!gluac_bundle_read(&frame, &raw[0])) {
+			fprintf(stderr, "%s is corrupt\n", patch);
+			return 1;
+		}
+
+		data.swap(raw);
+	}
+
+	std::vector<DeltaRecord> records;
+	if (!parse_patch(data, records)) {
+		fprintf(stderr, "%s isn't a gluac patch or is corrupt\n", patch);
+		return 1;
+	}
+
+	// the whole tree is checked before anything is written, so a patch for
+	// some other build is refused without leaving the tree half patched.
+	// files already in their new state are skipped, so an apply that was
+	// cut short can be run again
+	std::vector<bool> applied(records.size(), false);
+	size_t mismatched = 0;
+
+	for (size_t i = 0; i < records.size(); i++) {
+		const DeltaRecord &record = records[i];
+		std::string path = tree_path(dir, record.path);
+		std::string current;
+		bool exists = read_file(path.c_str(), current);
+		uint64_t hash = hash64(current.data(), current.size());
+
+		if (record.op == DELTA_REMOVE ? !exists : exists && hash == record.newhash && current.size() == record.newsize) {
+			applied[i] = true;
+			continue;
+		}
+
+		// an added file that's already there with other content is someone's, not the patch's to replace
+		if (record.op == DELTA_ADD ? exists : !exists || hash != record.oldhash) {
+			fprintf(stderr, "%s doesn't match the tree the patch was made from\n", path.c_str());
+			mismatched++;
+		}
+	}
+
+	if (mismatched)
+		return 1;
+
+	size_t written = 0;
+	size_t removed = 0;
+	for (size_t i = 0; i < records.size(); i++) {
+		const DeltaRecord &record = records[i];
+		std::string path = tree_path(dir, record.path);
+		if (applied[i])
+			continue;
+
+		if (record.op == DELTA_REMOVE) {
+			if (remove(path.c_str()) != 0) {
+				fprintf(stderr, "cannot remove %s\n", path.c_str());
+				return 1;
+			}
+
+			removed++;
+			continue;
+		}
+
+		std::string now;
+		if (record.op == DELTA_PATCH) {
+			std::string old;
+			if (!read_file(path.c_str(), old) || !delta_decode(old, record.payload.data(), record.payload.size(), now)) {
+				fprintf(stderr, "cannot patch %s\n", path.c_str());
+				return 1;
+			}
+		} else {
+			now = record.payload;
+		}
+
+		if (now.size() != record.newsize || hash64(now.data(), now.size()) != record.newhash) {
+			fprintf(stderr, "patching %s gave the wrong file\n", path.c_str());
+			return 1;
+		}
+
+		if (!make_parent_dirs(path.c_str()) || !write_file_atomic(path.c_str(), now.data(), now.size())) {
+			fprintf(stderr, "cannot write %s\n", path.c_str());
+			return 1;
+		}
+
+		written++;
+	}
+
+	if (stats)
+		fprintf(stderr, "apply: %u files written, %u removed, %u already done\n", (unsigned int)written, (unsigned int)removed, (unsigned int)(records.size() - written - removed));
+
+	return 0;
+}
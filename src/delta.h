@@ -0,0 +1,33 @@
+#ifndef GLUAC_DELTA_H
+#define GLUAC_DELTA_H
+
+#include "walk.h"
+
+#include <stddef.h>
+#include <string>
+
+typedef struct {
+	WalkOptions walk;	// which files of the trees take part
+	size_t workers;		// threads diffing files, 0 uses one per core
+	int compress;		// COMPRESS_*, the whole patch is framed by compress_frame when set
+	bool stats;			// print what the patch holds to stderr
+} DeltaOptions;
+
+// encodes now as copies out of old and literal bytes, appended to out
+void delta_encode(const std::string &old, const std::string &now, std::string &out);
+
+// rebuilds the file delta_encode was given as now, false if the delta doesn't fit old
+bool delta_decode(const std::string &old, const char *delta, size_t len, std::string &now);
+
+// writes a patch taking the tree at olddir to the one at newdir: files added,
+// removed, and changed ones as deltas, each with the hashes apply checks.
+// returns an exit code
+int delta_main(const char *olddir, const char *newdir, const char *patch, const DeltaOptions &options);
+
+// applies a patch to the tree at dir. every file it removes or changes has
+// to match the tree the patch was made from (or already be what the patch
+// makes it), nothing is touched otherwise, and every file written is checked
+// against the hash of what it should be. returns an exit code
+int delta_apply(const char *patch, const char *dir, bool stats);
+
+#endif
@@ -0,0 +1,214 @@
+#include "embed.h"
+#include "compiler.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// the object is for whatever gluac itself was built for, which has to be
+// what lua_shared and so the host were built for
+#if defined(__x86_64__) || defined(_M_X64)
+#define EMBED_MACHINE	62		// EM_X86_64
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define EMBED_MACHINE	183		// EM_AARCH64
+#elif defined(__arm__) || defined(_M_ARM)
+#define EMBED_MACHINE	40		// EM_ARM
+#define EMBED_FLAGS		0x05000000	// EABI version 5
+#else
+#define EMBED_MACHINE	3		// EM_386
+#endif
+
+#ifndef EMBED_FLAGS
+#define EMBED_FLAGS		0
+#endif
+
+#define EMBED_ALIGN		4096
+
+#define SHT_PROGBITS	1
+#define SHT_SYMTAB		2
+#define SHT_STRTAB		3
+#define SHF_ALLOC		0x2
+#define STB_GLOBAL		1
+#define STT_OBJECT		1
+
+static bool is_identifier(const char *name)
+{
+	if (name[0] == '\0' || (name[0] >= '0' && name[0] <= '9'))
+		return false;
+
+	for (const char *c = name; *c != '\0'; c++) {
+		if (!(*c == '_' || (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9')))
+			return false;
+	}
+
+	return true;
+}
+
+static bool ends_with(const char *path, const char *suffix)
+{
+	size_t len = strlen(path);
+	size_t suffixlen = strlen(suffix);
+	return len >= suffixlen && strcmp(path + len - suffixlen, suffix) == 0;
+}
+
+// little endian, every machine above is
+static void put(std::string &out, uint64_t value, size_t bytes)
+{
+	for (size_t i = 0; i < bytes; i++)
+		out.push_back((char)(value >> (i * 8)));
+}
+
+static void pad(std::string &out, size_t alignment)
+{
+	out.append((alignment - out.size() % alignment) % alignment, '\0');
+}
+
+// the image and its size in .rodata, and nothing that needs relocating, so
+// the only thing that differs between machines is the word size
+static void build_object(const std::string &image, const std::string &symbol, std::string &out)
+{
+	const size_t word = sizeof(void *);
+	const bool elf64 = word == 8;
+
+	std::string rodata = image;
+	pad(rodata, 8);
+	size_t sizeat = rodata.size();
+	put(rodata, image.size(), 8);
+
+	std::string strtab = std::string(1, '\0') + symbol + '\0' + symbol + "_size" + '\0';
+	uint32_t sizename = 1 + (uint32_t)symbol.size() + 1;
+
+	// the empty .note.GNU-stack keeps the linker from making the stack executable
+	static const char shstrtab[] = "\0.rodata\0.note.GNU-stack\0.symtab\0.strtab\0.shstrtab";
+	enum { NAME_RODATA = 1, NAME_NOTE = 9, NAME_SYMTAB = 25, NAME_STRTAB = 33, NAME_SHSTRTAB = 41 };
+
+	std::string symtab;
+	auto symbol_entry = [&](uint32_t name, uint64_t value, uint64_t size) {
+		put(symtab, name, 4);
+		if (elf64) {
+			put(symtab, (STB_GLOBAL << 4) | STT_OBJECT, 1);
+			put(symtab, 0, 1);
+			put(symtab, 1, 2);		// .rodata
+			put(symtab, value, 8);
+			put(symtab, size, 8);
+		} else {
+			put(symtab, value, 4);
+			put(symtab, size, 4);
+			put(symtab, (STB_GLOBAL << 4) | STT_OBJECT, 1);
+			put(symtab, 0, 1);
+			put(symtab, 1, 2);
+		}
+	};
+
+	symtab.append(elf64 ? 24 : 16, '\0');
+	symbol_entry(1, 0, image.size());
+	symbol_entry(sizename, sizeat, 8);
+
+	// header, then the sections' contents, then the section headers
+	size_t ehsize = elf64 ? 64 : 52;
+	out.assign(ehsize, '\0');
+
+	pad(out, 16);
+	size_t rodataat = out.size();
+	out += rodata;
+
+	pad(out, word);
+	size_t symtabat = out.size();
+	out += symtab;
+
+	size_t strtabat = out.size();
+	out += strtab;
+
+	size_t shstrtabat = out.size();
+	out.append(shstrtab, sizeof(shstrtab));
+
+	pad(out, word);
+	size_t shoff = out.size();
+
+	auto section = [&](uint32_t name, uint32_t type, uint64_t flags, size_t offset, size_t size, uint32_t link, uint32_t info, uint64_t align, uint64_t entsize) {
+		put(out, name, 4);
+		put(out, type, 4);
+		put(out, flags, word);
+		put(out, 0, word);		// address
+		put(out, offset, word);
+		put(out, size, word);
+		put(out, link, 4);
+		put(out, info, 4);
+		put(out, align, word);
+		put(out, entsize, word);
+	};
+
+	section(0, 0, 0, 0, 0, 0, 0, 0, 0);
+	section(NAME_RODATA, SHT_PROGBITS, SHF_ALLOC, rodataat, rodata.size(), 0, 0, EMBED_ALIGN, 0);
+	section(NAME_NOTE, SHT_PROGBITS, 0, rodataat, 0, 0, 0, 1, 0);
+	section(NAME_SYMTAB, SHT_SYMTAB, 0, symtabat, symtab.size(), 4, 1, word, elf64 ? 24 : 16);
+	section(NAME_STRTAB, SHT_STRTAB, 0, strtabat, strtab.size(), 0, 0, 1, 0);
+	section(NAME_SHSTRTAB, SHT_STRTAB, 0, shstrtabat, sizeof(shstrtab), 0, 0, 1, 0);
+
+	std::string header;
+	header.append("\x7f" "ELF", 4);
+	put(header, elf64 ? 2 : 1, 1);	// class
+	put(header, 1, 1);				// little endian
+	put(header, 1, 1);				// version
+	header.append(9, '\0');
+	put(header, 1, 2);				// relocatable
+	put(header, EMBED_MACHINE, 2);
+	put(header, 1, 4);
+	put(header, 0, word);			// entry
+	put(header, 0, word);			// program headers
+	put(header, shoff, word);
+	put(header, EMBED_FLAGS, 4);
+	put(header, ehsize, 2);
+	put(header, 0, 2);
+	put(header, 0, 2);
+	put(header, elf64 ? 64 : 40, 2);
+	put(header, 6, 2);				// sections
+	put(header, 5, 2);				// .shstrtab
+
+	out.replace(0, header.size(), header);
+}
+
+// a byte array the compiler can at least get through quickly: no spaces and
+// no hex, which is about as small as the source gets
+static void build_source(const std::string &image, const std::string &symbol, std::string &out)
+{
+	out = "// generated by gluac --emit-object, don't edit\n\n";
+	out += "#include <stdint.h>\n\n";
+	out += "extern \"C\" {\n\n";
+	out += "alignas(" + std::to_string(EMBED_ALIGN) + ") extern const unsigned char " + symbol + "[" + std::to_string(image.size()) + "] = {\n";
+
+	char number[8];
+	for (size_t i = 0; i < image.size(); i += 32) {
+		size_t end = i + 32 < image.size() ? i + 32 : image.size();
+		for (size_t j = i; j < end; j++) {
+			int len = snprintf(number, sizeof(number), "%u,", (unsigned char)image[j]);
+			out.append(number, (size_t)len);
+		}
+		out += '\n';
+	}
+
+	out += "};\n\n";
+	out += "extern const uint64_t " + symbol + "_size = " + std::to_string(image.size()) + ";\n\n";
+	out += "}\n";
+}
+
+bool embed_write(const char *path, const std::string &image, const char *symbol, std::string &err)
+{
+	if (!is_identifier(symbol)) {
+		err = std::string(symbol) + " isn't a valid symbol name";
+		return false;
+	}
+
+	std::string out;
+	if (ends_with(path, ".o"))
+		build_object(image, symbol, out);
+	else
+		build_source(image, symbol, out);
+
+	if (!write_file_atomic(path, out.data(), out.size())) {
+		err = std::string("cannot write ") + path;
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,14 @@
+#ifndef GLUAC_EMBED_H
+#define GLUAC_EMBED_H
+
+#include <string>
+
+// writes image to path as something a native build links in: an elf
+// relocatable object for the machine gluac was built for when path ends in
+// .o, c++ source otherwise. either defines two symbols with c linkage,
+// symbol (the image, page aligned, in read only data) and symbol_size (a
+// uint64_t holding its length). the file is replaced atomically, false with
+// err set on failure
+bool embed_write(const char *path, const std::string &image, const char *symbol, std::string &err);
+
+#endif
@@ -0,0 +1,145 @@
+#include "frame.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define read _read
+#define write _write
+#else
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+bool read_all(int fd, void *data, size_t len)
+{
+	char *p = (char *)data;
+
+	while (len > 0) {
+		int n = (int)read(fd, p, (unsigned int)(len > 0x10000000 ? 0x10000000 : len));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		p += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+bool write_all(int fd, const void *data, size_t len)
+{
+	const char *p = (const char *)data;
+
+	while (len > 0) {
+		int n = (int)write(fd, p, (unsigned int)(len > 0x10000000 ? 0x10000000 : len));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		p += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+bool frame_read(int fd, std::string &frame)
+{
+	char header[4];
+	if (!read_all(fd, header, 4))
+		return false;
+
+	uint32_t len = frame_u32(header);
+	if (len > GLUAC_MAX_FRAME)
+		return false;
+
+	frame.resize(len);
+	return len == 0 || read_all(fd, &frame[0], len);
+}
+
+bool frame_write(int fd, const std::string &payload)
+{
+	std::string buf;
+	buf.reserve(payload.size() + 4);
+	frame_put_u32(buf, (uint32_t)payload.size());
+	buf += payload;
+
+	return write_all(fd, buf.data(), buf.size());
+}
+
+#ifndef _WIN32
+
+bool frame_read_fd(int fd, std::string &frame, int *passedfd)
+{
+	char header[4];
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = { header, sizeof(header) };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	*passedfd = -1;
+
+	// the descriptor arrives with the first byte of the frame, so only the
+	// start needs recvmsg and the rest can be read normally
+	ssize_t n;
+	while ((n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+	if (n <= 0)
+		return false;
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(passedfd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	if (n < 4 && !read_all(fd, header + n, 4 - n))
+		return false;
+
+	uint32_t len = frame_u32(header);
+	if (len > GLUAC_MAX_FRAME)
+		return false;
+
+	frame.resize(len);
+	return len == 0 || read_all(fd, &frame[0], len);
+}
+
+bool frame_write_fd(int fd, const std::string &payload, int passfd)
+{
+	std::string buf;
+	buf.reserve(payload.size() + 4);
+	frame_put_u32(buf, (uint32_t)payload.size());
+	buf += payload;
+
+	char control[CMSG_SPACE(sizeof(int))];
+	memset(control, 0, sizeof(control));
+	struct iovec iov = { &buf[0], buf.size() };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &passfd, sizeof(int));
+
+	ssize_t n;
+	while ((n = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+	if (n <= 0)
+		return false;
+
+	return (size_t)n == buf.size() || write_all(fd, buf.data() + n, buf.size() - n);
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef GLUAC_FRAME_H
+#define GLUAC_FRAME_H
+
+#include <stdint.h>
+#include <string>
+
+// frames are a little endian u32 length followed by that many bytes, the
+// payload itself is a sequence of u32s and length prefixed strings
+
+#define GLUAC_MAX_FRAME (256u * 1024 * 1024)
+
+inline void frame_put_u32(std::string &buf, uint32_t v)
+{
+	char b[4] = { (char)(v & 0xFF), (char)((v >> 8) & 0xFF), (char)((v >> 16) & 0xFF), (char)((v >> 24) & 0xFF) };
+	buf.append(b, 4);
+}
+
+inline void frame_put_str(std::string &buf, const char *s, size_t len)
+{
+	frame_put_u32(buf, (uint32_t)len);
+	buf.append(s, len);
+}
+
+inline void frame_put_str(std::string &buf, const std::string &s)
+{
+	frame_put_str(buf, s.data(), s.size());
+}
+
+inline uint32_t frame_u32(const char *p)
+{
+	const unsigned char *b = (const unsigned char *)p;
+	return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+class FrameReader
+{
+public:
+	FrameReader(const std::string &frame) : m_pData(frame.data()), m_iLeft(frame.size()) {}
+
+	bool GetU32(uint32_t &v)
+	{
+		if (m_iLeft < 4)
+			return false;
+
+		v = frame_u32(m_pData);
+		m_pData += 4;
+		m_iLeft -= 4;
+		return true;
+	}
+
+	bool GetStr(std::string &s)
+	{
+		uint32_t len;
+		if (!GetU32(len) || len > m_iLeft)
+			return false;
+
+		s.assign(m_pData, len);
+		m_pData += len;
+		m_iLeft -= len;
+		return true;
+	}
+
+	// whatever follows the fields already read
+	const char *Rest() const { return m_pData; }
+	size_t RestSize() const { return m_iLeft; }
+
+private:
+	const char *m_pData;
+	size_t m_iLeft;
+};
+
+// blocking reads/writes of whole frames on a file descriptor, false on eof or error
+bool frame_read(int fd, std::string &frame);
+bool frame_write(int fd, const std::string &payload);
+
+// unix sockets only, passes a file descriptor along with the frame.
+// passedfd is set to -1 when the frame didn't carry one
+bool frame_read_fd(int fd, std::string &frame, int *passedfd);
+bool frame_write_fd(int fd, const std::string &payload, int passfd);
+
+bool read_all(int fd, void *data, size_t len);
+bool write_all(int fd, const void *data, size_t len);
+
+#endif
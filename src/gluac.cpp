@@ -0,0 +1,104 @@
+#include "gluac.h"
+#include "compiler.h"
+
+#include <mutex>
+
+struct gluac_context {
+	lua_State *L;
+	CompileLimits limits;
+	std::string error;
+};
+
+typedef struct {
+	gluac_sink sink;
+	void *ud;
+} SinkWriter;
+
+static std::mutex g_InitLock;
+static int g_iInitStatus = 1;	// 1 until the first gluac_init has run
+
+static int sink_write(lua_State *L, const void *p, size_t sz, void *ud)
+{
+	SinkWriter *writer = (SinkWriter *)ud;
+	return writer->sink(p, sz, writer->ud);
+}
+
+static int context_compile(gluac_context *ctx, const CompileJob *job)
+{
+	bool ok = compile(ctx->L, job, ctx->error);
+
+	// a compile cut off by the limits may leave the state unusable
+	if (compiler_exhausted(ctx->L)) {
+		lua_State *fresh = compiler_newstate(&ctx->limits);
+		if (fresh != nullptr) {
+			compiler_close(ctx->L);
+			ctx->L = fresh;
+		}
+	}
+
+	if (!ok)
+		return GLUAC_ERROR;
+
+	ctx->error.clear();
+	return GLUAC_OK;
+}
+
+int gluac_init(void)
+{
+	std::lock_guard<std::mutex> lock(g_InitLock);
+
+	if (g_iInitStatus == 1)
+		g_iInitStatus = load_lua_shared() ? GLUAC_OK : GLUAC_ERROR;
+
+	return g_iInitStatus;
+}
+
+gluac_context *gluac_context_new(const gluac_limits *limits)
+{
+	if (gluac_init() != GLUAC_OK)
+		return nullptr;
+
+	gluac_context *ctx = new gluac_context();
+	ctx->limits.memory = limits != nullptr ? limits->memory : 0;
+	ctx->limits.milliseconds = limits != nullptr ? limits->milliseconds : 0;
+
+	ctx->L = compiler_newstate(&ctx->limits);
+	if (ctx->L == nullptr) {
+		delete ctx;
+		return nullptr;
+	}
+
+	return ctx;
+}
+
+void gluac_context_free(gluac_context *ctx)
+{
+	if (ctx == nullptr)
+		return;
+
+	compiler_close(ctx->L);
+	delete ctx;
+}
+
+int gluac_compile_buffer(gluac_context *ctx, const char *src, size_t len, const char *chunkname, unsigned int flags, gluac_sink sink, void *ud)
+{
+	SinkWriter writer = { sink, ud };
+	CompileJob job = { nullptr, src, len, chunkname != nullptr ? chunkname : "=(buffer)",
+		(flags & GLUAC_STRIP) != 0, (flags & GLUAC_PARSEONLY) != 0, sink_write, &writer };
+
+	return context_compile(ctx, &job);
+}
+
+int gluac_compile_file(gluac_context *ctx, const char *path, unsigned int flags, gluac_sink sink, void *ud)
+{
+	SinkWriter writer = { sink, ud };
+	CompileJob job = { path, nullptr, 0, nullptr,
+		(flags & GLUAC_STRIP) != 0, (flags & GLUAC_PARSEONLY) != 0, sink_write, &writer };
+
+	return context_compile(ctx, &job);
+}
+
+const char *gluac_error(const gluac_context *ctx)
+{
+	return ctx->error.c_str();
+}
@@ -0,0 +1,70 @@
+#ifndef GLUAC_H
+#define GLUAC_H
+
+#include <stddef.h>
+
+// libgluac, compiling lua to gmod bytecode from inside another program.
+//
+// call gluac_init once, then make a context per thread. a context owns its
+// own lua_State so different contexts can compile at the same time, but one
+// context must only be used by one thread at a time
+
+#if defined(_WIN32) && defined(GLUAC_SHARED)
+#ifdef GLUAC_BUILD
+#define GLUAC_API __declspec(dllexport)
+#else
+#define GLUAC_API __declspec(dllimport)
+#endif
+#elif defined(GLUAC_SHARED)
+#define GLUAC_API __attribute__((visibility("default")))
+#else
+#define GLUAC_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GLUAC_OK		0
+#define GLUAC_ERROR		(-1)
+
+#define GLUAC_STRIP		(1 << 0)	// leave out debug information
+#define GLUAC_PARSEONLY	(1 << 1)	// only check the source parses, nothing is written to the sink
+
+typedef struct gluac_context gluac_context;
+
+// limits every compile on a context is held to, zero leaves that one unlimited
+typedef struct {
+	size_t memory;				// bytes a compile may allocate
+	unsigned int milliseconds;	// wall-clock time a compile may run for
+} gluac_limits;
+
+// receives the bytecode in pieces, return non-zero to abort the compile.
+// may be null when compiling with GLUAC_PARSEONLY
+typedef int (*gluac_sink)(const void *data, size_t len, void *ud);
+
+// loads lua_shared and finds what gluac needs in it. safe to call more than
+// once and from several threads, only the first call does anything
+GLUAC_API int gluac_init(void);
+
+// creates a context with its own lua_State, limits may be null. calls
+// gluac_init if it hasn't been, returns null on failure
+GLUAC_API gluac_context *gluac_context_new(const gluac_limits *limits);
+
+GLUAC_API void gluac_context_free(gluac_context *ctx);
+
+// compiles len bytes of src. chunkname is what errors and debug information
+// call it, e.g "@lua/autorun/init.lua"
+GLUAC_API int gluac_compile_buffer(gluac_context *ctx, const char *src, size_t len, const char *chunkname, unsigned int flags, gluac_sink sink, void *ud);
+
+// compiles the file at path, or stdin when path is null
+GLUAC_API int gluac_compile_file(gluac_context *ctx, const char *path, unsigned int flags, gluac_sink sink, void *ud);
+
+// the message for the context's last failed compile, valid until the next compile on it
+GLUAC_API const char *gluac_error(const gluac_context *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,395 @@
+// open, mmap and O_CLOEXEC are hidden by a strict -std=c99 otherwise
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "gluac_bundle.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct gluac_bundle {
+	const unsigned char *base;
+	size_t size;
+	int mapped;
+	const gluac_bundle_header *header;
+	const uint32_t *displacements;
+	const gluac_bundle_entry *entries;
+	const uint32_t *order;
+	const char *names;
+};
+
+uint64_t gluac_bundle_hash(const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+uint32_t gluac_bundle_slot(uint64_t hash, uint32_t displacement, uint32_t slots)
+{
+	// splitmix64's finalizer, so every displacement gives an unrelated slot
+	uint64_t x = hash ^ ((uint64_t)displacement * 0x9e3779b97f4a7c15ULL);
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return (uint32_t)(x % slots);
+}
+
+size_t gluac_bundle_normalize(char *path)
+{
+	char *in = path;
+	char *out = path;
+
+	for (; *in != '\0'; in++) {
+		char c = *in == '\\' ? '/' : *in;
+
+		// drops leading slashes, doubled slashes and ./ segments
+		if (c == '/' && (out == path || out[-1] == '/'))
+			continue;
+		if (c == '.' && (out == path || out[-1] == '/') && (in[1] == '/' || in[1] == '\\'))
+			continue;
+
+		*out++ = c;
+	}
+
+	*out = '\0';
+	return (size_t)(out - path);
+}
+
+static int table_fits(const gluac_bundle *bundle, uint64_t offset, uint64_t count, size_t size, uint64_t alignment)
+{
+	return offset <= bundle->size && count <= (bundle->size - offset) / size && offset % alignment == 0;
+}
+
+// checked once here so lookups never have to
+static int bundle_validate(gluac_bundle *bundle)
+{
+	const gluac_bundle_header *header = (const gluac_bundle_header *)bundle->base;
+	uint32_t i;
+
+	if (bundle->size < sizeof(gluac_bundle_header) || memcmp(header->magic, GLUAC_BUNDLE_MAGIC, 8) != 0)
+		return 0;
+
+	if (header->version != GLUAC_BUNDLE_VERSION || header->size != bundle->size)
+		return 0;
+
+	if (header->slots < header->count || (header->count > 0 && header->buckets == 0))
+		return 0;
+
+	if (!table_fits(bundle, header->displacements, header->buckets, sizeof(uint32_t), 4) ||
+		!table_fits(bundle, header->entries, header->slots, sizeof(gluac_bundle_entry), 8) ||
+		!table_fits(bundle, header->order, header->count, sizeof(uint32_t), 4) ||
+		header->names > bundle->size)
+		return 0;
+
+	bundle->header = header;
+	bundle->displacements = (const uint32_t *)(bundle->base + header->displacements);
+	bundle->entries = (const gluac_bundle_entry *)(bundle->base + header->entries);
+	bundle->order = (const uint32_t *)(bundle->base + header->order);
+	bundle->names = (const char *)(bundle->base + header->names);
+
+	for (i = 0; i < header->slots; i++) {
+		const gluac_bundle_entry *entry = &bundle->entries[i];
+		if (entry->namelen == 0)
+			continue;
+
+		if (entry->name > bundle->size - header->names || entry->namelen > bundle->size - header->names - entry->name)
+			return 0;
+		if (entry->offset > bundle->size || entry->length > bundle->size - entry->offset)
+			return 0;
+		if (entry->codec > GLUAC_CODEC_LZ4 || (entry->codec == GLUAC_CODEC_NONE && entry->rawlength != entry->length))
+			return 0;
+		if (entry->rawlength > (size_t)-1)
+			return 0;
+	}
+
+	for (i = 0; i < header->count; i++) {
+		if (bundle->order[i] >= header->slots || bundle->entries[bundle->order[i]].namelen == 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+gluac_bundle *gluac_bundle_open_memory(const void *data, size_t size)
+{
+	gluac_bundle *bundle;
+
+	// the header and entries are read in place and hold 64 bit fields
+	if ((uintptr_t)data % 8 != 0)
+		return NULL;
+
+	bundle = (gluac_bundle *)calloc(1, sizeof(gluac_bundle));
+	if (bundle == NULL)
+		return NULL;
+
+	bundle->base = (const unsigned char *)data;
+	bundle->size = size;
+
+	if (!bundle_validate(bundle)) {
+		free(bundle);
+		return NULL;
+	}
+
+	return bundle;
+}
+
+gluac_bundle *gluac_bundle_open(const char *path)
+{
+	gluac_bundle *bundle;
+	void *base;
+	size_t size;
+
+	#ifdef _WIN32
+	HANDLE file, mapping;
+	LARGE_INTEGER filesize;
+
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	if (!GetFileSizeEx(file, &filesize) || filesize.QuadPart == 0) {
+		CloseHandle(file);
+		return NULL;
+	}
+
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL)
+		return NULL;
+
+	base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (base == NULL)
+		return NULL;
+
+	size = (size_t)filesize.QuadPart;
+	#else
+	struct stat st;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+
+	size = (size_t)st.st_size;
+	base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return NULL;
+	#endif
+
+	bundle = gluac_bundle_open_memory(base, size);
+	if (bundle == NULL) {
+		#ifdef _WIN32
+		UnmapViewOfFile(base);
+		#else
+		munmap(base, size);
+		#endif
+		return NULL;
+	}
+
+	bundle->mapped = 1;
+	return bundle;
+}
+
+void gluac_bundle_close(gluac_bundle *bundle)
+{
+	if (bundle == NULL)
+		return;
+
+	if (bundle->mapped) {
+		#ifdef _WIN32
+		UnmapViewOfFile((void *)bundle->base);
+		#else
+		munmap((void *)bundle->base, bundle->size);
+		#endif
+	}
+
+	free(bundle);
+}
+
+static void describe(const gluac_bundle *bundle, const gluac_bundle_entry *entry, gluac_bundle_file *file)
+{
+	file->name = bundle->names + entry->name;
+	file->namelen = entry->namelen;
+	file->data = bundle->base + entry->offset;
+	file->size = (size_t)entry->length;
+	file->rawsize = (size_t)entry->rawlength;
+	file->codec = entry->codec;
+}
+
+int gluac_bundle_find(const gluac_bundle *bundle, const char *name, size_t len, gluac_bundle_file *file)
+{
+	const gluac_bundle_header *header = bundle->header;
+	const gluac_bundle_entry *entry;
+	uint64_t hash;
+
+	if (header->count == 0)
+		return 0;
+
+	hash = gluac_bundle_hash(name, len);
+	entry = &bundle->entries[gluac_bundle_slot(hash, bundle->displacements[hash % header->buckets], header->slots)];
+
+	if (entry->namelen != len || memcmp(bundle->names + entry->name, name, len) != 0)
+		return 0;
+
+	describe(bundle, entry, file);
+	return 1;
+}
+
+size_t gluac_bundle_count(const gluac_bundle *bundle)
+{
+	return bundle->header->count;
+}
+
+int gluac_bundle_at(const gluac_bundle *bundle, size_t index, gluac_bundle_file *file)
+{
+	if (index >= bundle->header->count)
+		return 0;
+
+	describe(bundle, &bundle->entries[bundle->order[index]], file);
+	return 1;
+}
+
+int gluac_lz4_decompress(const void *src, size_t srclen, void *dst, size_t dstlen)
+{
+	const unsigned char *ip = (const unsigned char *)src;
+	const unsigned char *iend = ip + srclen;
+	unsigned char *op = (unsigned char *)dst;
+	unsigned char *oend = op + dstlen;
+
+	while (ip < iend) {
+		unsigned int token = *ip++;
+		size_t literals = token >> 4;
+		size_t length = token & 15;
+		size_t offset;
+		const unsigned char *match;
+
+		// a nibble of 15 carries on in bytes until one isn't 255
+		if (literals == 15) {
+			unsigned char more;
+			do {
+				if (ip == iend)
+					return 0;
+				more = *ip++;
+				literals += more;
+			} while (more == 255);
+		}
+
+		if (literals > (size_t)(iend - ip) || literals > (size_t)(oend - op))
+			return 0;
+
+		memcpy(op, ip, literals);
+		ip += literals;
+		op += literals;
+
+		// the last sequence is only literals
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return 0;
+
+		offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+
+		if (offset == 0 || offset > (size_t)(op - (unsigned char *)dst))
+			return 0;
+
+		if (length == 15) {
+			unsigned char more;
+			do {
+				if (ip == iend)
+					return 0;
+				more = *ip++;
+				length += more;
+			} while (more == 255);
+		}
+
+		length += 4;
+		if (length > (size_t)(oend - op))
+			return 0;
+
+		// matches can overlap what they're writing, runs are made this way
+		match = op - offset;
+		if (offset >= length) {
+			memcpy(op, match, length);
+			op += length;
+		} else {
+			while (length-- > 0)
+				*op++ = *match++;
+		}
+	}
+
+	return op == oend;
+}
+
+int gluac_bundle_read(const gluac_bundle_file *file, void *out)
+{
+	switch (file->codec) {
+	case GLUAC_CODEC_NONE:
+		if (file->size != file->rawsize)
+			return 0;
+		memcpy(out, file->data, file->size);
+		return 1;
+	case GLUAC_CODEC_LZ4:
+		return gluac_lz4_decompress(file->data, file->size, out, file->rawsize);
+	default:
+		return 0;
+	}
+}
+
+int gluac_frame_open(const void *data, size_t size, gluac_bundle_file *file)
+{
+	gluac_frame_header header;
+
+	if (size < sizeof(header))
+		return 0;
+
+	// copied out since nothing says a frame in memory is aligned
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, GLUAC_FRAME_MAGIC, 8) != 0 || header.codec > GLUAC_CODEC_LZ4 || header.rawlength > (size_t)-1)
+		return 0;
+
+	file->name = NULL;
+	file->namelen = 0;
+	file->data = (const unsigned char *)data + sizeof(header);
+	file->size = size - sizeof(header);
+	file->rawsize = (size_t)header.rawlength;
+	file->codec = header.codec;
+	return 1;
+}
+
+int gluac_bundle_verify(const gluac_bundle *bundle)
+{
+	uint32_t i;
+
+	for (i = 0; i < bundle->header->slots; i++) {
+		const gluac_bundle_entry *entry = &bundle->entries[i];
+		if (entry->namelen != 0 && gluac_bundle_hash(bundle->base + entry->offset, (size_t)entry->length) != entry->hash)
+			return 0;
+	}
+
+	return 1;
+}
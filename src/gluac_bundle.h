@@ -0,0 +1,132 @@
+#ifndef GLUAC_BUNDLE_READER_H
+#define GLUAC_BUNDLE_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// reads bundles written by gluac --bundle: many compiled files in one, found
+// by name with a single probe of a perfect hash and handed back as pointers
+// into the mapped file, ready for luaL_loadbuffer without a copy. files
+// compressed with --compress are decompressed one at a time by
+// gluac_bundle_read, and single outputs written with --compress are framed
+// so gluac_frame_open can read them the same way.
+//
+// this file and gluac_bundle.c don't depend on anything else in gluac, copy
+// them into the loader that needs them.
+//
+// layout, little endian:
+//   header
+//   u32 displacements[buckets]
+//   entry entries[slots]			unused slots have a namelen of 0
+//   u32 order[count]				slots in the order the files were written
+//   char names[]					not null terminated
+//   blobs, from a page boundary	each aligned to GLUAC_BUNDLE_ALIGN
+//
+// a name hashes to a bucket, the bucket's displacement picks the slot, and
+// the slot's name is compared to rule out names that aren't in the bundle.
+//
+// compressed files are in the lz4 block format, so any lz4 decoder can read
+// them too. a frame is a gluac_frame_header followed by the file
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GLUAC_BUNDLE_MAGIC		"GLUACBDL"
+#define GLUAC_BUNDLE_VERSION	2
+#define GLUAC_BUNDLE_ALIGN		16
+#define GLUAC_FRAME_MAGIC		"GLUACLZF"
+
+#define GLUAC_CODEC_NONE		0
+#define GLUAC_CODEC_LZ4			1
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;			// files in the bundle
+	uint32_t buckets;
+	uint32_t slots;
+	uint64_t displacements;	// offsets from the start of the file
+	uint64_t entries;
+	uint64_t order;
+	uint64_t names;
+	uint64_t data;
+	uint64_t size;			// of the whole file, so a truncated one is refused
+} gluac_bundle_header;
+
+typedef struct {
+	uint64_t offset;		// from the start of the file
+	uint64_t length;		// as stored
+	uint64_t rawlength;		// once decompressed
+	uint64_t hash;			// gluac_bundle_hash of the blob as stored
+	uint32_t name;			// offset into the name table
+	uint32_t namelen;
+	uint32_t codec;			// GLUAC_CODEC_*
+	uint32_t reserved;
+} gluac_bundle_entry;
+
+typedef struct {
+	char magic[8];
+	uint32_t codec;
+	uint32_t reserved;
+	uint64_t rawlength;
+} gluac_frame_header;
+
+typedef struct gluac_bundle gluac_bundle;
+
+typedef struct {
+	const char *name;		// not null terminated, null for a frame
+	size_t namelen;
+	const void *data;		// as stored, the bytecode itself when codec is GLUAC_CODEC_NONE
+	size_t size;
+	size_t rawsize;			// the size of the bytecode
+	uint32_t codec;
+} gluac_bundle_file;
+
+// 64 bit FNV-1a, short names make anything fancier pointless
+uint64_t gluac_bundle_hash(const void *data, size_t len);
+
+// the slot a name hashing to hash lands in given its bucket's displacement
+uint32_t gluac_bundle_slot(uint64_t hash, uint32_t displacement, uint32_t slots);
+
+// names are stored with forward slashes and no leading / or ./, this puts
+// a path into that form in place and returns its new length
+size_t gluac_bundle_normalize(char *path);
+
+// maps the bundle at path, null if it can't be opened or isn't a bundle
+gluac_bundle *gluac_bundle_open(const char *path);
+
+// reads a bundle already in memory, which must outlive it. data has to be
+// 8 byte aligned, null is returned otherwise
+gluac_bundle *gluac_bundle_open_memory(const void *data, size_t size);
+
+void gluac_bundle_close(gluac_bundle *bundle);
+
+// finds a file by its normalized name, 0 if it isn't in the bundle
+int gluac_bundle_find(const gluac_bundle *bundle, const char *name, size_t len, gluac_bundle_file *file);
+
+size_t gluac_bundle_count(const gluac_bundle *bundle);
+
+// the index'th file in the order they were written, 0 past the end
+int gluac_bundle_at(const gluac_bundle *bundle, size_t index, gluac_bundle_file *file);
+
+// puts the bytecode of file into out, which must hold file->rawsize bytes.
+// 0 if the file is corrupt
+int gluac_bundle_read(const gluac_bundle_file *file, void *out);
+
+// describes a single framed output already in memory for gluac_bundle_read,
+// 0 if it isn't one
+int gluac_frame_open(const void *data, size_t size, gluac_bundle_file *file);
+
+// decompresses an lz4 block of srclen bytes into exactly dstlen bytes, 0 if
+// it's corrupt or doesn't fill dst
+int gluac_lz4_decompress(const void *src, size_t srclen, void *dst, size_t dstlen);
+
+// checks every blob against its hash, 0 if any don't match
+int gluac_bundle_verify(const gluac_bundle *bundle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,308 @@
+#include "gma.h"
+#include "hash.h"
+#include "workpool.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+
+#ifdef _WIN32
+#define gma_seek _fseeki64
+#define gma_tell _ftelli64
+#else
+#define gma_seek fseeko
+#define gma_tell ftello
+#endif
+
+#define GMA_IDENT		"GMAD"
+#define GMA_VERSION		3
+#define GMA_COPY_CHUNK	(1 << 20)
+
+typedef struct {
+	std::string name;
+	uint64_t size;
+	uint32_t crc;
+	uint64_t offset;		// from the start of the file block
+	bool lua;
+	std::string bytecode;
+} GmaEntry;
+
+// reads the addon header, keeping every byte of it in raw so it can be
+// written back unchanged. integers are little endian like everything gmad writes
+class GmaReader
+{
+public:
+	GmaReader(FILE *f) : m_pFile(f) {}
+
+	bool Read(void *out, size_t len)
+	{
+		if (fread(out, 1, len, m_pFile) != len)
+			return false;
+
+		m_Raw.append((const char *)out, len);
+		return true;
+	}
+
+	bool ReadString(std::string &out)
+	{
+		out.clear();
+		for (;;) {
+			int c = fgetc(m_pFile);
+			if (c == EOF)
+				return false;
+
+			m_Raw.push_back((char)c);
+			if (c == 0)
+				return true;
+
+			out.push_back((char)c);
+		}
+	}
+
+	std::string m_Raw;
+
+private:
+	FILE *m_pFile;
+};
+
+static bool ends_with_lua(const std::string &name)
+{
+	return name.size() > 4 && name.compare(name.size() - 4, 4, ".lua") == 0;
+}
+
+// everything up to the file list goes in header, which is copied out as is
+static bool read_gma(FILE *f, std::string &header, std::vector<GmaEntry> &entries, uint64_t &fileblock)
+{
+	GmaReader reader(f);
+	char ident[4];
+	unsigned char version;
+	uint64_t steamid, timestamp;
+	std::string text;
+	int32_t addonversion;
+
+	if (!reader.Read(ident, 4) || memcmp(ident, GMA_IDENT, 4) != 0)
+		return false;
+
+	if (!reader.Read(&version, 1) || version > GMA_VERSION)
+		return false;
+
+	if (!reader.Read(&steamid, 8) || !reader.Read(&timestamp, 8))
+		return false;
+
+	// required content, a list of strings ending with an empty one
+	if (version > 1) {
+		do {
+			if (!reader.ReadString(text))
+				return false;
+		} while (!text.empty());
+	}
+
+	// name, description and author
+	for (int i = 0; i < 3; i++) {
+		if (!reader.ReadString(text))
+			return false;
+	}
+
+	if (!reader.Read(&addonversion, 4))
+		return false;
+
+	header = reader.m_Raw;
+
+	uint64_t offset = 0;
+	for (;;) {
+		uint32_t number;
+		if (!reader.Read(&number, 4))
+			return false;
+		if (number == 0)
+			break;
+
+		GmaEntry entry;
+		int64_t size;
+		if (!reader.ReadString(entry.name) || !reader.Read(&size, 8) || !reader.Read(&entry.crc, 4) || size < 0)
+			return false;
+
+		entry.size = (uint64_t)size;
+		entry.offset = offset;
+		entry.lua = ends_with_lua(entry.name);
+		offset += entry.size;
+		entries.push_back(entry);
+	}
+
+	int64_t pos = gma_tell(f);
+	if (pos < 0)
+		return false;
+
+	fileblock = (uint64_t)pos;
+
+	// the entries have to actually be there, a truncated download otherwise fails halfway through writing
+	if (gma_seek(f, 0, SEEK_END) != 0 || gma_tell(f) < (int64_t)(fileblock + offset))
+		return false;
+
+	return true;
+}
+
+static bool read_at(FILE *f, uint64_t offset, char *out, size_t len)
+{
+	return gma_seek(f, (int64_t)offset, SEEK_SET) == 0 && fread(out, 1, len, f) == len;
+}
+
+// writes an addon with the entries' new sizes and crcs, then the crc of all of it
+static bool write_gma(FILE *in, FILE *out, const std::string &header, const std::vector<GmaEntry> &entries, uint64_t fileblock)
+{
+	uint32_t crc = 0;
+	bool ok = true;
+
+	auto put = [&](const void *data, size_t len) {
+		crc = crc32(data, len, crc);
+		ok = ok && fwrite(data, 1, len, out) == len;
+	};
+
+	put(header.data(), header.size());
+
+	for (size_t i = 0; i < entries.size(); i++) {
+		const GmaEntry &entry = entries[i];
+		uint32_t number = (uint32_t)(i + 1);
+		int64_t size = entry.lua ? (int64_t)entry.bytecode.size() : (int64_t)entry.size;
+		uint32_t entrycrc = entry.lua ? crc32(entry.bytecode.data(), entry.bytecode.size()) : entry.crc;
+
+		put(&number, 4);
+		put(entry.name.c_str(), entry.name.size() + 1);
+		put(&size, 8);
+		put(&entrycrc, 4);
+	}
+
+	uint32_t end = 0;
+	put(&end, 4);
+
+	// everything but lua goes straight from the input to the output a chunk at a time
+	std::string chunk;
+	for (size_t i = 0; i < entries.size() && ok; i++) {
+		const GmaEntry &entry = entries[i];
+		if (entry.lua) {
+			put(entry.bytecode.data(), entry.bytecode.size());
+			continue;
+		}
+
+		uint64_t done = 0;
+		while (done < entry.size && ok) {
+			size_t len = (size_t)(entry.size - done < GMA_COPY_CHUNK ? entry.size - done : GMA_COPY_CHUNK);
+			chunk.resize(len);
+
+			ok = read_at(in, fileblock + entry.offset + done, &chunk[0], len);
+			if (ok)
+				put(chunk.data(), len);
+
+			done += len;
+		}
+	}
+
+	// the crc itself isn't part of what it covers
+	ok = ok && fwrite(&crc, 1, 4, out) == 4;
+	return ok;
+}
+
+int gma_main(const char *input, const char *output, const GmaOptions &options)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	FILE *in = fopen(input, "rb");
+	if (in == nullptr) {
+		fprintf(stderr, "cannot open %s\n", input);
+		return 1;
+	}
+
+	std::string header;
+	std::vector<GmaEntry> entries;
+	uint64_t fileblock = 0;
+
+	if (!read_gma(in, header, entries, fileblock)) {
+		fprintf(stderr, "%s isn't a gma addon or is truncated\n", input);
+		fclose(in);
+		return 1;
+	}
+
+	size_t count = 0;
+	for (size_t i = 0; i < entries.size(); i++)
+		count += entries[i].lua ? 1 : 0;
+
+	size_t workers = options.batch.workers ? options.batch.workers : std::thread::hardware_concurrency();
+	if (workers > count)
+		workers = count;
+
+	std::atomic<size_t> failed(0);
+	WorkPool pool(workers ? workers : 1, workers * 4 + 4, 0, options.batch.limits);
+	if (!pool.Start()) {
+		fclose(in);
+		return 1;
+	}
+
+	// entries are read in order on this thread while the pool compiles the ones
+	// before them, each source is let go once it's compiled
+	std::vector<std::string> sources(entries.size());
+
+	for (size_t i = 0; i < entries.size(); i++) {
+		GmaEntry *entry = &entries[i];
+		std::string *source = &sources[i];
+		if (!entry->lua)
+			continue;
+
+		source->resize((size_t)entry->size);
+		if (entry->size > 0 && !read_at(in, fileblock + entry->offset, &(*source)[0], source->size())) {
+			fprintf(stderr, "cannot read %s from %s\n", entry->name.c_str(), input);
+			failed++;
+			continue;
+		}
+
+		std::string chunkname = make_chunkname(entry->name.c_str(), options.chunknames);
+
+		pool.Push([entry, source, chunkname, &options, &failed](lua_State *L) {
+			std::string err;
+			CompileJob job = { entry->name.c_str(), source->data(), source->size(), chunkname.c_str(), options.batch.strip, options.batch.parseonly, write_dump_string, &entry->bytecode };
+
+			if (!compile(L, &job, err)) {
+				fprintf(stderr, "%s\n", err.c_str());
+				failed++;
+			}
+
+			std::string().swap(*source);
+		});
+	}
+
+	pool.Wait();
+
+	int status = failed ? 1 : 0;
+
+	if (failed == 0 && !options.batch.parseonly) {
+		bool tostdout = strcmp(output, "-") == 0;
+		std::string tmp = tostdout ? "" : temp_filename(output);
+		FILE *out = tostdout ? stdout : fopen(tmp.c_str(), "wb");
+
+		bool ok = out != nullptr && write_gma(in, out, header, entries, fileblock);
+
+		if (tostdout) {
+			ok = fflush(stdout) == 0 && ok;
+		} else if (out != nullptr) {
+			ok = fclose(out) == 0 && ok;
+			if (!ok || rename(tmp.c_str(), output) != 0) {
+				remove(tmp.c_str());
+				ok = false;
+			}
+		}
+
+		if (!ok) {
+			fprintf(stderr, "cannot write %s\n", output);
+			status = 1;
+		}
+	}
+
+	fclose(in);
+
+	if (options.batch.stats) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		batch_report("gma", count, failed, elapsed.count());
+	}
+
+	return status;
+}
@@ -0,0 +1,18 @@
+#ifndef GLUAC_GMA_H
+#define GLUAC_GMA_H
+
+#include "batch.h"
+#include "compiler.h"
+
+typedef struct {
+	BatchOptions batch;
+	ChunknameOptions chunknames;	// applied to entry names, which are relative to the game's root
+} GmaOptions;
+
+// compiles every .lua entry of the addon at input on a pool of worker states
+// and writes the addon to output ("-" for stdout) with the compiled entries
+// swapped in, everything else byte for byte and the crcs redone. nothing is
+// written if any entry fails. returns an exit code
+int gma_main(const char *input, const char *output, const GmaOptions &options);
+
+#endif
@@ -0,0 +1,177 @@
+#include "hash.h"
+
+#include <string.h>
+
+static const uint64_t PRIME1 = 11400714785074694791ULL;
+static const uint64_t PRIME2 = 14029467366897019727ULL;
+static const uint64_t PRIME3 = 1609587929392839161ULL;
+static const uint64_t PRIME4 = 9650029242287828579ULL;
+static const uint64_t PRIME5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+	acc += input * PRIME2;
+	acc = rotl(acc, 31);
+	return acc * PRIME1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t val)
+{
+	acc ^= hash_round(0, val);
+	return acc * PRIME1 + PRIME4;
+}
+
+void hash64_init(Hash64State *state, uint64_t seed)
+{
+	state->v[0] = seed + PRIME1 + PRIME2;
+	state->v[1] = seed + PRIME2;
+	state->v[2] = seed;
+	state->v[3] = seed - PRIME1;
+	state->total = 0;
+	state->buffered = 0;
+	state->seed = seed;
+}
+
+void hash64_update(Hash64State *state, const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	const unsigned char *end = p + len;
+
+	state->total += len;
+
+	if (state->buffered + len < 32) {
+		memcpy(state->buffer + state->buffered, p, len);
+		state->buffered += len;
+		return;
+	}
+
+	if (state->buffered > 0) {
+		size_t fill = 32 - state->buffered;
+		memcpy(state->buffer + state->buffered, p, fill);
+		p += fill;
+
+		for (int i = 0; i < 4; i++)
+			state->v[i] = hash_round(state->v[i], read64(state->buffer + i * 8));
+
+		state->buffered = 0;
+	}
+
+	for (; p + 32 <= end; p += 32) {
+		state->v[0] = hash_round(state->v[0], read64(p));
+		state->v[1] = hash_round(state->v[1], read64(p + 8));
+		state->v[2] = hash_round(state->v[2], read64(p + 16));
+		state->v[3] = hash_round(state->v[3], read64(p + 24));
+	}
+
+	state->buffered = end - p;
+	memcpy(state->buffer, p, state->buffered);
+}
+
+uint64_t hash64_final(const Hash64State *state)
+{
+	uint64_t h;
+
+	if (state->total >= 32) {
+		h = rotl(state->v[0], 1) + rotl(state->v[1], 7) + rotl(state->v[2], 12) + rotl(state->v[3], 18);
+		for (int i = 0; i < 4; i++)
+			h = merge_round(h, state->v[i]);
+	} else {
+		h = state->seed + PRIME5;
+	}
+
+	h += state->total;
+
+	const unsigned char *p = state->buffer;
+	const unsigned char *end = p + state->buffered;
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= hash_round(0, read64(p));
+		h = rotl(h, 27) * PRIME1 + PRIME4;
+	}
+
+	if (p + 4 <= end) {
+		h ^= (uint64_t)read32(p) * PRIME1;
+		h = rotl(h, 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+
+	for (; p < end; p++) {
+		h ^= (*p) * PRIME5;
+		h = rotl(h, 11) * PRIME1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+uint64_t hash64(const void *data, size_t len, uint64_t seed)
+{
+	Hash64State state;
+	hash64_init(&state, seed);
+	hash64_update(&state, data, len);
+	return hash64_final(&state);
+}
+
+// slicing by 8: eight tables let the loop take a word at a time (little endian)
+struct Crc32Tables
+{
+	uint32_t t[8][256];
+
+	Crc32Tables()
+	{
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; bit++)
+				crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1)));
+			t[0][i] = crc;
+		}
+
+		for (uint32_t i = 0; i < 256; i++) {
+			for (int k = 1; k < 8; k++)
+				t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+		}
+	}
+};
+
+uint32_t crc32(const void *data, size_t len, uint32_t crc)
+{
+	static const Crc32Tables tables;
+	const uint32_t (*t)[256] = tables.t;
+	const unsigned char *p = (const unsigned char *)data;
+	crc = ~crc;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		uint32_t lo = read32(p) ^ crc;
+		uint32_t hi = read32(p + 4);
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+			t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+	}
+
+	for (; len > 0; len--, p++)
+		crc = t[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
@@ -0,0 +1,26 @@
+#ifndef GLUAC_HASH_H
+#define GLUAC_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 64 bit xxHash, used for cache keys and to check file contents
+uint64_t hash64(const void *data, size_t len, uint64_t seed = 0);
+
+// incremental form for data that arrives in pieces, same result as hash64
+typedef struct {
+	uint64_t v[4];
+	uint64_t total;
+	unsigned char buffer[32];
+	size_t buffered;
+	uint64_t seed;
+} Hash64State;
+
+void hash64_init(Hash64State *state, uint64_t seed = 0);
+void hash64_update(Hash64State *state, const void *data, size_t len);
+uint64_t hash64_final(const Hash64State *state);
+
+// the zip/gma crc32, pass the previous result as crc to continue one
+uint32_t crc32(const void *data, size_t len, uint32_t crc = 0);
+
+#endif
@@ -0,0 +1,125 @@
+#include "lazy.h"
+#include "compiler.h"
+#include "gluac_bundle.h"
+
+#include <stdio.h>
+
+// the stub, after a line setting name to the real module's entry and global
+// to the global it defines (or nil). a module written "X = X or {}" has to
+// see its global unset while it runs, and the proxy is put back if it fails
+// so the next access tries again
+static const char g_StubSource[] =
+	"local proxy, real = {}\n"
+	"local function get()\n"
+	"	if real == nil then\n"
+	"		if global then _G[global] = nil end\n"
+	"		local ok, ret = pcall(function() return " LAZY_LOADER "(name)() end)\n"
+	"		if ok then real = global and rawget(_G, global) or ret end\n"
+	"		if real == nil then\n"
+	"			if global then _G[global] = proxy end\n"
+	"			error(ok and name .. \" defines nothing\" or ret, 0)\n"
+	"		end\n"
+	"		if global then _G[global] = real end\n"
+	"	end\n"
+	"	return real\n"
+	"end\n"
+	"setmetatable(proxy, {\n"
+	"	__index = function(_, k) return get()[k] end,\n"
+	"	__newindex = function(_, k, v) get()[k] = v end,\n"
+	"	__call = function(_, ...) return get()(...) end,\n"
+	"})\n"
+	"if global then _G[global] = proxy end\n"
+	"return proxy\n";
+
+static std::string lua_quote(const std::string &value)
+{
+	std::string out = "\"";
+	for (size_t i = 0; i < value.size(); i++) {
+		unsigned char c = (unsigned char)value[i];
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += (char)c;
+		} else if (c < 32 || c == 127) {
+			char escape[8];
+			snprintf(escape, sizeof(escape), "\\%03u", c);
+			out += escape;
+		} else {
+			out += (char)c;
+		}
+	}
+
+	return out + "\"";
+}
+
+static bool is_identifier(const std::string &name)
+{
+	if (name.empty() || (name[0] >= '0' && name[0] <= '9'))
+		return false;
+
+	for (size_t i = 0; i < name.size(); i++) {
+		char c = name[i];
+		if (!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+			return false;
+	}
+
+	return true;
+}
+
+bool read_lazy_config(const char *path, std::vector<LazyModule> &modules, std::string &err)
+{
+	std::string data;
+	if (!read_file(path, data)) {
+		err = std::string("cannot open ") + path;
+		return false;
+	}
+
+	size_t start = 0;
+	for (unsigned int number = 1; start < data.size(); number++) {
+		size_t end = data.find('\n', start);
+		if (end == std::string::npos)
+			end = data.size();
+
+		std::string line = data.substr(start, end - start);
+		start = end + 1;
+
+		// whitespace separated fields
+		std::vector<std::string> fields;
+		size_t pos = 0;
+		while (pos < line.size()) {
+			size_t first = line.find_first_not_of(" \t\r", pos);
+			if (first == std::string::npos)
+				break;
+
+			size_t last = line.find_first_of(" \t\r", first);
+			if (last == std::string::npos)
+				last = line.size();
+
+			fields.push_back(line.substr(first, last - first));
+			pos = last;
+		}
+
+		if (fields.empty() || fields[0][0] == '#')
+			continue;
+
+		if (fields.size() > 2 || (fields.size() == 2 && !is_identifier(fields[1]))) {
+			err = std::string(path) + ":" + std::to_string(number) + ": expected a file name and optionally a global";
+			return false;
+		}
+
+		LazyModule module;
+		module.name = fields[0];
+		module.name.resize(gluac_bundle_normalize(&module.name[0]));
+		if (fields.size() == 2)
+			module.global = fields[1];
+
+		modules.push_back(module);
+	}
+
+	return true;
+}
+
+std::string lazy_stub(const LazyModule &module)
+{
+	std::string global = module.global.empty() ? "nil" : lua_quote(module.global);
+	return "local name, global = " + lua_quote(module.name + LAZY_SUFFIX) + ", " + global + "\n" + g_StubSource;
+}
@@ -0,0 +1,30 @@
+#ifndef GLUAC_LAZY_H
+#define GLUAC_LAZY_H
+
+#include <string>
+#include <vector>
+
+// a lazy module's own bytecode is stored under its name with this on the
+// end, its stub takes the name itself
+#define LAZY_SUFFIX ".lazy"
+
+// the global stubs call to load a bundle entry, which the host provides. it
+// takes the entry's name and returns the loaded function, as luaL_loadbuffer would
+#define LAZY_LOADER "gluac_load"
+
+typedef struct {
+	std::string name;	// the file's name in the bundle, normalized
+	std::string global;	// the global the module defines, empty if it only returns its table
+} LazyModule;
+
+// reads a lazy config: one module per line, its name in the bundle then
+// optionally the global it defines. blank lines and lines starting with #
+// are ignored. false with err set if it can't be read or a line is malformed
+bool read_lazy_config(const char *path, std::vector<LazyModule> &modules, std::string &err);
+
+// lua source for the stub that stands in for module. it puts a proxy table
+// in module.global (and returns it) that loads the real module the first
+// time it's indexed, assigned to or called, then forwards to what it defined
+std::string lazy_stub(const LazyModule &module);
+
+#endif
@@ -0,0 +1,481 @@
+#include "lexer.h"
+#include "hash.h"
+
+#include <string.h>
+
+static bool is_digit(unsigned char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+// luajit lets any byte over 127 into a name, so utf-8 identifiers lex as one
+static bool is_ident(unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || is_digit(c) || c == '_' || c >= 0x80;
+}
+
+static bool is_newline(char c)
+{
+	return c == '\n' || c == '\r';
+}
+
+LuaLexer::LuaLexer(const char *src, size_t len) :
+	m_pEnd(src + len),
+	m_p(src),
+	m_iLine(1),
+	m_bDone(false)
+{
+}
+
+// steps over a line break, \r\n and \n\r count as one like they do in lua
+void LuaLexer::Newline()
+{
+	char c = *m_p++;
+	if (m_p < m_pEnd && is_newline(*m_p) && *m_p != c)
+		m_p++;
+
+	m_iLine++;
+}
+
+// at a [ checks for [[, [=[ and so on and steps past it
+bool LuaLexer::LongBracket(size_t &level)
+{
+	const char *p = m_p + 1;
+	level = 0;
+
+	while (p < m_pEnd && *p == '=') {
+		p++;
+		level++;
+	}
+
+	if (p >= m_pEnd || *p != '[')
+		return false;
+
+	m_p = p + 1;
+	return true;
+}
+
+// runs past the ]=] closing a long bracket of the given level, false if there isn't one
+bool LuaLexer::SkipLongBracket(size_t level, int &newlines)
+{
+	while (m_p < m_pEnd) {
+		if (*m_p == ']') {
+			const char *p = m_p + 1;
+			size_t n = 0;
+			while (p < m_pEnd && *p == '=') {
+				p++;
+				n++;
+			}
+
+			if (n == level && p < m_pEnd && *p == ']') {
+				m_p = p + 1;
+				return true;
+			}
+
+			m_p = p;
+		} else if (is_newline(*m_p)) {
+			Newline();
+			newlines++;
+		} else {
+			m_p++;
+		}
+	}
+
+	return false;
+}
+
+// skips whitespace and comments, false on a comment that never ends
+bool LuaLexer::SkipSpace(int &newlines)
+{
+	while (m_p < m_pEnd) {
+		char c = *m_p;
+
+		if (is_newline(c)) {
+			Newline();
+			newlines++;
+		} else if (c == ' ' || c == '\t' || c == '\v' || c == '\f') {
+			m_p++;
+		} else if (c == '-' && m_p + 1 < m_pEnd && m_p[1] == '-') {
+			m_p += 2;
+
+			size_t level;
+			if (m_p < m_pEnd && *m_p == '[' && LongBracket(level)) {
+				if (!SkipLongBracket(level, newlines))
+					return false;
+			} else {
+				while (m_p < m_pEnd && !is_newline(*m_p))
+					m_p++;
+			}
+		} else if (c == '/' && m_p + 1 < m_pEnd && m_p[1] == '/') {
+			while (m_p < m_pEnd && !is_newline(*m_p))
+				m_p++;
+		} else if (c == '/' && m_p + 1 < m_pEnd && m_p[1] == '*') {
+			m_p += 2;
+
+			for (;;) {
+				if (m_p >= m_pEnd)
+					return false;
+
+				if (*m_p == '*' && m_p + 1 < m_pEnd && m_p[1] == '/') {
+					m_p += 2;
+					break;
+				}
+
+				if (is_newline(*m_p)) {
+					Newline();
+					newlines++;
+				} else {
+					m_p++;
+				}
+			}
+		} else {
+			break;
+		}
+	}
+
+	return true;
+}
+
+bool LuaLexer::Next(LuaToken &token)
+{
+	if (m_bDone)
+		return false;
+
+	const char *start = m_p;
+	token.newlines = 0;
+	bool ok = SkipSpace(token.newlines);
+
+	token.line = m_iLine;
+
+	if (ok) {
+		start = m_p;
+
+		if (m_p >= m_pEnd) {
+			token.type = TOKEN_EOF;
+			token.text = m_p;
+			token.len = 0;
+			m_bDone = true;
+			return false;
+		}
+
+		unsigned char c = *m_p;
+
+		if (is_digit(c) || (c == '.' && m_p + 1 < m_pEnd && is_digit(m_p[1]))) {
+			// as greedy as luajit, which leaves working out what's valid to the conversion
+			char exponent = (c == '0' && m_p + 1 < m_pEnd && (m_p[1] | 0x20) == 'x') ? 'p' : 'e';
+			char prev = 0;
+
+			while (m_p < m_pEnd) {
+				unsigned char d = *m_p;
+				if (!(is_ident(d) || d == '.' || ((d == '+' || d == '-') && (prev | 0x20) == exponent)))
+					break;
+
+				prev = d;
+				m_p++;
+			}
+
+			token.type = TOKEN_NUMBER;
+		} else if (is_ident(c)) {
+			while (m_p < m_pEnd && is_ident(*m_p))
+				m_p++;
+
+			token.type = TOKEN_NAME;
+		} else if (c == '"' || c == '\'') {
+			m_p++;
+			token.type = TOKEN_STRING;
+
+			for (;;) {
+				if (m_p >= m_pEnd || is_newline(*m_p)) {
+					ok = false;
+					break;
+				}
+
+				char d = *m_p;
+				if (d == (char)c) {
+					m_p++;
+					break;
+				}
+
+				if (d != '\\') {
+					m_p++;
+					continue;
+				}
+
+				m_p++;
+				if (m_p >= m_pEnd) {
+					ok = false;
+					break;
+				}
+
+				if (is_newline(*m_p)) {
+					Newline();
+				} else if (*m_p == 'z') {
+					m_p++;
+					while (m_p < m_pEnd && (is_newline(*m_p) || *m_p == ' ' || *m_p == '\t' || *m_p == '\v' || *m_p == '\f')) {
+						if (is_newline(*m_p))
+							Newline();
+						else
+							m_p++;
+					}
+				} else {
+					m_p++;
+				}
+			}
+		} else if (c == '[') {
+			size_t level;
+			if (LongBracket(level)) {
+				int newlines = 0;
+				ok = SkipLongBracket(level, newlines);
+				token.type = TOKEN_STRING;
+			} else {
+				// [= without a second [ is an invalid delimiter rather than an index
+				m_p++;
+				ok = m_p >= m_pEnd || *m_p != '=';
+				token.type = TOKEN_SYMBOL;
+			}
+		} else {
+			token.type = TOKEN_SYMBOL;
+			m_p++;
+
+			char next = m_p < m_pEnd ? *m_p : '\0';
+			const char *lua = nullptr;	// what gmod's spelling stands for
+
+			switch (c) {
+			case '.':
+				if (next == '.')
+					m_p += (m_p + 1 < m_pEnd && m_p[1] == '.') ? 2 : 1;
+				break;
+			case '=': case '~': case '<': case '>':
+				if (next == '=')
+					m_p++;
+				break;
+			case ':':
+				if (next == ':')
+					m_p++;
+				break;
+			case '!':
+				if (next == '=') {
+					lua = "~=";
+					m_p++;
+				} else {
+					lua = "not";
+					token.type = TOKEN_NAME;
+				}
+				break;
+			case '&': case '|':
+				if (next == (char)c) {
+					lua = c == '&' ? "and" : "or";
+					token.type = TOKEN_NAME;
+					m_p++;
+				}
+				break;
+			}
+
+			if (lua != nullptr) {
+				token.text = lua;
+				token.len = strlen(lua);
+				return true;
+			}
+		}
+	}
+
+	if (!ok) {
+		token.type = TOKEN_ERROR;
+		m_p = m_pEnd;
+		m_bDone = true;
+	}
+
+	token.text = start;
+	token.len = m_p - start;
+	return true;
+}
+
+static int hex_value(char c)
+{
+	if (is_digit(c))
+		return c - '0';
+	if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+		return (c | 0x20) - 'a' + 10;
+	return -1;
+}
+
+static void put_utf8(std::string &out, unsigned long c)
+{
+	if (c < 0x80) {
+		out += (char)c;
+	} else if (c < 0x800) {
+		out += (char)(0xC0 | (c >> 6));
+		out += (char)(0x80 | (c & 0x3F));
+	} else if (c < 0x10000) {
+		out += (char)(0xE0 | (c >> 12));
+		out += (char)(0x80 | ((c >> 6) & 0x3F));
+		out += (char)(0x80 | (c & 0x3F));
+	} else {
+		out += (char)(0xF0 | (c >> 18));
+		out += (char)(0x80 | ((c >> 12) & 0x3F));
+		out += (char)(0x80 | ((c >> 6) & 0x3F));
+		out += (char)(0x80 | (c & 0x3F));
+	}
+}
+
+bool lua_string_value(const LuaToken &token, std::string &value)
+{
+	if (token.type != TOKEN_STRING || token.len < 2)
+		return false;
+
+	const char *p = token.text;
+	const char *end = token.text + token.len;
+	value.clear();
+
+	if (*p == '[') {
+		size_t level = 0;
+		p++;
+		while (*p == '=') {
+			p++;
+			level++;
+		}
+		p++;
+		end -= level + 2;
+
+		// a line break straight after the opening bracket isn't part of the string
+		if (p < end && is_newline(*p)) {
+			char c = *p++;
+			if (p < end && is_newline(*p) && *p != c)
+				p++;
+		}
+
+		value.assign(p, end - p);
+		return true;
+	}
+
+	p++;
+	end--;
+
+	while (p < end) {
+		char c = *p++;
+		if (c != '\\') {
+			value += c;
+			continue;
+		}
+
+		c = *p++;
+		switch (c) {
+		case 'a': value += '\a'; break;
+		case 'b': value += '\b'; break;
+		case 'f': value += '\f'; break;
+		case 'n': value += '\n'; break;
+		case 'r': value += '\r'; break;
+		case 't': value += '\t'; break;
+		case 'v': value += '\v'; break;
+		case 'x': {
+			int hi = p < end ? hex_value(p[0]) : -1;
+			int lo = p + 1 < end ? hex_value(p[1]) : -1;
+			if (hi < 0 || lo < 0)
+				return false;
+			value += (char)(hi * 16 + lo);
+			p += 2;
+			break;
+		}
+		case 'u': {
+			if (p >= end || *p != '{')
+				return false;
+			unsigned long code = 0;
+			for (p++; p < end && *p != '}'; p++) {
+				int digit = hex_value(*p);
+				if (digit < 0 || code > 0x10FFFF)
+					return false;
+				code = code * 16 + digit;
+			}
+			if (p >= end)
+				return false;
+			p++;
+			put_utf8(value, code);
+			break;
+		}
+		case 'z':
+			while (p < end && (is_newline(*p) || *p == ' ' || *p == '\t' || *p == '\v' || *p == '\f'))
+				p++;
+			break;
+		case '\n':
+		case '\r':
+			value += '\n';
+			if (p < end && is_newline(*p) && *p != c)
+				p++;
+			break;
+		default:
+			if (is_digit(c)) {
+				int code = c - '0';
+				for (int i = 0; i < 2 && p < end && is_digit(*p); i++)
+					code = code * 10 + (*p++ - '0');
+				if (code > 255)
+					return false;
+				value += (char)code;
+			} else {
+				value += c;
+			}
+			break;
+		}
+	}
+
+	return true;
+}
+
+uint64_t token_hash(const char *src, size_t len, bool strip, uint64_t seed)
+{
+	Hash64State state;
+	hash64_init(&state, seed);
+
+	// tokens are mostly a few bytes, so they're gathered up rather than hashed one by one
+	unsigned char buffer[4096];
+	size_t used = 0;
+
+	LuaLexer lexer(src, len);
+	LuaToken token;
+
+	while (lexer.Next(token)) {
+		// line breaks only reach stripped bytecode through luajit refusing
+		// a call whose ( starts a new line as ambiguous
+		uint32_t newlines = (uint32_t)token.newlines;
+		if (strip)
+			newlines = newlines > 0 && token.type == TOKEN_SYMBOL && token.len == 1 && token.text[0] == '(' ? 1 : 0;
+
+		if (used + 9 + token.len > sizeof(buffer)) {
+			hash64_update(&state, buffer, used);
+			used = 0;
+		}
+
+		unsigned char *head = buffer + used;
+		head[0] = (unsigned char)token.type;
+		for (int i = 0; i < 4; i++) {
+			head[1 + i] = (unsigned char)(newlines >> (i * 8));
+			head[5 + i] = (unsigned char)((uint32_t)token.len >> (i * 8));
+		}
+		used += 9;
+
+		if (token.len > sizeof(buffer) - used) {
+			hash64_update(&state, buffer, used);
+			hash64_update(&state, token.text, token.len);
+			used = 0;
+		} else {
+			memcpy(buffer + used, token.text, token.len);
+			used += token.len;
+		}
+	}
+
+	// the main function's line count runs to the end of the source, so the
+	// breaks after the last token (blank lines, a trailing comment) are in it too
+	if (!strip && token.type == TOKEN_EOF) {
+		if (used + 5 > sizeof(buffer)) {
+			hash64_update(&state, buffer, used);
+			used = 0;
+		}
+
+		buffer[used] = (unsigned char)TOKEN_EOF;
+		for (int i = 0; i < 4; i++)
+			buffer[used + 1 + i] = (unsigned char)((uint32_t)token.newlines >> (i * 8));
+		used += 5;
+	}
+
+	hash64_update(&state, buffer, used);
+	return hash64_final(&state);
+}
@@ -0,0 +1,59 @@
+#ifndef GLUAC_LEXER_H
+#define GLUAC_LEXER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+enum {
+	TOKEN_EOF = 0,
+	TOKEN_NAME,		// identifiers and keywords, gmod's continue included
+	TOKEN_STRING,	// quoted or long bracket strings, text keeps the delimiters
+	TOKEN_NUMBER,
+	TOKEN_SYMBOL,	// operators and punctuation
+	TOKEN_ERROR		// something lua_shared would refuse, text runs to the end of the source
+};
+
+typedef struct {
+	int type;
+	const char *text;
+	size_t len;
+	int line;
+	int newlines;	// line breaks between the end of the previous token and this one
+} LuaToken;
+
+// splits lua source into tokens the way gmod's lua_shared does, which also
+// takes // and /* */ comments and the C spellings !=, &&, || and !. those
+// come back as the lua tokens they stand for (~=, and, or, not) so source
+// written either way gives the same stream
+class LuaLexer
+{
+public:
+	LuaLexer(const char *src, size_t len);
+
+	// false once the source runs out, an error token is the last one returned
+	bool Next(LuaToken &token);
+
+private:
+	bool SkipSpace(int &newlines);
+	bool LongBracket(size_t &level);
+	bool SkipLongBracket(size_t level, int &newlines);
+	void Newline();
+
+	const char *m_pEnd;
+	const char *m_p;
+	int m_iLine;
+	bool m_bDone;
+};
+
+// the contents of a quoted or long bracket string token, false if it isn't one
+bool lua_string_value(const LuaToken &token, std::string &value);
+
+// hashes source as the compiler sees it, so edits that can't change the
+// bytecode keep the hash. comments and spacing never count, line breaks only
+// count when debug information is kept (for the line numbers in it) or when
+// they'd make lua_shared call a call ambiguous
+uint64_t token_hash(const char *src, size_t len, bool strip, uint64_t seed = 0);
+
+#endif
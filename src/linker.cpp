@@ -0,0 +1,294 @@
+#include "linker.h"
+#include "bundle.h"
+#include "compiler.h"
+#include "workpool.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+
+// luajit's dump format (lj_bcdump.h): a header, then every prototype in the
+// chunk with its length in front, children before the function they're in,
+// ending with the chunk's main function and a zero length
+#define BCDUMP_HEAD1		0x1b
+#define BCDUMP_HEAD2		'L'
+#define BCDUMP_HEAD3		'J'
+#define BCDUMP_F_BE			0x01
+#define BCDUMP_F_STRIP		0x02
+#define BCDUMP_F_FFI		0x04
+#define BCDUMP_KGC_CHILD	0
+#define BCDUMP_KGC_STR		5
+
+#define PROTO_CHILD			0x01
+#define PROTO_VARARG		0x02
+
+
+// constants are addressed by 16 bit operands, and each module takes two
+#define LINK_MAX_MODULES	32768
+
+// the opcodes the linked main function uses. 2.0 writes dump version 1 and
+// 2.1 version 2, which adds ISTYPE, ISNUM, TGETR and TSETR among them
+typedef struct {
+	unsigned int kstr;
+	unsigned int fnew;
+	unsigned int tnew;
+	unsigned int tsetv;
+	unsigned int ret1;
+} LinkOpcodes;
+
+static const LinkOpcodes g_Opcodes[2] = {
+	{ 37, 49, 50, 57, 72 },
+	{ 39, 51, 52, 60, 76 },
+};
+
+typedef struct {
+	unsigned int version;
+	uint32_t flags;
+	const char *protos;		// every prototype with its length, up to the zero that ends them
+	size_t len;
+} LinkDump;
+
+static bool read_uleb(const unsigned char *&p, const unsigned char *end, uint32_t &value)
+{
+	value = 0;
+	for (unsigned int shift = 0; p < end && shift < 35; shift += 7) {
+		unsigned char byte = *p++;
+		value |= (uint32_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+static void write_uleb(std::string &out, uint32_t value)
+{
+	while (value >= 0x80) {
+		out.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+
+	out.push_back((char)value);
+}
+
+static bool parse_dump(const std::string &bytecode, LinkDump &dump)
+{
+	const unsigned char *p = (const unsigned char *)bytecode.data();
+	const unsigned char *end = p + bytecode.size();
+
+	if (bytecode.size() < 5 || p[0] != BCDUMP_HEAD1 || p[1] != BCDUMP_HEAD2 || p[2] != BCDUMP_HEAD3)
+		return false;
+
+	dump.version = p[3];
+	p += 4;
+	if ((dump.version != 1 && dump.version != 2) || !read_uleb(p, end, dump.flags))
+		return false;
+
+	// the module's chunkname, the linked chunk has its own
+	if (!(dump.flags & BCDUMP_F_STRIP)) {
+		uint32_t len;
+		if (!read_uleb(p, end, len) || len > (size_t)(end - p))
+			return false;
+		p += len;
+	}
+
+	dump.protos = (const char *)p;
+
+	// the prototypes go in as they are, they only need to be found
+	size_t count = 0;
+	for (;;) {
+		uint32_t len;
+		const unsigned char *at = p;
+		if (!read_uleb(p, end, len))
+			return false;
+
+		if (len == 0) {
+			dump.len = (size_t)((const char *)at - dump.protos);
+			return count > 0 && p == end;
+		}
+
+		if (len > (size_t)(end - p))
+			return false;
+
+		p += len;
+		count++;
+	}
+}
+
+static void write_ins(std::string &out, bool bigendian, uint32_t ins)
+{
+	for (int i = 0; i < 4; i++) {
+		int shift = bigendian ? 24 - i * 8 : i * 8;
+		out.push_back((char)(ins >> shift));
+	}
+}
+
+static uint32_t ins_ad(unsigned int op, uint32_t a, uint32_t d)
+{
+	return op | (a << 8) | (d << 16);
+}
+
+static uint32_t ins_abc(unsigned int op, uint32_t a, uint32_t b, uint32_t c)
+{
+	return op | (a << 8) | (c << 16) | (b << 24);
+}
+
+bool bytecode_link(const std::vector<LinkModule> &modules, const char *chunkname, std::string &out, std::string &err)
+{
+	if (modules.size() > LINK_MAX_MODULES) {
+		err = "too many modules to link into one chunk";
+		return false;
+	}
+
+	std::vector<LinkDump> dumps(modules.size());
+	uint32_t flags = 0;
+	unsigned int version = 1;
+
+	for (size_t i = 0; i < modules.size(); i++) {
+		if (!parse_dump(modules[i].bytecode, dumps[i])) {
+			err = modules[i].name + " isn't luajit bytecode";
+			return false;
+		}
+
+		// ffi is only a hint that the ffi library has to be loaded, any module wanting it is enough
+		if (i > 0 && (dumps[i].version != version || (dumps[i].flags & ~BCDUMP_F_FFI) != (flags & ~BCDUMP_F_FFI))) {
+			err = modules[i].name + " was compiled differently to " + modules[0].name;
+			return false;
+		}
+
+		version = dumps[i].version;
+		flags |= dumps[i].flags;
+	}
+
+	bool strip = (flags & BCDUMP_F_STRIP) != 0;
+	bool bigendian = (flags & BCDUMP_F_BE) != 0;
+	const LinkOpcodes &op = g_Opcodes[version - 1];
+	uint32_t count = (uint32_t)modules.size();
+
+	out.clear();
+	out.push_back(BCDUMP_HEAD1);
+	out.push_back(BCDUMP_HEAD2);
+	out.push_back(BCDUMP_HEAD3);
+	out.push_back((char)version);
+	write_uleb(out, flags);
+
+	if (!strip) {
+		size_t len = strlen(chunkname);
+		write_uleb(out, (uint32_t)len);
+		out.append(chunkname, len);
+	}
+
+	// each module's functions finish with its main function left on the
+	// loader's stack, in order, for the linked main function to take
+	for (size_t i = 0; i < dumps.size(); i++)
+		out.append(dumps[i].protos, dumps[i].len);
+
+	// the table is sized for every name up front
+	uint32_t hbits = 0;
+	while ((1u << hbits) < count)
+		hbits++;
+
+	// constants are numbered back from the end of the list, and the children
+	// at the end of it take the stack from the top, so module i's main
+	// function ends up constant i and its name constant count + i
+	std::string proto;
+	proto.push_back((char)(count > 0 ? PROTO_CHILD | PROTO_VARARG : PROTO_VARARG));
+	proto.push_back(0);		// parameters
+	proto.push_back(3);		// slots: the table, a function and its name
+	proto.push_back(0);		// upvalues
+	write_uleb(proto, count * 2);
+	write_uleb(proto, 0);
+	write_uleb(proto, count * 3 + 2);
+	if (!strip)
+		write_uleb(proto, 0);
+
+	write_ins(proto, bigendian, ins_ad(op.tnew, 0, hbits << 11));
+	for (uint32_t i = 0; i < count; i++) {
+		write_ins(proto, bigendian, ins_ad(op.fnew, 1, i));
+		write_ins(proto, bigendian, ins_ad(op.kstr, 2, count + i));
+		write_ins(proto, bigendian, ins_abc(op.tsetv, 1, 0, 2));
+	}
+	write_ins(proto, bigendian, ins_ad(op.ret1, 0, 2));
+
+	for (uint32_t i = count; i-- > 0;) {
+		write_uleb(proto, BCDUMP_KGC_STR + (uint32_t)modules[i].name.size());
+		proto += modules[i].name;
+	}
+	for (uint32_t i = 0; i < count; i++)
+		write_uleb(proto, BCDUMP_KGC_CHILD);
+
+	write_uleb(out, (uint32_t)proto.size());
+	out += proto;
+	out.push_back(0);
+
+	return true;
+}
+
+int link_main(const std::vector<BatchItem> &items, const char *path, const BatchOptions &options)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<LinkModule> modules(items.size());
+	std::atomic<size_t> failed(0);
+
+	size_t workers = options.workers ? options.workers : std::thread::hardware_concurrency();
+	if (workers > items.size())
+		workers = items.size();
+
+	WorkPool pool(workers ? workers : 1, workers * 4 + 4, 0, options.limits);
+	if (!pool.Start())
+		return 1;
+
+	for (size_t i = 0; i < items.size(); i++) {
+		const BatchItem *item = &items[i];
+		LinkModule *module = &modules[i];
+
+		pool.Push([item, module, &options, &failed](lua_State *L) {
+			std::string source;
+			std::string err;
+
+			if (!read_file(item->input.c_str(), source)) {
+				fprintf(stderr, "cannot open %s\n", item->input.c_str());
+				failed++;
+				return;
+			}
+
+			CompileJob job = { item->input.c_str(), source.data(), source.size(), item->chunkname.c_str(), options.strip, options.parseonly, write_dump_string, &module->bytecode };
+
+			if (!compile(L, &job, err)) {
+				fprintf(stderr, "%s\n", err.c_str());
+				failed++;
+				return;
+			}
+
+			module->name = bundle_name(item->output);
+		});
+	}
+
+	pool.Wait();
+
+	int status = failed ? 1 : 0;
+
+	if (failed == 0 && !options.parseonly) {
+		std::string chunk;
+		std::string err;
+		std::string chunkname = std::string("@") + path;
+
+		if (!bytecode_link(modules, chunkname.c_str(), chunk, err)) {
+			fprintf(stderr, "%s\n", err.c_str());
+			status = 1;
+		} else if (!write_file_atomic(path, chunk.data(), chunk.size())) {
+			fprintf(stderr, "cannot write %s\n", path);
+			status = 1;
+		}
+	}
+
+	if (options.stats) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		batch_report("link", items.size(), failed, elapsed.count());
+	}
+
+	return status;
+}
@@ -0,0 +1,27 @@
+#ifndef GLUAC_LINKER_H
+#define GLUAC_LINKER_H
+
+#include "batch.h"
+
+#include <string>
+#include <vector>
+
+typedef struct {
+	std::string name;		// key the module's function is stored under
+	std::string bytecode;	// its dump as compile wrote it
+} LinkModule;
+
+// joins compiled modules into one chunk whose main function returns a table
+// of each module's own main function by name, uncalled. the modules' functions
+// go in unchanged with their line info, but luajit keeps one chunkname per
+// chunk, so errors in any of them name the linked chunk (chunkname, unused
+// when the modules were stripped). every module has to come from the same
+// luajit with the same strip flag. false with err set if they can't be joined
+bool bytecode_link(const std::vector<LinkModule> &modules, const char *chunkname, std::string &out, std::string &err);
+
+// compiles every item and links them into one chunk at path, each item's
+// output being its name in the table. nothing is written if any item fails.
+// returns an exit code
+int link_main(const std::vector<BatchItem> &items, const char *path, const BatchOptions &options);
+
+#endif
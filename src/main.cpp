@@ -1,101 +1,67 @@
-#include "lua_dyn.h"
-#include "lua_jit.h"
-
-#ifdef _WIN32
-#include <windows.h>
-#else
-#include <dlfcn.h>
-#endif
+#include "batch.h"
+#include "bundle.h"
+#include "compiler.h"
+#include "compress.h"
+#include "coprocess.h"
+#include "daemon.h"
+#include "delta.h"
+#include "gluac.h"
+#include "gma.h"
+#include "linker.h"
+#include "script.h"
+#include "spool.h"
+#include "tar.h"
+#include "walk.h"
+#include "watch.h"
 
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
-#include <symbolfinder.hpp>
-
-#define LUA_PREFIX LuaFunctions.
-lua_All_functions LuaFunctions;
 
 char* g_sInputFilename = nullptr;
 char* g_sOutputFilename = nullptr;
+char* g_sOutputDir = nullptr;
 bool g_bParseOnly = false;
 bool g_bStripDebug = false;
 
-typedef int(__cdecl *lj_bcwrite_t) (lua_State *L, void *gcproto, lua_Writer, void *data, int strip);
-lj_bcwrite_t lj_bcwrite = NULL;
-
-#ifdef _WIN32
-static const char *LuaJIT_bcwrite_sym = "\x83\xEC\x24\x8B\x4C\x24\x2C\x8B\x54\x24\x30\x8B\x44\x24\x28\x89";
-static const size_t LuaJIT_bcwrite_symlen = 16;
-#else
-static const char *LuaJIT_bcwrite_sym = "@lj_bcwrite";
-static const size_t LuaJIT_bcwrite_symlen = 0;
-#endif
-
-typedef struct {
-	size_t *len;
-	char **data;
-} wdata;
-
-int write_dump(lua_State *L, const void* p, size_t sz, void* ud)
+static int write_bytecode(const void *data, size_t len, void *ud)
 {
-	wdata *wd = (wdata *)ud;
-
-	char *newData = (char *)realloc(*(wd->data), (*(wd->len)) + sz);
-
-	if (newData)
-	{
-		memcpy(newData + (*(wd->len)), p, sz);
-		*(wd->data) = newData;
-		*(wd->len) += sz;
-	}
-	else {
-		free(newData);
-		return 1;
-	}
-
+	((std::string *)ud)->append((const char *)data, len);
 	return 0;
 }
 
-int lua_bcwrite(lua_State *L, lua_Writer writer, void *data, bool strip)
-{
-	cTValue *o = L->top - 1;
-	return lj_bcwrite(L, (GCproto *)(mref((&gcval(o)->fn)->l.pc, char) - sizeof(GCproto)), writer, data, strip);
-}
-
-bool load_lua_shared()
+static int lua_main(gluac_context *ctx, const ChunknameOptions &chunknames)
 {
-	#ifdef _WIN32
-	HMODULE module = LoadLibrary("lua_shared.dll");
+	std::string bytecode;
+	unsigned int flags = (g_bStripDebug ? GLUAC_STRIP : 0) | (g_bParseOnly ? GLUAC_PARSEONLY : 0);
+	int status;
 
-	if (module == nullptr) {
-		fprintf(stderr, "could not find lua_shared\n");
-		return false;
-	}
-	#else
-	void* module = dlopen("lua_shared_srv.so", RTLD_LAZY);
+	if (chunknames.name.empty() && chunknames.relative.empty() && chunknames.strip.empty()) {
+		// if filename is NULL it loads from stdin
+		status = gluac_compile_file(ctx, g_sInputFilename, flags, write_bytecode, &bytecode);
+	} else {
+		std::string source;
+		if (g_sInputFilename != nullptr) {
+			if (!read_file(g_sInputFilename, source)) {
+				fprintf(stderr, "cannot open %s\n", g_sInputFilename);
+				return 1;
+			}
+		} else {
+			char buffer[16384];
+			size_t n;
+			while ((n = fread(buffer, 1, sizeof(buffer), stdin)) > 0)
+				source.append(buffer, n);
+		}
 
-	if (module == nullptr) {
-		fprintf(stderr, "%s\n", dlerror());
-		return false;
+		std::string chunkname = make_chunkname(g_sInputFilename, chunknames);
+		status = gluac_compile_buffer(ctx, source.data(), source.size(), chunkname.c_str(), flags, write_bytecode, &bytecode);
 	}
 
-	#endif
-
-	SymbolFinder symfinder;
-	lj_bcwrite = reinterpret_cast<lj_bcwrite_t>(symfinder.Resolve(module, LuaJIT_bcwrite_sym, LuaJIT_bcwrite_symlen));
-	
-	if (lj_bcwrite == nullptr) {
-		fprintf(stderr, "failed to resolve lj_bcwrite\n");
-		return false;
-	}
-
-	return luaL_loadfunctions(module, &LuaFunctions, sizeof(LuaFunctions));
-}
-
-static int lua_main(lua_State* L)
-{
-	// load our Lua file as a chunk on the stack (if filename is NULL it loads from stdin)
-	if (luaL_loadfile(L, g_sInputFilename) != 0) {
-		fprintf(stderr, "%s\n", lua_tostring(L, -1));
-		return 0;
+	if (status != GLUAC_OK) {
+		fprintf(stderr, "%s\n", gluac_error(ctx));
+		return 1;
 	}
 
 	// return early if we only want parsing
@@ -103,60 +69,481 @@ static int lua_main(lua_State* L)
 		return 0;
 	}
 
-	char* bytecode = 0L;
-	size_t len = 0;
-	wdata wd = { &len, &bytecode };
+	if (g_sOutputFilename != nullptr) {
+		if (!write_file_atomic(g_sOutputFilename, bytecode.data(), bytecode.size())) {
+			fprintf(stderr, "cannot write %s\n", g_sOutputFilename);
+			return 1;
+		}
 
-	if (lua_bcwrite(L, write_dump, &wd, g_bStripDebug))
-	{
-		fprintf(stderr, "failed to dump bytecode\n");
 		return 0;
 	}
 
 	// output bytecode to stdout
-	fwrite(bytecode, len, 1, stdout);
+	fwrite(bytecode.data(), bytecode.size(), 1, stdout);
 	fflush(stdout);
-	
+
 	return 0;
 }
 
+static void usage()
+{
+	printf("USAGE: gluac [input] [output] [-p] [-s]\n");
+	printf("       gluac -o <dir> [input...] [-p] [-s]\n");
+	printf("       gluac -r <srcdir> <outdir> [-p] [-s]\n");
+	printf("       gluac --watch <srcdir> <outdir> [-p] [-s]\n");
+	printf("       gluac -e <script> [-- args...]\n");
+	printf("       gluac --bundle <file> [-r <srcdir> | input...]\n");
+	printf("       gluac --emit-object <file.o|file.cpp> [-r <srcdir> | input...]\n");
+	printf("       gluac --link <file> [-r <srcdir> | input...]\n");
+	printf("       gluac --gma <input.gma> <output.gma>\n");
+	printf("       gluac --tar < input.tar > output.tar\n");
+	printf("       gluac --delta <olddir> <newdir> <patch>\n");
+	printf("       gluac --apply <patch> <dir>\n");
+	printf("       gluac --spool <dir> [-o <dir> input... | -r <srcdir> <outdir>]\n");
+	printf("-p: Parse only, doesn't dump bytecode\n");
+	printf("-s: Strip debug information\n");
+	printf("-o <dir>: Compile every input into dir, keeping their relative paths\n");
+	printf("--chunkname <name>: Name a single input this in errors and debug information\n");
+	printf("--chunkname-relative <dir>: Name inputs by their path relative to dir\n");
+	printf("--chunkname-strip <dir>: Leave dir off the front of input names (repeatable)\n");
+	printf("-r: Compile every .lua file under srcdir into the same layout under outdir\n");
+	printf("--include <glob>: With -r, compile matching files instead of *.lua (repeatable)\n");
+	printf("--exclude <glob>: With -r, skip matching files and directories (repeatable)\n");
+	printf("-e <script>: Run a lua build script with the gluac library, args are passed to it\n");
+	printf("--watch: Build srcdir into outdir like -r, then recompile files as they change\n");
+	printf("--debounce <ms>: With --watch, quiet time after a change before compiling (default 20)\n");
+	printf("--bundle <file>: Compile into one indexed bundle instead of separate files\n");
+	printf("--emit-object <file>: Compile into a bundle inside an object (.o) or c++ source file to link into a host\n");
+	printf("--symbol <name>: With --emit-object, the symbol the bundle is defined as (default gluac_embedded)\n");
+	printf("--link <file>: Compile into one chunk that returns a table of every file's function\n");
+	printf("--gma: Compile the lua in an addon, writing a new addon (output - for stdout)\n");
+	printf("--tar: Compile the lua in a tar stream from stdin, writing the stream to stdout\n");
+	printf("--delta: Write a patch taking the compiled tree in olddir to the one in newdir\n");
+	printf("--apply: Check a tree is the one a patch was made from and patch it\n");
+	printf("--order <file>: With --bundle, lay files out in the order this load trace lists them\n");
+	printf("--lazy <file>: With --bundle, put the modules this lists behind stubs that load them on first use\n");
+	printf("--compress <fast|high>: With -o, -r or --bundle, compress each output for loading or for shipping\n");
+	printf("--spool <dir>: Share the build through a spool directory, with no inputs just work on it\n");
+	printf("--lease <s>: With --spool, how long a claimed job can go without being renewed (default 30)\n");
+	printf("--chunk <n>: With --spool, inputs per job (default 64)\n");
+	printf("--zygote: With -o, compile each file in a forked copy of a warm state\n");
+	printf("--stats: With -o, print timings when done\n");
+	printf("--prefetch <n>: With -o, number of inputs to read ahead of the compiler\n");
+	printf("--io <uring|threads>: With -o, how files are read and written (default uring where available)\n");
+	printf("--coprocess: Answer framed compile requests on stdin with framed responses on stdout\n");
+	printf("--daemon: Serve compile requests on a local socket, keeping lua_shared loaded\n");
+	printf("--remote: Compile through a running daemon, falling back to compiling locally\n");
+	printf("--socket <path>: Socket used by --daemon and --remote (default %s)\n", daemon_default_socket().c_str());
+	printf("--priority <interactive|batch>: Lane for --remote requests, single files default to interactive\n");
+	printf("--interactive-workers <n>: Daemon workers kept free for interactive requests (default 1)\n");
+	printf("--metrics <addr>: Serve daemon metrics over http on a port, host:port or unix socket path\n");
+	printf("--cache-size <mb>: Memory the daemon uses to cache results (default 64, 0 disables)\n");
+	printf("--time-limit <ms>: Fail any file that takes longer than this to compile\n");
+	printf("--memory-limit <mb>: Fail any file that needs more than this much memory to compile\n");
+	printf("-j <n>: Number of worker states, defaults to the number of cores\n");
+}
+
 int main(int argc, char* argv[])
 {
+	enum { OPT_DAEMON = 256, OPT_REMOTE, OPT_SOCKET, OPT_ZYGOTE, OPT_STATS, OPT_PRIORITY, OPT_INTERACTIVE_WORKERS, OPT_METRICS, OPT_CACHE_SIZE, OPT_TIME_LIMIT, OPT_MEMORY_LIMIT, OPT_INCLUDE, OPT_EXCLUDE, OPT_PREFETCH, OPT_IO, OPT_WATCH, OPT_DEBOUNCE, OPT_COPROCESS, OPT_SPOOL, OPT_LEASE, OPT_CHUNK, OPT_CHUNKNAME, OPT_CHUNKNAME_RELATIVE, OPT_CHUNKNAME_STRIP, OPT_BUNDLE, OPT_ORDER, OPT_COMPRESS, OPT_GMA, OPT_TAR, OPT_DELTA, OPT_APPLY, OPT_LINK, OPT_LAZY, OPT_EMIT_OBJECT, OPT_SYMBOL };
+
+	static const struct option options[] = {
+		{ "daemon", no_argument, nullptr, OPT_DAEMON },
+		{ "remote", no_argument, nullptr, OPT_REMOTE },
+		{ "socket", required_argument, nullptr, OPT_SOCKET },
+		{ "zygote", no_argument, nullptr, OPT_ZYGOTE },
+		{ "stats", no_argument, nullptr, OPT_STATS },
+		{ "priority", required_argument, nullptr, OPT_PRIORITY },
+		{ "interactive-workers", required_argument, nullptr, OPT_INTERACTIVE_WORKERS },
+		{ "metrics", required_argument, nullptr, OPT_METRICS },
+		{ "cache-size", required_argument, nullptr, OPT_CACHE_SIZE },
+		{ "time-limit", required_argument, nullptr, OPT_TIME_LIMIT },
+		{ "memory-limit", required_argument, nullptr, OPT_MEMORY_LIMIT },
+		{ "include", required_argument, nullptr, OPT_INCLUDE },
+		{ "exclude", required_argument, nullptr, OPT_EXCLUDE },
+		{ "prefetch", required_argument, nullptr, OPT_PREFETCH },
+		{ "io", required_argument, nullptr, OPT_IO },
+		{ "watch", no_argument, nullptr, OPT_WATCH },
+		{ "debounce", required_argument, nullptr, OPT_DEBOUNCE },
+		{ "coprocess", no_argument, nullptr, OPT_COPROCESS },
+		{ "spool", required_argument, nullptr, OPT_SPOOL },
+		{ "lease", required_argument, nullptr, OPT_LEASE },
+		{ "chunk", required_argument, nullptr, OPT_CHUNK },
+		{ "chunkname", required_argument, nullptr, OPT_CHUNKNAME },
+		{ "chunkname-relative", required_argument, nullptr, OPT_CHUNKNAME_RELATIVE },
+		{ "chunkname-strip", required_argument, nullptr, OPT_CHUNKNAME_STRIP },
+		{ "bundle", required_argument, nullptr, OPT_BUNDLE },
+		{ "order", required_argument, nullptr, OPT_ORDER },
+		{ "compress", required_argument, nullptr, OPT_COMPRESS },
+		{ "gma", no_argument, nullptr, OPT_GMA },
+		{ "tar", no_argument, nullptr, OPT_TAR },
+		{ "delta", no_argument, nullptr, OPT_DELTA },
+		{ "apply", no_argument, nullptr, OPT_APPLY },
+		{ "link", required_argument, nullptr, OPT_LINK },
+		{ "lazy", required_argument, nullptr, OPT_LAZY },
+		{ "emit-object", required_argument, nullptr, OPT_EMIT_OBJECT },
+		{ "symbol", required_argument, nullptr, OPT_SYMBOL },
+		{ nullptr, 0, nullptr, 0 }
+	};
+
+	bool daemon = false;
+	bool remote = false;
+	bool zygote = false;
+	bool stats = false;
+	bool recursive = false;
+	size_t prefetch = 0;
+	const char *io = nullptr;
+	bool watch = false;
+	unsigned int debounce = 20;
+	bool coprocess = false;
+	const char *script = nullptr;
+	const char *spool = nullptr;
+	const char *bundle = nullptr;
+	const char *order = nullptr;
+	const char *link = nullptr;
+	const char *lazy = nullptr;
+	const char *object = nullptr;
+	const char *symbol = nullptr;
+	int compress = COMPRESS_NONE;
+	bool gma = false;
+	bool tar = false;
+	bool delta = false;
+	bool apply = false;
+	unsigned int lease = 30;
+	size_t chunk = 64;
+	WalkOptions walk;
+	ChunknameOptions chunknames;
+	std::string socketpath = daemon_default_socket();
+	size_t workers = 0;
+	int reserved = -1;
+	const char *priority = nullptr;
+	const char *metrics = nullptr;
+	size_t cachemb = 64;
+	CompileLimits limits = { 0, 0 };
+
 	int opt;
-    while ((opt = getopt(argc, argv, "ps")) != -1) {
+    while ((opt = getopt_long(argc, argv, "psrj:o:e:", options, nullptr)) != -1) {
         switch (opt) {
         case 'p': g_bParseOnly = true; break;
         case 's': g_bStripDebug = true; break;
+        case 'j': workers = (size_t)atoi(optarg); break;
+        case 'o': g_sOutputDir = optarg; break;
+        case 'r': recursive = true; break;
+        case 'e': script = optarg; break;
+        case OPT_DAEMON: daemon = true; break;
+        case OPT_REMOTE: remote = true; break;
+        case OPT_SOCKET: socketpath = optarg; break;
+        case OPT_ZYGOTE: zygote = true; break;
+        case OPT_STATS: stats = true; break;
+        case OPT_PRIORITY: priority = optarg; break;
+        case OPT_INTERACTIVE_WORKERS: reserved = atoi(optarg); break;
+        case OPT_METRICS: metrics = optarg; break;
+        case OPT_CACHE_SIZE: cachemb = (size_t)atoi(optarg); break;
+        case OPT_TIME_LIMIT: limits.milliseconds = (unsigned int)atoi(optarg); break;
+        case OPT_MEMORY_LIMIT: limits.memory = (size_t)atoi(optarg) * 1024 * 1024; break;
+        case OPT_INCLUDE: walk.include.push_back(optarg); break;
+        case OPT_EXCLUDE: walk.exclude.push_back(optarg); break;
+        case OPT_PREFETCH: prefetch = (size_t)atoi(optarg); break;
+        case OPT_IO: io = optarg; break;
+        case OPT_WATCH: watch = true; break;
+        case OPT_DEBOUNCE: debounce = (unsigned int)atoi(optarg); break;
+        case OPT_COPROCESS: coprocess = true; break;
+        case OPT_SPOOL: spool = optarg; break;
+        case OPT_LEASE: lease = (unsigned int)atoi(optarg); break;
+        case OPT_CHUNK: chunk = (size_t)atoi(optarg); break;
+        case OPT_CHUNKNAME: chunknames.name = optarg; break;
+        case OPT_CHUNKNAME_RELATIVE: chunknames.relative = optarg; break;
+        case OPT_CHUNKNAME_STRIP: chunknames.strip.push_back(optarg); break;
+        case OPT_BUNDLE: bundle = optarg; break;
+        case OPT_ORDER: order = optarg; break;
+        case OPT_GMA: gma = true; break;
+        case OPT_TAR: tar = true; break;
+        case OPT_DELTA: delta = true; break;
+        case OPT_APPLY: apply = true; break;
+        case OPT_LINK: link = optarg; break;
+        case OPT_LAZY: lazy = optarg; break;
+        case OPT_EMIT_OBJECT: object = optarg; break;
+        case OPT_SYMBOL: symbol = optarg; break;
+        case OPT_COMPRESS:
+        	if (!parse_compress_level(optarg, compress)) {
+        		usage();
+        		return 1;
+        	}
+        	break;
         default:
-			printf("USAGE: gluac [input] [output] [-p] [-s]\n");
-			printf("-p: Parse only, doesn't dump bytecode\n");
-			printf("-s: Strip debug information\n");
+			usage();
             return 1;
         }
     }
 
-    if (optind < argc) {
+	// an embedded bundle is built like any other, it's only written out differently
+	if (object != nullptr) {
+		if (bundle != nullptr) {
+			usage();
+			return 1;
+		}
+
+		bundle = object;
+	}
+
+	if (symbol != nullptr && object == nullptr) {
+		usage();
+		return 1;
+	}
+
+	// requests name their own inputs, the coprocess only ever reads stdin
+	if (coprocess && (optind != argc || g_sOutputDir != nullptr || recursive || watch || daemon)) {
+		usage();
+		return 1;
+	}
+
+	// the script decides what to compile, everything left over is its arguments
+	if (script != nullptr && (g_sOutputDir != nullptr || recursive || watch || daemon || coprocess || zygote || remote)) {
+		usage();
+		return 1;
+	}
+
+	if (watch && (optind + 2 != argc || recursive || g_sOutputDir != nullptr || zygote)) {
+		usage();
+		return 1;
+	}
+
+	// one name for everything only makes sense when there's one thing
+	if (!chunknames.name.empty() && (g_sOutputDir != nullptr || recursive || watch || daemon || coprocess || spool != nullptr || script != nullptr || bundle != nullptr || link != nullptr)) {
+		usage();
+		return 1;
+	}
+
+	if (bundle != nullptr && (g_sOutputDir != nullptr || watch || daemon || coprocess || zygote || remote || spool != nullptr || script != nullptr)) {
+		usage();
+		return 1;
+	}
+
+	// the linked chunk is loaded as it is, so it can't be compressed
+	if (link != nullptr && (bundle != nullptr || g_sOutputDir != nullptr || watch || daemon || coprocess || zygote || remote || spool != nullptr || script != nullptr || gma || tar || delta || apply || compress != COMPRESS_NONE)) {
+		usage();
+		return 1;
+	}
+
+	if ((order != nullptr || lazy != nullptr) && bundle == nullptr) {
+		usage();
+		return 1;
+	}
+
+	// an addon is its own input list, and gmod can't load compressed entries
+	if (gma && (optind + 2 != argc || g_sOutputDir != nullptr || recursive || watch || daemon || coprocess || zygote || remote || spool != nullptr || script != nullptr || bundle != nullptr || compress != COMPRESS_NONE || !chunknames.name.empty() || !chunknames.relative.empty())) {
+		usage();
+		return 1;
+	}
+
+	// these only read and write files, nothing else applies to them
+	if ((delta || apply) && (optind + (delta ? 3 : 2) != argc || (delta && apply) || tar || gma || g_sOutputDir != nullptr || recursive || watch || daemon || coprocess || zygote || remote || spool != nullptr || script != nullptr || bundle != nullptr || (apply && compress != COMPRESS_NONE))) {
+		usage();
+		return 1;
+	}
+
+	if (delta) {
+		walk.threads = workers;
+		DeltaOptions options = { walk, workers, compress, stats };
+		return delta_main(argv[optind], argv[optind + 1], argv[optind + 2], options);
+	}
+
+	if (apply) {
+		return delta_apply(argv[optind], argv[optind + 1], stats);
+	}
+
+	if (tar && (optind != argc || gma || g_sOutputDir != nullptr || recursive || watch || daemon || coprocess || zygote || remote || spool != nullptr || script != nullptr || bundle != nullptr || compress != COMPRESS_NONE || !chunknames.name.empty() || !chunknames.relative.empty())) {
+		usage();
+		return 1;
+	}
+
+	// the other modes write outputs somewhere this process doesn't control
+	if (compress != COMPRESS_NONE && (watch || daemon || coprocess || zygote || remote || spool != nullptr || script != nullptr)) {
+		usage();
+		return 1;
+	}
+
+	if (spool != nullptr && (watch || daemon || coprocess || zygote || remote || script != nullptr || lease == 0 || chunk == 0)) {
+		usage();
+		return 1;
+	}
+
+	std::vector<BatchItem> items;
+	if (recursive) {
+		// a bundle or a linked chunk takes the place of the output directory
+		if (optind + (bundle != nullptr || link != nullptr ? 1 : 2) != argc || g_sOutputDir != nullptr) {
+			usage();
+			return 1;
+		}
+
+		std::string root = argv[optind];
+		if (bundle == nullptr && link == nullptr)
+			g_sOutputDir = argv[optind + 1];
+
+		std::vector<std::string> files;
+		walk.threads = workers;
+		if (!walk_tree(root.c_str(), walk, files))
+			return 1;
+
+		if (files.empty()) {
+			fprintf(stderr, "no files to compile under %s\n", root.c_str());
+			return 0;
+		}
+
+		if (root[root.size() - 1] != '/')
+			root += '/';
+
+		std::string outdir = bundle != nullptr || link != nullptr ? "" : g_sOutputDir;
+		if (!outdir.empty() && outdir[outdir.size() - 1] != '/')
+			outdir += '/';
+
+		for (size_t i = 0; i < files.size(); i++) {
+			BatchItem item = { root + files[i], outdir + files[i], make_chunkname((root + files[i]).c_str(), chunknames) };
+			items.push_back(item);
+		}
+	}
+
+	if (zygote && g_sOutputDir == nullptr) {
+		fprintf(stderr, "--zygote needs an output directory (-o)\n");
+		return 1;
+	}
+
+	if ((g_sOutputDir != nullptr || bundle != nullptr || link != nullptr) && !recursive) {
+		for (int i = optind; i < argc; i++) {
+			BatchItem item = { argv[i], "", make_chunkname(argv[i], chunknames) };
+
+			// files in a bundle or a linked chunk go by the name they were compiled under
+			if (bundle != nullptr || link != nullptr)
+				item.output = item.chunkname[0] == '@' ? item.chunkname.substr(1) : item.chunkname;
+			else
+				item.output = batch_output_path(g_sOutputDir, argv[i]);
+
+			items.push_back(item);
+		}
+
+		if (items.empty()) {
+			usage();
+			return 1;
+		}
+	}
+
+    if (script == nullptr && optind < argc) {
     	g_sInputFilename = argv[optind];
     }
 
-	if (!load_lua_shared()) {
+    if (script == nullptr && optind + 1 < argc) {
+    	g_sOutputFilename = argv[optind + 1];
+    }
+
+	if (priority != nullptr && strcmp(priority, "interactive") != 0 && strcmp(priority, "batch") != 0) {
+		usage();
+		return 1;
+	}
+
+	if (io != nullptr && strcmp(io, "uring") != 0 && strcmp(io, "threads") != 0) {
+		usage();
+		return 1;
+	}
+
+	bool threadio = io != nullptr && strcmp(io, "threads") == 0;
+
+	if (remote && !watch && !coprocess) {
+		// a lone file is usually an editor or a make rule waiting on it
+		bool interactive = priority != nullptr ? strcmp(priority, "interactive") == 0 : items.empty();
+		BatchOptions batch = { g_bStripDebug, g_bParseOnly, workers, stats, limits, prefetch, threadio, compress };
+
+		int status = items.empty() ?
+			daemon_remote(socketpath.c_str(), g_sInputFilename, g_sOutputFilename, make_chunkname(g_sInputFilename, chunknames), g_bStripDebug, g_bParseOnly, interactive) :
+			daemon_remote_batch(socketpath.c_str(), items, batch, interactive);
+
+		if (status >= 0)
+			return status;
+	}
+
+	if (gluac_init() != GLUAC_OK) {
 		fprintf(stderr, "error loading lua_shared\n");
 		return 1;
 	}
 
-	lua_State* L = lua_open();
-	luaL_openlibs(L);
-	if (L == nullptr) {
-		fprintf(stderr, "cannot create lua state: not enough memory.\n");
+	if (coprocess) {
+		return coprocess_main(limits);
+	}
+
+	if (spool != nullptr) {
+		// a worker takes its inputs from the spool
+		if (items.empty() && optind != argc) {
+			usage();
+			return 1;
+		}
+
+		SpoolOptions options = { { g_bStripDebug, g_bParseOnly, workers, stats, limits, prefetch, threadio, compress }, lease, chunk };
+		return items.empty() ? spool_work(spool, options) : spool_submit(spool, items, options);
+	}
+
+	if (script != nullptr) {
+		BatchOptions batch = { g_bStripDebug, g_bParseOnly, workers, stats, limits, prefetch, threadio, compress };
+		return script_main(script, argc - optind, argv + optind, batch);
+	}
+
+	if (watch) {
+		walk.threads = workers;
+		WatchOptions options = { { g_bStripDebug, g_bParseOnly, workers, stats, limits, prefetch, threadio, compress }, walk, debounce, chunknames };
+		return watch_main(argv[optind], argv[optind + 1], options);
+	}
+
+	if (daemon) {
+		DaemonOptions options = { socketpath.c_str(), workers, reserved, metrics, cachemb * 1024 * 1024, limits };
+		return daemon_main(options);
+	}
+
+	if (tar) {
+		TarOptions options = { { g_bStripDebug, g_bParseOnly, workers, stats, limits, prefetch, threadio, compress }, chunknames, 0, 64 * 1024 * 1024 };
+		return tar_main(options);
+	}
+
+	if (gma) {
+		GmaOptions options = { { g_bStripDebug, g_bParseOnly, workers, stats, limits, prefetch, threadio, compress }, chunknames };
+		return gma_main(argv[optind], argv[optind + 1], options);
+	}
+
+	if (bundle != nullptr) {
+		if (items.empty()) {
+			usage();
+			return 1;
+		}
+
+		BundleOptions options = { { g_bStripDebug, g_bParseOnly, workers, stats, limits, prefetch, threadio, compress }, order, lazy, object != nullptr ? (symbol != nullptr ? symbol : "gluac_embedded") : nullptr };
+		return bundle_main(items, bundle, options);
+	}
+
+	if (link != nullptr) {
+		if (items.empty()) {
+			usage();
+			return 1;
+		}
+
+		BatchOptions batch = { g_bStripDebug, g_bParseOnly, workers, stats, limits, prefetch, threadio, compress };
+		return link_main(items, link, batch);
+	}
+
+	if (compress != COMPRESS_NONE && items.empty()) {
+		usage();
 		return 1;
 	}
 
-	if (lua_cpcall(L, lua_main, nullptr) != 0) {
-		fprintf(stderr, "lua_cpcall: %s\n", lua_tostring(L, -1));
-		lua_close(L);
+	if (!items.empty()) {
+		BatchOptions batch = { g_bStripDebug, g_bParseOnly, workers, stats, limits, prefetch, threadio, compress };
+		return zygote ? zygote_main(items, batch) : batch_main(items, batch);
+	}
+
+	gluac_limits contextlimits = { limits.memory, limits.milliseconds };
+	gluac_context *ctx = gluac_context_new(&contextlimits);
+	if (ctx == nullptr) {
 		return 1;
 	}
 
-	lua_close(L);
-	return 0;
-}
\ No newline at end of file
+	int status = lua_main(ctx, chunknames);
+
+	gluac_context_free(ctx);
+	return status;
+}
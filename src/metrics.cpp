@@ -0,0 +1,236 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+static const double g_Buckets[METRICS_BUCKETS] = {
+	0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0
+};
+
+Histogram::Histogram() : m_iCount(0), m_iSumMicros(0)
+{
+	for (int i = 0; i < METRICS_BUCKETS; i++)
+		m_Buckets[i] = 0;
+}
+
+void Histogram::Observe(double seconds)
+{
+	// buckets are stored non-cumulative and summed up when rendered
+	for (int i = 0; i < METRICS_BUCKETS; i++) {
+		if (seconds <= g_Buckets[i]) {
+			m_Buckets[i]++;
+			break;
+		}
+	}
+
+	m_iCount++;
+	m_iSumMicros += (unsigned long long)(seconds * 1e6);
+}
+
+void Histogram::Write(std::string &out, const char *name, const char *labels) const
+{
+	char line[256];
+	unsigned long long cumulative = 0;
+	const char *sep = *labels ? "," : "";
+
+	for (int i = 0; i < METRICS_BUCKETS; i++) {
+		cumulative += m_Buckets[i];
+		snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels, sep, g_Buckets[i], cumulative);
+		out += line;
+	}
+
+	unsigned long long count = m_iCount;
+	snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep, count);
+	out += line;
+	snprintf(line, sizeof(line), "%s_sum{%s} %.6f\n", name, labels, m_iSumMicros / 1e6);
+	out += line;
+	snprintf(line, sizeof(line), "%s_count{%s} %llu\n", name, labels, count);
+	out += line;
+}
+
+void metrics_header(std::string &out, const char *name, const char *type, const char *help)
+{
+	out += "# HELP ";
+	out += name;
+	out += " ";
+	out += help;
+	out += "\n# TYPE ";
+	out += name;
+	out += " ";
+	out += type;
+	out += "\n";
+}
+
+void metrics_sample(std::string &out, const char *name, const char *labels, double value)
+{
+	char line[256];
+	if (*labels)
+		snprintf(line, sizeof(line), "%s{%s} %.15g\n", name, labels, value);
+	else
+		snprintf(line, sizeof(line), "%s %.15g\n", name, value);
+	out += line;
+}
+
+#ifdef _WIN32
+
+bool MetricsServer::Start(const char *address, Renderer render)
+{
+	fprintf(stderr, "metrics are not supported on this platform\n");
+	return false;
+}
+
+void MetricsServer::Stop()
+{
+}
+
+void MetricsServer::Run()
+{
+}
+
+#else
+
+bool MetricsServer::Start(const char *address, Renderer render)
+{
+	m_Render = render;
+
+	if (strchr(address, '/') != nullptr) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(address) >= sizeof(addr.sun_path)) {
+			fprintf(stderr, "metrics socket path too long: %s\n", address);
+			return false;
+		}
+		strcpy(addr.sun_path, address);
+
+		// only a socket nothing answers on is replaced, it's left over from a
+		// daemon that died. anything else at the path is someone's file
+		struct stat st;
+		if (lstat(address, &st) == 0) {
+			if (!S_ISSOCK(st.st_mode)) {
+				fprintf(stderr, "cannot listen on %s: it exists and isn't a socket\n", address);
+				return false;
+			}
+
+			int existing = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			bool live = existing >= 0 && connect(existing, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+			if (existing >= 0)
+				close(existing);
+
+			if (live) {
+				fprintf(stderr, "something is already listening on %s\n", address);
+				return false;
+			}
+
+			unlink(address);
+		}
+
+		m_iListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (m_iListenFd < 0 || bind(m_iListenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+			fprintf(stderr, "cannot listen on %s: %s\n", address, strerror(errno));
+			Stop();
+			return false;
+		}
+
+		m_UnixPath = address;
+	} else {
+		// only the local machine can scrape unless a host is given explicitly
+		std::string host = "127.0.0.1";
+		const char *port = address;
+		const char *colon = strrchr(address, ':');
+		if (colon != nullptr) {
+			host.assign(address, colon - address);
+			port = colon + 1;
+		}
+
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons((uint16_t)atoi(port));
+		if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+			fprintf(stderr, "bad metrics address: %s\n", address);
+			return false;
+		}
+
+		int one = 1;
+		m_iListenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (m_iListenFd >= 0)
+			setsockopt(m_iListenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		if (m_iListenFd < 0 || bind(m_iListenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+			fprintf(stderr, "cannot listen on %s: %s\n", address, strerror(errno));
+			Stop();
+			return false;
+		}
+	}
+
+	if (listen(m_iListenFd, 16) != 0) {
+		Stop();
+		return false;
+	}
+
+	m_Thread = std::thread(&MetricsServer::Run, this);
+	return true;
+}
+
+void MetricsServer::Stop()
+{
+	if (m_iListenFd < 0)
+		return;
+
+	// wakes the accept in Run up so the thread can be joined
+	shutdown(m_iListenFd, SHUT_RDWR);
+	if (m_Thread.joinable())
+		m_Thread.join();
+
+	close(m_iListenFd);
+	m_iListenFd = -1;
+
+	if (!m_UnixPath.empty())
+		unlink(m_UnixPath.c_str());
+}
+
+void MetricsServer::Run()
+{
+	for (;;) {
+		int fd = accept4(m_iListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return;
+		}
+
+		// a scraper that never finishes its request mustn't stall the others
+		struct timeval timeout = { 1, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		std::string request;
+		char buffer[1024];
+		while (request.find("\r\n\r\n") == std::string::npos && request.find("\n\n") == std::string::npos && request.size() < 8192) {
+			ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+			if (n <= 0)
+				break;
+			request.append(buffer, n);
+		}
+
+		std::string body = m_Render();
+		std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+			std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+
+		send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+		close(fd);
+	}
+}
+
+#endif
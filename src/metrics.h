@@ -0,0 +1,52 @@
+#ifndef GLUAC_METRICS_H
+#define GLUAC_METRICS_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+#define METRICS_BUCKETS 14
+
+// latency histogram in seconds, rendered in the prometheus text format
+class Histogram
+{
+public:
+	Histogram();
+
+	void Observe(double seconds);
+	void Write(std::string &out, const char *name, const char *labels) const;
+
+private:
+	std::atomic<unsigned long long> m_Buckets[METRICS_BUCKETS];
+	std::atomic<unsigned long long> m_iCount;
+	std::atomic<unsigned long long> m_iSumMicros;
+};
+
+// appends "# TYPE" lines, only the first sample of a family should pass help
+void metrics_header(std::string &out, const char *name, const char *type, const char *help);
+void metrics_sample(std::string &out, const char *name, const char *labels, double value);
+
+// serves whatever render returns to every http request on address, which is
+// either a unix socket path, a port on localhost or host:port
+class MetricsServer
+{
+public:
+	typedef std::function<std::string()> Renderer;
+
+	MetricsServer() : m_iListenFd(-1) {}
+	~MetricsServer() { Stop(); }
+
+	bool Start(const char *address, Renderer render);
+	void Stop();
+
+private:
+	void Run();
+
+	int m_iListenFd;
+	std::string m_UnixPath;
+	Renderer m_Render;
+	std::thread m_Thread;
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "order.h"
+#include "compiler.h"
+#include "gluac_bundle.h"
+#include "lexer.h"
+
+#include <string.h>
+
+#include <unordered_map>
+
+static bool token_is(const LuaToken &token, int type, const char *text)
+{
+	return token.type == type && token.len == strlen(text) && memcmp(token.text, text, token.len) == 0;
+}
+
+std::vector<std::string> lua_includes(const char *src, size_t len)
+{
+	std::vector<std::string> paths;
+	LuaLexer lexer(src, len);
+	LuaToken previous = { TOKEN_EOF, "", 0, 0, 0 };
+	LuaToken token;
+
+	while (lexer.Next(token)) {
+		// x.include and x:include are someone else's function
+		bool call = (token_is(token, TOKEN_NAME, "include") || token_is(token, TOKEN_NAME, "AddCSLuaFile")) &&
+			!token_is(previous, TOKEN_SYMBOL, ".") && !token_is(previous, TOKEN_SYMBOL, ":");
+		previous = token;
+
+		if (!call || !lexer.Next(token))
+			continue;
+
+		// include "x.lua" or include("x.lua"), anything more is worked out at runtime
+		bool paren = token_is(token, TOKEN_SYMBOL, "(");
+		LuaToken arg = token;
+		if (paren && !lexer.Next(arg))
+			break;
+
+		previous = arg;
+
+		std::string path;
+		if (!lua_string_value(arg, path))
+			continue;
+
+		if (paren) {
+			if (!lexer.Next(token))
+				break;
+
+			previous = token;
+			if (!token_is(token, TOKEN_SYMBOL, ")"))
+				continue;
+		}
+
+		path.resize(gluac_bundle_normalize(&path[0]));
+		if (!path.empty())
+			paths.push_back(path);
+	}
+
+	return paths;
+}
+
+bool read_load_trace(const char *path, std::vector<std::string> &trace)
+{
+	std::string data;
+	if (!read_file(path, data))
+		return false;
+
+	size_t start = 0;
+	while (start < data.size()) {
+		size_t end = data.find('\n', start);
+		if (end == std::string::npos)
+			end = data.size();
+
+		std::string line = data.substr(start, end - start);
+		start = end + 1;
+
+		while (!line.empty() && (line[line.size() - 1] == '\r' || line[line.size() - 1] == ' ' || line[line.size() - 1] == '\t'))
+			line.resize(line.size() - 1);
+
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		line.resize(gluac_bundle_normalize(&line[0]));
+		trace.push_back(line);
+	}
+
+	return true;
+}
+
+// a path as the game names it (lua/x.lua, addons/y/lua/x.lua) or as it
+// was included (x.lua) to the file in the bundle it means. leading
+// directories are dropped until something matches, each tried as it is and
+// under lua/, since bundles are built from both addon roots and lua folders
+static bool find_name(const std::unordered_map<std::string, size_t> &index, const std::string &path, size_t &found)
+{
+	size_t start = 0;
+	while (start < path.size()) {
+		std::string suffix = path.substr(start);
+
+		std::unordered_map<std::string, size_t>::const_iterator it = index.find(suffix);
+		if (it == index.end())
+			it = index.find("lua/" + suffix);
+
+		if (it != index.end()) {
+			found = it->second;
+			return true;
+		}
+
+		start = path.find('/', start);
+		if (start == std::string::npos)
+			break;
+		start++;
+	}
+
+	return false;
+}
+
+std::vector<size_t> load_order(const std::vector<std::string> &names, const std::vector<std::vector<std::string> > &includes, const std::vector<std::string> &trace)
+{
+	std::unordered_map<std::string, size_t> index;
+	for (size_t i = 0; i < names.size(); i++)
+		index[names[i]] = i;
+
+	// include looks next to the file doing the including first, then from the lua folder
+	std::vector<std::vector<size_t> > edges(names.size());
+	std::vector<bool> included(names.size(), false);
+
+	for (size_t i = 0; i < names.size() && i < includes.size(); i++) {
+		size_t slash = names[i].rfind('/');
+		std::string dir = slash == std::string::npos ? "" : names[i].substr(0, slash + 1);
+
+		for (size_t j = 0; j < includes[i].size(); j++) {
+			size_t target;
+			std::unordered_map<std::string, size_t>::const_iterator it = index.find(dir + includes[i][j]);
+
+			if (it != index.end())
+				target = it->second;
+			else if (!find_name(index, includes[i][j], target))
+				continue;
+
+			if (target != i) {
+				edges[i].push_back(target);
+				included[target] = true;
+			}
+		}
+	}
+
+	std::vector<size_t> order;
+	std::vector<bool> placed(names.size(), false);
+	order.reserve(names.size());
+
+	for (size_t i = 0; i < trace.size(); i++) {
+		size_t found;
+		if (find_name(index, trace[i], found) && !placed[found]) {
+			placed[found] = true;
+			order.push_back(found);
+		}
+	}
+
+	// a file runs before the files it includes, and those in the order it
+	// includes them. files in an include cycle are reached from the second pass
+	std::vector<size_t> stack;
+	for (int pass = 0; pass < 2; pass++) {
+		for (size_t root = 0; root < names.size(); root++) {
+			if (placed[root] || (pass == 0 && included[root]))
+				continue;
+
+			stack.push_back(root);
+			while (!stack.empty()) {
+				size_t i = stack.back();
+				stack.pop_back();
+
+				if (!placed[i]) {
+					placed[i] = true;
+					order.push_back(i);
+				}
+
+				for (size_t j = edges[i].size(); j-- > 0;) {
+					if (!placed[edges[i][j]])
+						stack.push_back(edges[i][j]);
+				}
+			}
+		}
+	}
+
+	return order;
+}
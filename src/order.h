@@ -0,0 +1,24 @@
+#ifndef GLUAC_ORDER_H
+#define GLUAC_ORDER_H
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+// the literal paths a lua source passes to include or AddCSLuaFile, in the
+// order the calls appear. calls with a computed path are skipped
+std::vector<std::string> lua_includes(const char *src, size_t len);
+
+// reads a load order trace: one path per line, as the server loaded them.
+// blank lines and lines starting with # are ignored
+bool read_load_trace(const char *path, std::vector<std::string> &trace);
+
+// the order to lay out files named names (normalized paths) so the ones loaded
+// together sit together, as indexes into names. files in the trace come first
+// in the order it lists them, the rest follow a walk of the include graph
+// from every file nothing includes, taken in the order given.
+// includes[i] are the lua_includes of names[i]
+std::vector<size_t> load_order(const std::vector<std::string> &names, const std::vector<std::vector<std::string> > &includes, const std::vector<std::string> &trace);
+
+#endif
@@ -0,0 +1,424 @@
+#include "script.h"
+#include "compiler.h"
+#include "hash.h"
+#include "lexer.h"
+#include "walk.h"
+#include "workpool.h"
+
+#include <stdio.h>
+
+#include <memory>
+
+// gluac.compile{ path = "lua/x.lua", source = "...", chunkname = "@lua/x.lua", output = "out/x.lua", strip = true, parseonly = false }
+//   compiles path, or source when it's given. returns the bytecode, or true when it was written to
+//   output, or nil and the error
+// gluac.compile_many{ { path = ... }, { path = ... }, strip = true }
+//   compiles every entry in parallel, fields on the outer table are defaults for the entries. returns
+//   a table of results in the same order and a table of errors by index, or nil if there were none
+// gluac.walk(root, { include = { "*.lua" }, exclude = { ".git" } })
+//   lists files and directories under root the way -r does, returns both as tables of relative paths
+// gluac.hash(data), gluac.hashfile(path)
+//   xxHash64 as 16 hex digits
+// gluac.tokenhash(source, strip)
+//   hash of the source's tokens, which only changes when the bytecode might
+// gluac.write(path, data)
+//   writes data atomically, creating any missing directories
+// gluac.workers
+//   size of the compile pool
+
+// lua errors longjmp past c++ destructors, so nothing here raises one once
+// it's holding anything that needs destroying, failures are returned
+// instead. argument checks come first, and tables are only read with
+// lua_rawget so an __index metamethod can't raise partway through. that
+// leaves running out of memory, which leaks what it skips, but then the
+// script is failing anyway
+
+typedef struct {
+	std::string path;
+	std::string source;
+	std::string chunkname;
+	std::string output;
+	bool hassource;
+	bool strip;
+	bool parseonly;
+
+	bool ok;
+	std::string result;		// bytecode, or the error when not ok
+} ScriptCompile;
+
+static BatchOptions g_ScriptOptions;
+static WorkPool *g_pScriptPool = nullptr;
+
+static WorkPool *script_pool()
+{
+	if (g_pScriptPool != nullptr)
+		return g_pScriptPool;
+
+	size_t workers = g_ScriptOptions.workers ? g_ScriptOptions.workers : std::thread::hardware_concurrency();
+	WorkPool *pool = new WorkPool(workers, workers * 4, 0, g_ScriptOptions.limits);
+	if (!pool->Start()) {
+		delete pool;
+		return nullptr;
+	}
+
+	g_pScriptPool = pool;
+	return pool;
+}
+
+// pushes t[name] for the table at the absolute index, without metamethods
+static void raw_field(lua_State *L, int index, const char *name)
+{
+	lua_pushstring(L, name);
+	lua_rawget(L, index);
+}
+
+static bool field_string(lua_State *L, int index, const char *name, std::string &out)
+{
+	raw_field(L, index, name);
+
+	size_t len;
+	const char *str = lua_type(L, -1) == LUA_TSTRING ? lua_tolstring(L, -1, &len) : nullptr;
+	if (str != nullptr)
+		out.assign(str, len);
+
+	lua_pop(L, 1);
+	return str != nullptr;
+}
+
+static bool field_bool(lua_State *L, int index, const char *name, bool def)
+{
+	raw_field(L, index, name);
+	bool value = lua_isnil(L, -1) ? def : lua_toboolean(L, -1) != 0;
+	lua_pop(L, 1);
+	return value;
+}
+
+static void read_compile(lua_State *L, int index, const ScriptCompile &defaults, ScriptCompile &job)
+{
+	job.strip = field_bool(L, index, "strip", defaults.strip);
+	job.parseonly = field_bool(L, index, "parseonly", defaults.parseonly);
+	job.hassource = field_string(L, index, "source", job.source);
+	field_string(L, index, "path", job.path);
+	field_string(L, index, "output", job.output);
+
+	if (!field_string(L, index, "chunkname", job.chunkname))
+		job.chunkname = job.path.empty() ? "=(source)" : "@" + job.path;
+
+	job.ok = false;
+}
+
+// runs on a worker
+static void run_compile(lua_State *L, ScriptCompile &job)
+{
+	if (!job.hassource) {
+		if (job.path.empty()) {
+			job.result = "needs a path or a source";
+			return;
+		}
+
+		if (!read_file(job.path.c_str(), job.source)) {
+			job.result = "cannot open " + job.path;
+			return;
+		}
+	}
+
+	std::string bytecode;
+	CompileJob compile_job = { nullptr, job.source.data(), job.source.size(), job.chunkname.c_str(), job.strip, job.parseonly, write_dump_string, &bytecode };
+
+	std::string().swap(job.source);
+
+	if (!compile(L, &compile_job, job.result))
+		return;
+
+	if (!job.output.empty() && !job.parseonly) {
+		if (!(make_parent_dirs(job.output.c_str()) && write_file_atomic(job.output.c_str(), bytecode.data(), bytecode.size()))) {
+			job.result = "cannot write " + job.output;
+			return;
+		}
+
+		bytecode.clear();
+	}
+
+	job.result.swap(bytecode);
+	job.ok = true;
+}
+
+static void push_result(lua_State *L, const ScriptCompile &job)
+{
+	if (!job.ok)
+		lua_pushboolean(L, 0);
+	else if (!job.output.empty() || job.parseonly)
+		lua_pushboolean(L, 1);
+	else
+		lua_pushlstring(L, job.result.data(), job.result.size());
+}
+
+static ScriptCompile script_defaults()
+{
+	ScriptCompile defaults;
+	defaults.strip = g_ScriptOptions.strip;
+	defaults.parseonly = g_ScriptOptions.parseonly;
+	return defaults;
+}
+
+static int script_compile(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	WorkPool *pool = script_pool();
+	if (pool == nullptr) {
+		lua_pushnil(L);
+		lua_pushstring(L, "cannot start the compile pool");
+		return 2;
+	}
+
+	std::shared_ptr<ScriptCompile> job(new ScriptCompile());
+	read_compile(L, 1, script_defaults(), *job);
+
+	pool->Push([job](lua_State *WL) { run_compile(WL, *job); });
+	pool->Wait();
+
+	if (!job->ok) {
+		lua_pushnil(L);
+		lua_pushlstring(L, job->result.data(), job->result.size());
+		return 2;
+	}
+
+	push_result(L, *job);
+	return 1;
+}
+
+static int script_compile_many(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	WorkPool *pool = script_pool();
+	if (pool == nullptr) {
+		lua_pushnil(L);
+		lua_pushstring(L, "cannot start the compile pool");
+		return 2;
+	}
+
+	ScriptCompile defaults = script_defaults();
+	defaults.strip = field_bool(L, 1, "strip", defaults.strip);
+	defaults.parseonly = field_bool(L, 1, "parseonly", defaults.parseonly);
+
+	size_t count = lua_objlen(L, 1);
+	std::vector<ScriptCompile> jobs(count);
+
+	for (size_t i = 0; i < count; i++) {
+		lua_rawgeti(L, 1, (int)i + 1);
+		if (lua_istable(L, -1)) {
+			read_compile(L, lua_gettop(L), defaults, jobs[i]);
+		} else {
+			// a bare string is a path
+			size_t len;
+			const char *path = lua_type(L, -1) == LUA_TSTRING ? lua_tolstring(L, -1, &len) : nullptr;
+			jobs[i].path.assign(path != nullptr ? path : "", path != nullptr ? len : 0);
+			jobs[i].chunkname = "@" + jobs[i].path;
+			jobs[i].hassource = false;
+			jobs[i].strip = defaults.strip;
+			jobs[i].parseonly = defaults.parseonly;
+			jobs[i].ok = false;
+		}
+		lua_pop(L, 1);
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		ScriptCompile *job = &jobs[i];
+		pool->Push([job](lua_State *WL) { run_compile(WL, *job); });
+	}
+
+	pool->Wait();
+
+	lua_createtable(L, (int)count, 0);
+	for (size_t i = 0; i < count; i++) {
+		push_result(L, jobs[i]);
+		lua_rawseti(L, -2, (int)i + 1);
+	}
+
+	bool failed = false;
+	for (size_t i = 0; i < count && !failed; i++)
+		failed = !jobs[i].ok;
+
+	if (!failed) {
+		lua_pushnil(L);
+		return 2;
+	}
+
+	lua_newtable(L);
+	for (size_t i = 0; i < count; i++) {
+		if (jobs[i].ok)
+			continue;
+
+		lua_pushlstring(L, jobs[i].result.data(), jobs[i].result.size());
+		lua_rawseti(L, -2, (int)i + 1);
+	}
+
+	return 2;
+}
+
+static void read_globs(lua_State *L, int index, const char *name, std::vector<std::string> &globs)
+{
+	raw_field(L, index, name);
+
+	if (lua_type(L, -1) == LUA_TSTRING) {
+		globs.push_back(lua_tostring(L, -1));
+	} else if (lua_istable(L, -1)) {
+		size_t count = lua_objlen(L, -1);
+		for (size_t i = 1; i <= count; i++) {
+			lua_rawgeti(L, -1, (int)i);
+			if (lua_type(L, -1) == LUA_TSTRING)
+				globs.push_back(lua_tostring(L, -1));
+			lua_pop(L, 1);
+		}
+	}
+
+	lua_pop(L, 1);
+}
+
+static void push_strings(lua_State *L, const std::vector<std::string> &strings)
+{
+	lua_createtable(L, (int)strings.size(), 0);
+	for (size_t i = 0; i < strings.size(); i++) {
+		lua_pushlstring(L, strings[i].data(), strings[i].size());
+		lua_rawseti(L, -2, (int)i + 1);
+	}
+}
+
+static int script_walk(lua_State *L)
+{
+	const char *root = luaL_checkstring(L, 1);
+
+	WalkOptions options;
+	options.threads = g_ScriptOptions.workers;
+	if (lua_istable(L, 2)) {
+		read_globs(L, 2, "include", options.include);
+		read_globs(L, 2, "exclude", options.exclude);
+	}
+
+	std::vector<std::string> files;
+	std::vector<std::string> dirs;
+	if (!walk_tree(root, options, files, &dirs)) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "cannot read %s", root);
+		return 2;
+	}
+
+	push_strings(L, files);
+	push_strings(L, dirs);
+	return 2;
+}
+
+static void push_hash(lua_State *L, uint64_t hash)
+{
+	char hex[17];
+	snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+	lua_pushlstring(L, hex, 16);
+}
+
+static int script_hash(lua_State *L)
+{
+	size_t len;
+	const char *data = luaL_checklstring(L, 1, &len);
+	push_hash(L, hash64(data, len));
+	return 1;
+}
+
+static int script_tokenhash(lua_State *L)
+{
+	size_t len;
+	const char *source = luaL_checklstring(L, 1, &len);
+	push_hash(L, token_hash(source, len, lua_toboolean(L, 2) != 0));
+	return 1;
+}
+
+static int script_hashfile(lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+
+	std::string data;
+	if (!read_file(path, data)) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "cannot open %s", path);
+		return 2;
+	}
+
+	push_hash(L, hash64(data.data(), data.size()));
+	return 1;
+}
+
+static int script_write(lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+	size_t len;
+	const char *data = luaL_checklstring(L, 2, &len);
+
+	if (!(make_parent_dirs(path) && write_file_atomic(path, data, len))) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "cannot write %s", path);
+		return 2;
+	}
+
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+static const luaL_Reg script_functions[] = {
+	{ "compile", script_compile },
+	{ "compile_many", script_compile_many },
+	{ "walk", script_walk },
+	{ "hash", script_hash },
+	{ "hashfile", script_hashfile },
+	{ "tokenhash", script_tokenhash },
+	{ "write", script_write },
+	{ nullptr, nullptr }
+};
+
+int script_main(const char *path, int argc, char **argv, const BatchOptions &options)
+{
+	g_ScriptOptions = options;
+
+	// the script itself runs without the per-compile limits, those are for the pool
+	lua_State *L = compiler_newstate();
+	if (L == nullptr)
+		return 1;
+
+	luaL_register(L, "gluac", script_functions);
+	lua_pushinteger(L, (lua_Integer)(options.workers ? options.workers : std::thread::hardware_concurrency()));
+	lua_setfield(L, -2, "workers");
+	lua_pop(L, 1);
+
+	// the same arg table the standalone interpreter gives
+	lua_createtable(L, argc, 1);
+	lua_pushstring(L, path);
+	lua_rawseti(L, -2, 0);
+	for (int i = 0; i < argc; i++) {
+		lua_pushstring(L, argv[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_setglobal(L, "arg");
+
+	lua_getglobal(L, "debug");
+	lua_getfield(L, -1, "traceback");
+	lua_remove(L, -2);
+
+	int status = luaL_loadfile(L, path);
+	if (status == 0) {
+		for (int i = 0; i < argc; i++)
+			lua_pushstring(L, argv[i]);
+
+		status = lua_pcall(L, argc, 0, 1);
+	}
+
+	if (status != 0) {
+		const char *msg = lua_tostring(L, -1);
+		fprintf(stderr, "%s\n", msg != nullptr ? msg : "unknown error");
+	}
+
+	delete g_pScriptPool;
+	g_pScriptPool = nullptr;
+
+	compiler_close(L);
+	return status == 0 ? 0 : 1;
+}
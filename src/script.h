@@ -0,0 +1,13 @@
+#ifndef GLUAC_SCRIPT_H
+#define GLUAC_SCRIPT_H
+
+#include "batch.h"
+
+// runs a lua build script with a gluac table for compiling on the worker
+// pool, listing directories, hashing and writing files. args are passed to
+// the script as ... and in the arg table, options give the pool size, the
+// default strip and parse only flags and the limits for each compile.
+// returns an exit code
+int script_main(const char *path, int argc, char **argv, const BatchOptions &options);
+
+#endif
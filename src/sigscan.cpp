@@ -0,0 +1,323 @@
+#include "sigscan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <dlfcn.h>
+#include <link.h>
+#endif
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define SIGSCAN_TARGET_SSE2
+#define SIGSCAN_TARGET_AVX2
+#else
+#define SIGSCAN_TARGET_SSE2 __attribute__((target("sse2")))
+#define SIGSCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static inline unsigned int lowest_bit(unsigned int x)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, x);
+	return index;
+#else
+	return __builtin_ctz(x);
+#endif
+}
+
+// a signature with its wildcards resolved into a byte mask, padded to a
+// multiple of 16 so whole blocks can be compared at once
+typedef struct {
+	unsigned char *bytes;
+	unsigned char *mask;
+	size_t len;
+	size_t first;
+	size_t last;
+} PreparedSig;
+
+static bool prepare_sig(const Signature *sig, PreparedSig *out)
+{
+	size_t padded = (sig->len + 15) & ~(size_t)15;
+
+	out->bytes = (unsigned char *)calloc(padded * 2, 1);
+	if (out->bytes == nullptr)
+		return false;
+
+	out->mask = out->bytes + padded;
+	out->len = sig->len;
+	out->first = sig->len;
+	out->last = 0;
+
+	for (size_t i = 0; i < sig->len; i++) {
+		if (sig->mask != nullptr && sig->mask[i] == '?')
+			continue;
+
+		out->bytes[i] = (unsigned char)sig->pattern[i];
+		out->mask[i] = 0xFF;
+
+		if (out->first == sig->len)
+			out->first = i;
+		out->last = i;
+	}
+
+	// a pattern made only of wildcards would match anywhere
+	if (out->first == sig->len) {
+		free(out->bytes);
+		return false;
+	}
+
+	return true;
+}
+
+SIGSCAN_TARGET_SSE2
+static bool match_at(const unsigned char *p, const PreparedSig *sig)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= sig->len; i += 16) {
+		__m128i data = _mm_loadu_si128((const __m128i *)(p + i));
+		__m128i bytes = _mm_loadu_si128((const __m128i *)(sig->bytes + i));
+		__m128i mask = _mm_loadu_si128((const __m128i *)(sig->mask + i));
+		__m128i diff = _mm_and_si128(_mm_xor_si128(data, bytes), mask);
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF)
+			return false;
+	}
+
+	for (; i < sig->len; i++) {
+		if ((p[i] ^ sig->bytes[i]) & sig->mask[i])
+			return false;
+	}
+
+	return true;
+}
+
+static const unsigned char *scan_scalar(const unsigned char *data, size_t size, size_t i, const PreparedSig *sig)
+{
+	unsigned char first = sig->bytes[sig->first];
+	unsigned char last = sig->bytes[sig->last];
+
+	for (; i + sig->len <= size; i++) {
+		if (data[i + sig->first] == first && data[i + sig->last] == last && match_at(data + i, sig))
+			return data + i;
+	}
+
+	return nullptr;
+}
+
+// checks 16 candidate positions at a time by comparing the first and last
+// fixed bytes of the signature, only running the full compare on hits
+SIGSCAN_TARGET_SSE2
+static const unsigned char *scan_sse2(const unsigned char *data, size_t size, const PreparedSig *sig)
+{
+	__m128i first = _mm_set1_epi8((char)sig->bytes[sig->first]);
+	__m128i last = _mm_set1_epi8((char)sig->bytes[sig->last]);
+	size_t i = 0;
+
+	for (; i + 15 + sig->len <= size; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(data + i + sig->first));
+		__m128i b = _mm_loadu_si128((const __m128i *)(data + i + sig->last));
+		unsigned int hits = (unsigned int)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+		while (hits) {
+			size_t offset = i + lowest_bit(hits);
+			if (match_at(data + offset, sig))
+				return data + offset;
+			hits &= hits - 1;
+		}
+	}
+
+	return scan_scalar(data, size, i, sig);
+}
+
+SIGSCAN_TARGET_AVX2
+static const unsigned char *scan_avx2(const unsigned char *data, size_t size, const PreparedSig *sig)
+{
+	__m256i first = _mm256_set1_epi8((char)sig->bytes[sig->first]);
+	__m256i last = _mm256_set1_epi8((char)sig->bytes[sig->last]);
+	size_t i = 0;
+
+	for (; i + 31 + sig->len <= size; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(data + i + sig->first));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(data + i + sig->last));
+		unsigned int hits = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+
+		while (hits) {
+			size_t offset = i + lowest_bit(hits);
+			if (match_at(data + offset, sig))
+				return data + offset;
+			hits &= hits - 1;
+		}
+	}
+
+	return scan_scalar(data, size, i, sig);
+}
+
+static bool cpu_has_avx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// the OS must also be saving the ymm registers on context switches
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+static const unsigned char *scan_region(const unsigned char *data, size_t size, const PreparedSig *sig)
+{
+	static const bool avx2 = cpu_has_avx2();
+
+	if (size < sig->len)
+		return nullptr;
+
+	return avx2 ? scan_avx2(data, size, sig) : scan_sse2(data, size, sig);
+}
+
+const void *sigscan_find(const void *start, size_t size, const Signature *sigs, size_t numsigs)
+{
+	for (size_t i = 0; i < numsigs; i++) {
+		PreparedSig sig;
+		if (!prepare_sig(&sigs[i], &sig))
+			continue;
+
+		const unsigned char *match = scan_region((const unsigned char *)start, size, &sig);
+		free(sig.bytes);
+
+		if (match != nullptr)
+			return match;
+	}
+
+	return nullptr;
+}
+
+typedef struct {
+	const unsigned char *start;
+	size_t size;
+} Region;
+
+#define SIGSCAN_MAX_REGIONS 32
+
+#ifdef _WIN32
+static size_t module_regions(void *module, Region *regions)
+{
+	unsigned char *base = (unsigned char *)module;
+	IMAGE_DOS_HEADER *dos = (IMAGE_DOS_HEADER *)base;
+	IMAGE_NT_HEADERS *nt = (IMAGE_NT_HEADERS *)(base + dos->e_lfanew);
+	IMAGE_SECTION_HEADER *section = IMAGE_FIRST_SECTION(nt);
+	size_t count = 0;
+
+	for (WORD i = 0; i < nt->FileHeader.NumberOfSections && count < SIGSCAN_MAX_REGIONS; i++, section++) {
+		if ((section->Characteristics & IMAGE_SCN_MEM_EXECUTE) == 0)
+			continue;
+
+		regions[count].start = base + section->VirtualAddress;
+		regions[count].size = section->Misc.VirtualSize;
+		count++;
+	}
+
+	return count;
+}
+#else
+typedef struct {
+	struct link_map *map;
+	Region *regions;
+	size_t count;
+} PhdrSearch;
+
+static int module_phdr_callback(struct dl_phdr_info *info, size_t, void *data)
+{
+	PhdrSearch *search = (PhdrSearch *)data;
+
+	if (info->dlpi_addr != search->map->l_addr || strcmp(info->dlpi_name, search->map->l_name) != 0)
+		return 0;
+
+	for (size_t i = 0; i < info->dlpi_phnum && search->count < SIGSCAN_MAX_REGIONS; i++) {
+		const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+		if (phdr->p_type != PT_LOAD || (phdr->p_flags & PF_X) == 0)
+			continue;
+
+		search->regions[search->count].start = (const unsigned char *)(info->dlpi_addr + phdr->p_vaddr);
+		search->regions[search->count].size = phdr->p_memsz;
+		search->count++;
+	}
+
+	return 1;
+}
+
+static size_t module_regions(void *module, Region *regions)
+{
+	PhdrSearch search = { nullptr, regions, 0 };
+
+	if (dlinfo(module, RTLD_DI_LINKMAP, &search.map) != 0)
+		return 0;
+
+	dl_iterate_phdr(module_phdr_callback, &search);
+	return search.count;
+}
+#endif
+
+void *sigscan_module(void *module, const Signature *sigs, size_t numsigs, bool *ambiguous)
+{
+	Region regions[SIGSCAN_MAX_REGIONS];
+	size_t count = module_regions(module, regions);
+
+	if (ambiguous != nullptr)
+		*ambiguous = false;
+
+	// signatures are tried in order so an exact pattern can be preferred
+	// over a looser fallback that might appear earlier in the image. the
+	// first one that matches has to match exactly once, calling whichever
+	// of several lookalike functions came first would be a guess
+	for (size_t i = 0; i < numsigs; i++) {
+		PreparedSig sig;
+		if (!prepare_sig(&sigs[i], &sig))
+			continue;
+
+		const unsigned char *found = nullptr;
+		size_t matches = 0;
+
+		for (size_t r = 0; r < count && matches < 2; r++) {
+			const unsigned char *end = regions[r].start + regions[r].size;
+			const unsigned char *match = scan_region(regions[r].start, regions[r].size, &sig);
+
+			while (match != nullptr && matches < 2) {
+				found = match;
+				matches++;
+				match = scan_region(match + 1, (size_t)(end - match - 1), &sig);
+			}
+		}
+
+		free(sig.bytes);
+
+		// a looser signature later on would match everything this one did
+		if (matches > 1) {
+			if (ambiguous != nullptr)
+				*ambiguous = true;
+			return nullptr;
+		}
+
+		if (matches == 1)
+			return (void *)found;
+	}
+
+	return nullptr;
+}
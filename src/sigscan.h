@@ -0,0 +1,23 @@
+#ifndef GLUAC_SIGSCAN_H
+#define GLUAC_SIGSCAN_H
+
+#include <stddef.h>
+
+// a byte pattern to search for, mask is a string of the same length where
+// 'x' means the byte must match and '?' means any byte is accepted
+typedef struct {
+	const char *pattern;
+	const char *mask;
+	size_t len;
+} Signature;
+
+// searches [start, start + size) for the first signature that matches, trying
+// each signature in the order given. returns the address of the match or null
+const void *sigscan_find(const void *start, size_t size, const Signature *sigs, size_t numsigs);
+
+// same as sigscan_find but only searches the executable sections of a loaded
+// module, and the first signature that matches must match exactly once. when
+// it matches more than that, null is returned and ambiguous (if given) set
+void *sigscan_module(void *module, const Signature *sigs, size_t numsigs, bool *ambiguous = nullptr);
+
+#endif
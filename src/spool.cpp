@@ -0,0 +1,519 @@
+#include "spool.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+
+int spool_submit(const char *spooldir, const std::vector<BatchItem> &items, const SpoolOptions &options)
+{
+	fprintf(stderr, "spool mode is not supported on this platform\n");
+	return 1;
+}
+
+int spool_work(const char *spooldir, const SpoolOptions &options)
+{
+	fprintf(stderr, "spool mode is not supported on this platform\n");
+	return 1;
+}
+
+#else
+
+#include "compiler.h"
+#include "workpool.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#define SPOOL_MAGIC "gluac spool 1"
+
+// a line of a job file
+typedef struct {
+	std::string input;
+	std::string output;
+	std::string chunkname;
+} SpoolItem;
+
+// names of the job files in a spool directory, leaving out temporaries
+static void list_jobs(const std::string &dir, std::vector<std::string> &names)
+{
+	names.clear();
+
+	DIR *d = opendir(dir.c_str());
+	if (d == nullptr)
+		return;
+
+	struct dirent *entry;
+	while ((entry = readdir(d)) != nullptr) {
+		size_t len = strlen(entry->d_name);
+		if (entry->d_name[0] != '.' && len > 4 && strcmp(entry->d_name + len - 4, ".job") == 0)
+			names.push_back(entry->d_name);
+	}
+
+	closedir(d);
+}
+
+static bool write_small_file(const std::string &path, const std::string &data)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return false;
+
+	bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size();
+	return close(fd) == 0 && ok;
+}
+
+class Spool
+{
+public:
+	Spool(const std::string &dir, const SpoolOptions &options) :
+		m_sDir(dir),
+		m_Options(options),
+		m_pPool(nullptr),
+		m_bStopping(false)
+	{
+		if (!m_sDir.empty() && m_sDir[m_sDir.size() - 1] != '/')
+			m_sDir += '/';
+
+		char host[256] = "localhost";
+		gethostname(host, sizeof(host) - 1);
+		host[sizeof(host) - 1] = '\0';
+
+		m_sOwner = std::string(host) + "." + std::to_string(getpid());
+		m_sClock = m_sDir + "leases/.clock." + m_sOwner;
+	}
+
+	~Spool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_bStopping = true;
+		}
+		m_Wake.notify_all();
+
+		if (m_Heartbeat.joinable())
+			m_Heartbeat.join();
+
+		delete m_pPool;
+		unlink(m_sClock.c_str());
+	}
+
+	bool Open()
+	{
+		static const char *dirs[] = { "", "jobs", "leases", "done", "failed" };
+
+		for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+			std::string path = m_sDir + dirs[i];
+			if (mkdir(path.c_str(), 0777) != 0 && errno != EEXIST) {
+				fprintf(stderr, "cannot create %s: %s\n", path.c_str(), strerror(errno));
+				return false;
+			}
+		}
+
+		if (!write_small_file(m_sClock, m_sOwner)) {
+			fprintf(stderr, "cannot write to %sleases: %s\n", m_sDir.c_str(), strerror(errno));
+			return false;
+		}
+
+		size_t workers = m_Options.batch.workers ? m_Options.batch.workers : std::thread::hardware_concurrency();
+		m_pPool = new WorkPool(workers, workers * 4, 0, m_Options.batch.limits);
+		if (!m_pPool->Start())
+			return false;
+
+		m_Heartbeat = std::thread(&Spool::Heartbeat, this);
+		return true;
+	}
+
+	// writes items out as jobs of options.chunk inputs, returning their names
+	bool Submit(const std::vector<BatchItem> &items, std::vector<std::string> &names)
+	{
+		char cwd[4096];
+		if (getcwd(cwd, sizeof(cwd)) == nullptr)
+			return false;
+
+		// unique enough between submitters sharing a spool
+		char prefix[64];
+		snprintf(prefix, sizeof(prefix), "%08lx-%08x", (unsigned long)time(nullptr), (unsigned int)std::hash<std::string>()(m_sOwner));
+
+		size_t chunk = m_Options.chunk ? m_Options.chunk : 64;
+		for (size_t first = 0; first < items.size(); first += chunk) {
+			std::string job = SPOOL_MAGIC "\n";
+			job += "flags " + std::to_string(m_Options.batch.strip ? 1 : 0) + " " + std::to_string(m_Options.batch.parseonly ? 1 : 0) + "\n";
+
+			for (size_t i = first; i < items.size() && i < first + chunk; i++) {
+				const BatchItem &item = items[i];
+				if ((item.input + item.output + item.chunkname).find_first_of("\t\n") != std::string::npos) {
+					fprintf(stderr, "%s: paths with tabs or newlines can't be spooled\n", item.input.c_str());
+					return false;
+				}
+
+				// other machines won't share our working directory
+				job += item.input[0] == '/' ? item.input : std::string(cwd) + "/" + item.input;
+				job += '\t';
+				job += item.output[0] == '/' ? item.output : std::string(cwd) + "/" + item.output;
+				// named here, so the bytecode is the same whoever compiles it
+				job += "\t" + item.chunkname + "\n";
+			}
+
+			char name[96];
+			snprintf(name, sizeof(name), "%s-%06u.job", prefix, (unsigned int)(first / chunk));
+
+			std::string path = m_sDir + "jobs/" + name;
+			if (!write_file_atomic(path.c_str(), job.data(), job.size(), m_sOwner.c_str())) {
+				fprintf(stderr, "cannot write %s: %s\n", path.c_str(), strerror(errno));
+				return false;
+			}
+
+			names.push_back(name);
+		}
+
+		return true;
+	}
+
+	// claims and compiles the first free job, false if every job is taken
+	bool WorkOne()
+	{
+		std::vector<std::string> names;
+		list_jobs(m_sDir + "jobs", names);
+		if (names.empty())
+			return false;
+
+		// start somewhere different from the other workers so they don't all fight over the first job
+		size_t start = std::hash<std::string>()(m_sOwner) % names.size();
+
+		for (size_t i = 0; i < names.size(); i++) {
+			const std::string &name = names[(start + i) % names.size()];
+			if (Claim(name)) {
+				Run(name);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// breaks leases whose holders have stopped renewing them
+	void BreakStale()
+	{
+		time_t now;
+		if (!FilesystemTime(now))
+			return;
+
+		std::vector<std::string> names;
+		list_jobs(m_sDir + "leases", names);
+
+		for (size_t i = 0; i < names.size(); i++) {
+			std::string lease = m_sDir + "leases/" + names[i];
+
+			struct stat st;
+			if (stat(lease.c_str(), &st) != 0 || now - st.st_mtime <= (time_t)m_Options.lease)
+				continue;
+
+			// only one of the workers that noticed gets to rename it away
+			std::string broken = m_sDir + "leases/.broken." + m_sOwner;
+			if (rename(lease.c_str(), broken.c_str()) == 0) {
+				fprintf(stderr, "spool: broke the lease on %s, its holder stopped renewing it\n", names[i].c_str());
+				unlink(broken.c_str());
+			}
+		}
+	}
+
+	bool Empty()
+	{
+		std::vector<std::string> names;
+		list_jobs(m_sDir + "jobs", names);
+		return names.empty();
+	}
+
+	bool IsDone(const std::string &name)
+	{
+		struct stat st;
+		return stat((m_sDir + "done/" + name).c_str(), &st) == 0;
+	}
+
+	// prints the errors a finished job recorded, returning how many of its inputs failed
+	size_t Collect(const std::string &name)
+	{
+		std::string failed = m_sDir + "failed/" + name;
+		std::string errors;
+		size_t count = 0;
+
+		if (read_file(failed.c_str(), errors)) {
+			for (size_t i = 0; i < errors.size(); i++) {
+				if (errors[i] == '\0') {
+					errors[i] = '\n';
+					count++;
+				}
+			}
+
+			fwrite(errors.data(), 1, errors.size(), stderr);
+			unlink(failed.c_str());
+		}
+
+		unlink((m_sDir + "done/" + name).c_str());
+		return count;
+	}
+
+private:
+	bool Claim(const std::string &name)
+	{
+		std::string lease = m_sDir + "leases/" + name;
+		std::string tmp = m_sDir + "leases/." + name + "." + m_sOwner;
+
+		if (!write_small_file(tmp, m_sOwner))
+			return false;
+
+		// link fails if the lease already exists, which makes it the lock
+		bool claimed = link(tmp.c_str(), lease.c_str()) == 0;
+		if (!claimed && errno != EEXIST) {
+			// over nfs the link can succeed with its reply lost, the count says whether it did
+			struct stat st;
+			claimed = stat(tmp.c_str(), &st) == 0 && st.st_nlink == 2;
+		}
+
+		unlink(tmp.c_str());
+		return claimed;
+	}
+
+	void Run(const std::string &name)
+	{
+		std::string jobpath = m_sDir + "jobs/" + name;
+		std::string lease = m_sDir + "leases/" + name;
+
+		std::string job;
+		if (!read_file(jobpath.c_str(), job)) {
+			// finished by someone else since we listed it
+			unlink(lease.c_str());
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_sLease = lease;
+		}
+
+		std::vector<SpoolItem> items;
+		bool strip = false;
+		bool parseonly = false;
+		bool valid = ParseJob(job, items, strip, parseonly);
+
+		std::mutex errorlock;
+		std::string errors;
+
+		if (!valid)
+			errors = name + ": not a spool job\n";
+
+		for (size_t i = 0; i < items.size(); i++) {
+			const SpoolItem *item = &items[i];
+
+			m_pPool->Push([this, item, strip, parseonly, &errorlock, &errors](lua_State *L) {
+				std::string err;
+				if (!CompileItem(L, *item, strip, parseonly, err)) {
+					std::lock_guard<std::mutex> lock(errorlock);
+					errors += err;
+					errors += '\0';
+				}
+			});
+		}
+
+		m_pPool->Wait();
+
+		// errors are null separated, messages may have newlines of their own
+		std::string failed = m_sDir + "failed/" + name;
+		if (!errors.empty() && !write_file_atomic(failed.c_str(), errors.data(), errors.size(), m_sOwner.c_str()))
+			fprintf(stderr, "cannot write %s: %s\n", failed.c_str(), strerror(errno));
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_sLease.clear();
+		}
+
+		rename(jobpath.c_str(), (m_sDir + "done/" + name).c_str());
+		unlink(lease.c_str());
+	}
+
+	bool CompileItem(lua_State *L, const SpoolItem &item, bool strip, bool parseonly, std::string &err) const
+	{
+		std::string source;
+		if (!read_file(item.input.c_str(), source)) {
+			err = "cannot open " + item.input;
+			return false;
+		}
+
+		std::string bytecode;
+		CompileJob job = { item.input.c_str(), source.data(), source.size(), item.chunkname.c_str(), strip, parseonly, write_dump_string, &bytecode };
+
+		if (!compile(L, &job, err))
+			return false;
+
+		if (!parseonly && !(make_parent_dirs(item.output.c_str()) && write_file_atomic(item.output.c_str(), bytecode.data(), bytecode.size(), m_sOwner.c_str()))) {
+			err = "cannot write " + item.output;
+			return false;
+		}
+
+		return true;
+	}
+
+	static bool ParseJob(const std::string &job, std::vector<SpoolItem> &items, bool &strip, bool &parseonly)
+	{
+		size_t pos = 0;
+		size_t line = 0;
+
+		while (pos < job.size()) {
+			size_t end = job.find('\n', pos);
+			if (end == std::string::npos)
+				end = job.size();
+
+			std::string text = job.substr(pos, end - pos);
+			pos = end + 1;
+
+			if (line == 0) {
+				if (text != SPOOL_MAGIC)
+					return false;
+			} else if (line == 1) {
+				int s, p;
+				if (sscanf(text.c_str(), "flags %d %d", &s, &p) != 2)
+					return false;
+
+				strip = s != 0;
+				parseonly = p != 0;
+			} else {
+				size_t tab = text.find('\t');
+				size_t tab2 = tab != std::string::npos ? text.find('\t', tab + 1) : std::string::npos;
+				if (tab2 == std::string::npos)
+					return false;
+
+				SpoolItem item = { text.substr(0, tab), text.substr(tab + 1, tab2 - tab - 1), text.substr(tab2 + 1) };
+				items.push_back(item);
+			}
+
+			line++;
+		}
+
+		return line >= 2;
+	}
+
+	// machines sharing a spool needn't agree on the time, so leases are
+	// compared against a file this process has just touched instead
+	bool FilesystemTime(time_t &now)
+	{
+		struct stat st;
+		if (utimes(m_sClock.c_str(), nullptr) != 0 || stat(m_sClock.c_str(), &st) != 0)
+			return false;
+
+		now = st.st_mtime;
+		return true;
+	}
+
+	void Heartbeat()
+	{
+		std::chrono::milliseconds interval(m_Options.lease * 1000 / 4);
+		std::unique_lock<std::mutex> lock(m_Mutex);
+
+		while (!m_bStopping) {
+			m_Wake.wait_for(lock, interval);
+
+			if (!m_sLease.empty() && utimes(m_sLease.c_str(), nullptr) != 0 && errno == ENOENT) {
+				fprintf(stderr, "spool: lost the lease on %s, it may be compiled twice\n", m_sLease.c_str());
+				m_sLease.clear();
+			}
+		}
+	}
+
+	std::string m_sDir;
+	std::string m_sOwner;
+	std::string m_sClock;
+	std::string m_sLease;	// held by the job being compiled, renewed by the heartbeat
+	SpoolOptions m_Options;
+	WorkPool *m_pPool;
+
+	std::thread m_Heartbeat;
+	std::mutex m_Mutex;
+	std::condition_variable m_Wake;
+	bool m_bStopping;
+};
+
+// how long to sleep when every job is taken by someone else
+#define SPOOL_POLL_MS 100
+
+int spool_submit(const char *spooldir, const std::vector<BatchItem> &items, const SpoolOptions &options)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	Spool spool(spooldir, options);
+	if (!spool.Open())
+		return 1;
+
+	std::vector<std::string> names;
+	if (!spool.Submit(items, names))
+		return 1;
+
+	size_t failed = 0;
+	std::vector<bool> collected(names.size(), false);
+	size_t remaining = names.size();
+
+	while (remaining > 0) {
+		bool worked = spool.WorkOne();
+
+		for (size_t i = 0; i < names.size(); i++) {
+			if (!collected[i] && spool.IsDone(names[i])) {
+				failed += spool.Collect(names[i]);
+				collected[i] = true;
+				remaining--;
+			}
+		}
+
+		if (remaining > 0 && !worked) {
+			spool.BreakStale();
+			std::this_thread::sleep_for(std::chrono::milliseconds(SPOOL_POLL_MS));
+		}
+	}
+
+	if (options.batch.stats) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		batch_report("spool", items.size(), failed, elapsed.count());
+	}
+
+	return failed ? 1 : 0;
+}
+
+int spool_work(const char *spooldir, const SpoolOptions &options)
+{
+	Spool spool(spooldir, options);
+	if (!spool.Open())
+		return 1;
+
+	// waiting out a lease lets workers be started a little before the submitter
+	std::chrono::steady_clock::time_point idle = std::chrono::steady_clock::now();
+
+	for (;;) {
+		if (spool.WorkOne()) {
+			idle = std::chrono::steady_clock::now();
+			continue;
+		}
+
+		if (spool.Empty()) {
+			if (std::chrono::steady_clock::now() - idle > std::chrono::seconds(options.lease))
+				break;
+		} else {
+			// jobs held by others, one may need picking up if its holder dies
+			idle = std::chrono::steady_clock::now();
+			spool.BreakStale();
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(SPOOL_POLL_MS));
+	}
+
+	return 0;
+}
+
+#endif
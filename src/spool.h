@@ -0,0 +1,37 @@
+#ifndef GLUAC_SPOOL_H
+#define GLUAC_SPOOL_H
+
+#include "batch.h"
+
+// a spool directory shared between gluac processes, usually on different
+// machines over a network filesystem, lets them split one big build with
+// nothing coordinating them but the filesystem:
+//
+//   jobs/<id>.job    inputs with their output paths and chunknames, there
+//                    until the job is done
+//   leases/<id>.job  held by whoever is compiling that job, linked into
+//                    place so only one process can create it. the holder
+//                    touches it as it works, one left untouched for longer
+//                    than the lease is taken to be from a dead process and
+//                    is broken so the job can be claimed again
+//   done/<id>.job    the job file once every input in it has been compiled
+//   failed/<id>.job  the errors from a job's inputs, if any failed
+//
+// a lease broken from a process that was only slow means the job may be
+// compiled twice, which is harmless as outputs are written atomically
+typedef struct {
+	BatchOptions batch;		// workers and limits for this process, strip and parse only for the jobs it submits
+	unsigned int lease;		// seconds a claim stays good without being renewed
+	size_t chunk;			// inputs per job
+} SpoolOptions;
+
+// splits items into jobs in the spool, helps compile them and waits for the
+// other workers to finish the rest. errors from every job are printed.
+// input and output paths must mean the same thing on every machine working
+// on the spool. returns an exit code
+int spool_submit(const char *spooldir, const std::vector<BatchItem> &items, const SpoolOptions &options);
+
+// compiles jobs from the spool until it has been empty for a whole lease
+int spool_work(const char *spooldir, const SpoolOptions &options);
+
+#endif
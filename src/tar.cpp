@@ -0,0 +1,414 @@
+#include "tar.h"
+#include "workpool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#define TAR_BLOCK		512
+#define TAR_COPY_CHUNK	(1 << 20)
+
+typedef struct {
+	std::string head;	// extension headers and the member's own header, as read, or a pax global header on its own
+	std::string data;	// the source until it's compiled, then the bytecode, padded to a block
+	size_t held;		// bytes counted against the window's memory while it waits
+	bool lua;
+	bool done;
+	bool ok;
+} TarMember;
+
+// numeric fields are octal text, or big endian base 256 when the top bit is set
+static uint64_t tar_number(const unsigned char *field, size_t len)
+{
+	uint64_t value = 0;
+
+	if (field[0] & 0x80) {
+		value = field[0] & 0x7f;
+		for (size_t i = 1; i < len; i++)
+			value = (value << 8) | field[i];
+		return value;
+	}
+
+	for (size_t i = 0; i < len && field[i] != 0; i++) {
+		if (field[i] >= '0' && field[i] <= '7')
+			value = value * 8 + (field[i] - '0');
+	}
+
+	return value;
+}
+
+static size_t tar_padding(uint64_t size)
+{
+	return (size_t)((TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK);
+}
+
+// the checksum is of the header with its own field read as spaces
+static unsigned int tar_checksum(const unsigned char *header)
+{
+	unsigned int sum = 0;
+	for (size_t i = 0; i < TAR_BLOCK; i++)
+		sum += (i >= 148 && i < 156) ? ' ' : header[i];
+
+	return sum;
+}
+
+static void tar_set_size(unsigned char *header, uint64_t size)
+{
+	char field[13];
+	snprintf(field, sizeof(field), "%011llo", (unsigned long long)size);
+	memcpy(header + 124, field, 12);
+
+	char sum[8];
+	snprintf(sum, sizeof(sum), "%06o", tar_checksum(header));
+	memcpy(header + 148, sum, 7);
+	header[155] = ' ';
+}
+
+static bool ends_with_lua(const std::string &name)
+{
+	return name.size() > 4 && name.compare(name.size() - 4, 4, ".lua") == 0;
+}
+
+// a pax extended header is "<length> <key>=<value>\n" records
+static void pax_records(const std::string &data, std::string &path, bool &hassize)
+{
+	size_t pos = 0;
+	while (pos < data.size()) {
+		size_t space = data.find(' ', pos);
+		if (space == std::string::npos)
+			break;
+
+		size_t length = (size_t)strtoul(data.c_str() + pos, nullptr, 10);
+		if (length == 0 || pos + length > data.size())
+			break;
+
+		std::string record = data.substr(space + 1, pos + length - space - 2);
+		if (record.compare(0, 5, "path=") == 0)
+			path = record.substr(5);
+		else if (record.compare(0, 5, "size=") == 0)
+			hassize = true;
+
+		pos += length;
+	}
+}
+
+class TarStream
+{
+public:
+	TarStream(FILE *in, FILE *out, const TarOptions &options, WorkPool *pool) :
+		m_pIn(in),
+		m_pOut(out),
+		m_Options(options),
+		m_pPool(pool),
+		m_iHeld(0),
+		m_iLua(0),
+		m_bWriteFailed(false),
+		m_Failed(0)
+	{
+	}
+
+	// the pool has to have finished with the members by now
+	~TarStream()
+	{
+		for (size_t i = 0; i < m_Window.size(); i++)
+			delete m_Window[i];
+	}
+
+	bool Run();
+
+	size_t Compiled() const { return m_iLua; }
+	size_t Failed() const { return m_Failed; }
+
+private:
+	bool Read(void *out, size_t len) { return fread(out, 1, len, m_pIn) == len; }
+	void Write(const void *data, size_t len);
+
+	void Compile(TarMember *member, const std::string &name);
+	void Emit(TarMember *member);
+	void Drain(size_t keep);
+	bool Copy(uint64_t len);
+
+	FILE *m_pIn;
+	FILE *m_pOut;
+	const TarOptions &m_Options;
+	WorkPool *m_pPool;
+
+	std::deque<TarMember *> m_Window;
+	size_t m_iHeld;
+	size_t m_iLua;
+	bool m_bWriteFailed;
+	std::atomic<size_t> m_Failed;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_Done;
+};
+
+void TarStream::Write(const void *data, size_t len)
+{
+	// with -p nothing is written, but the stream is still read through and compiled
+	if (m_Options.batch.parseonly || m_bWriteFailed)
+		return;
+
+	if (fwrite(data, 1, len, m_pOut) != len)
+		m_bWriteFailed = true;
+}
+
+void TarStream::Compile(TarMember *member, const std::string &name)
+{
+	std::string chunkname = make_chunkname(name.compare(0, 2, "./") == 0 ? name.c_str() + 2 : name.c_str(), m_Options.chunknames);
+
+	m_pPool->Push([this, member, name, chunkname](lua_State *L) {
+		std::string bytecode;
+		std::string err;
+		CompileJob job = { name.c_str(), member->data.data(), member->data.size(), chunkname.c_str(), m_Options.batch.strip, m_Options.batch.parseonly, write_dump_string, &bytecode };
+
+		bool ok = compile(L, &job, err);
+		if (!ok) {
+			fprintf(stderr, "%s\n", err.c_str());
+			m_Failed++;
+		} else {
+			unsigned char *header = (unsigned char *)&member->head[member->head.size() - TAR_BLOCK];
+			tar_set_size(header, bytecode.size());
+			bytecode.append(tar_padding(bytecode.size()), '\0');
+		}
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		member->data.swap(bytecode);
+		member->ok = ok;
+		member->done = true;
+		m_Done.notify_all();
+	});
+}
+
+void TarStream::Emit(TarMember *member)
+{
+	// a member that didn't compile is left out, along with its extension headers
+	if (member->ok) {
+		Write(member->head.data(), member->head.size());
+		Write(member->data.data(), member->data.size());
+	}
+
+	m_iHeld -= member->held;
+	delete member;
+}
+
+// writes members from the front of the window in order, waiting on any that
+// are still compiling, until no more than keep are left
+void TarStream::Drain(size_t keep)
+{
+	while (m_Window.size() > keep) {
+		TarMember *member = m_Window.front();
+
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Done.wait(lock, [member] { return member->done; });
+		}
+
+		m_Window.pop_front();
+		Emit(member);
+	}
+}
+
+// passes len bytes of the input straight through
+bool TarStream::Copy(uint64_t len)
+{
+	std::string chunk;
+	while (len > 0) {
+		size_t n = (size_t)(len < TAR_COPY_CHUNK ? len : TAR_COPY_CHUNK);
+		chunk.resize(n);
+
+		if (!Read(&chunk[0], n))
+			return false;
+
+		Write(chunk.data(), n);
+		len -= n;
+	}
+
+	return true;
+}
+
+bool TarStream::Run()
+{
+	size_t window = m_Options.window ? m_Options.window : m_pPool->Size() * 4;
+	std::string meta;
+	std::string longname;
+	std::string paxpath;
+	bool paxsize = false;
+
+	for (;;) {
+		unsigned char header[TAR_BLOCK];
+		size_t got = fread(header, 1, TAR_BLOCK, m_pIn);
+
+		// a stream cut off at a member boundary is taken as ended
+		if (got == 0)
+			break;
+		if (got != TAR_BLOCK) {
+			fprintf(stderr, "tar stream ends part way through a header\n");
+			return false;
+		}
+
+		// two zero blocks end the archive, whatever follows is padding. it's read
+		// anyway so the writer on the other end of the pipe doesn't see it close early
+		bool zero = true;
+		for (size_t i = 0; i < TAR_BLOCK && zero; i++)
+			zero = header[i] == 0;
+		if (zero) {
+			while (fread(header, 1, TAR_BLOCK, m_pIn) > 0) {}
+			break;
+		}
+
+		if (tar_checksum(header) != tar_number(header + 148, 8)) {
+			fprintf(stderr, "not a tar stream, or a header is corrupt\n");
+			return false;
+		}
+
+		char type = (char)header[156];
+		uint64_t size = tar_number(header + 124, 12);
+		size_t padding = tar_padding(size);
+
+		// pax (x) and gnu (L, K) headers describe the member after them and go out just before it
+		if (type == 'x' || type == 'g' || type == 'L' || type == 'K') {
+			std::string data((size_t)size + padding, '\0');
+			if (!data.empty() && !Read(&data[0], data.size())) {
+				fprintf(stderr, "tar stream ends part way through a member\n");
+				return false;
+			}
+
+			// a global header applies to every member after it, so it goes out in
+			// its own place rather than with the next member, which may be dropped.
+			// ahead of any x, L or K headers already read for that member is just as good
+			if (type == 'g') {
+				TarMember *global = new TarMember();
+				global->head.assign((const char *)header, TAR_BLOCK);
+				global->head += data;
+				global->held = global->head.size();
+				global->lua = false;
+				global->done = true;
+				global->ok = true;
+
+				m_iHeld += global->held;
+				m_Window.push_back(global);
+				Drain(window);
+				continue;
+			}
+
+			if (type == 'x')
+				pax_records(data.substr(0, (size_t)size), paxpath, paxsize);
+			else if (type == 'L')
+				longname = std::string(data.c_str(), strnlen(data.c_str(), (size_t)size));
+
+			meta.append((const char *)header, TAR_BLOCK);
+			meta += data;
+			continue;
+		}
+
+		std::string name;
+		if (!paxpath.empty()) {
+			name = paxpath;
+		} else if (!longname.empty()) {
+			name = longname;
+		} else {
+			name = std::string((const char *)header, strnlen((const char *)header, 100));
+			if (memcmp(header + 257, "ustar", 5) == 0 && header[345] != 0)
+				name = std::string((const char *)header + 345, strnlen((const char *)header + 345, 155)) + "/" + name;
+		}
+
+		TarMember *member = new TarMember();
+		member->head = meta;
+		member->head.append((const char *)header, TAR_BLOCK);
+		member->held = 0;
+		member->done = false;
+		member->ok = true;
+
+		// a size given in a pax record would have to be rewritten there too, it's never small enough to matter
+		member->lua = (type == '0' || type == '\0' || type == '7') && ends_with_lua(name) && !paxsize;
+
+		meta.clear();
+		longname.clear();
+		paxpath.clear();
+		paxsize = false;
+
+		if (member->lua) {
+			member->data.resize((size_t)size);
+			std::string pad(padding, '\0');
+			if ((size > 0 && !Read(&member->data[0], (size_t)size)) || (padding > 0 && !Read(&pad[0], padding))) {
+				fprintf(stderr, "tar stream ends part way through %s\n", name.c_str());
+				delete member;
+				return false;
+			}
+
+			member->held = member->data.size();
+			m_iHeld += member->held;
+			m_iLua++;
+			m_Window.push_back(member);
+			Compile(member, name);
+		} else if (m_Window.empty() || m_iHeld + size + padding > m_Options.memory) {
+			// nothing is waiting ahead of it, or it's too big to hold: everything
+			// before it goes out first and then it streams straight through
+			Drain(0);
+			Emit(member);
+			if (!Copy(size + padding)) {
+				fprintf(stderr, "tar stream ends part way through %s\n", name.c_str());
+				return false;
+			}
+			continue;
+		} else {
+			member->data.resize((size_t)(size + padding));
+			if (!member->data.empty() && !Read(&member->data[0], member->data.size())) {
+				fprintf(stderr, "tar stream ends part way through %s\n", name.c_str());
+				delete member;
+				return false;
+			}
+
+			member->held = member->data.size();
+			m_iHeld += member->held;
+			member->done = true;
+			m_Window.push_back(member);
+		}
+
+		Drain(window);
+		while (!m_Window.empty() && m_iHeld > m_Options.memory)
+			Drain(m_Window.size() - 1);
+	}
+
+	Drain(0);
+
+	static const char end[TAR_BLOCK * 2] = { 0 };
+	Write(end, sizeof(end));
+
+	if (!m_Options.batch.parseonly && (fflush(m_pOut) != 0 || m_bWriteFailed)) {
+		fprintf(stderr, "cannot write the tar stream\n");
+		return false;
+	}
+
+	return true;
+}
+
+int tar_main(const TarOptions &options)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	size_t workers = options.batch.workers ? options.batch.workers : std::thread::hardware_concurrency();
+	WorkPool pool(workers ? workers : 1, (workers ? workers : 1) * 4, 0, options.batch.limits);
+	if (!pool.Start())
+		return 1;
+
+	TarStream stream(stdin, stdout, options, &pool);
+	bool ok = stream.Run();
+
+	// anything still compiling after an error touches the stream's members
+	pool.Wait();
+
+	if (options.batch.stats) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		batch_report("tar", stream.Compiled(), stream.Failed(), elapsed.count());
+	}
+
+	return ok && stream.Failed() == 0 ? 0 : 1;
+}
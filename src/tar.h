@@ -0,0 +1,22 @@
+#ifndef GLUAC_TAR_H
+#define GLUAC_TAR_H
+
+#include "batch.h"
+#include "compiler.h"
+
+typedef struct {
+	BatchOptions batch;
+	ChunknameOptions chunknames;	// applied to member names
+	size_t window;					// members held waiting for the ones before them, 0 picks from the worker count
+	size_t memory;					// bytes those members may hold, bigger ones wait until the window is empty
+} TarOptions;
+
+// reads a tar stream from stdin and writes it to stdout with every .lua
+// member compiled, in the same order and with everything else passed
+// through as is. members are compiled on a pool of worker states while the
+// ones before them are still being written, within options.window members
+// and options.memory bytes. a member that fails to compile is left out.
+// returns an exit code
+int tar_main(const TarOptions &options);
+
+#endif
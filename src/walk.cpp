@@ -0,0 +1,257 @@
+#include "walk.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+
+bool walk_tree(const char *root, const WalkOptions &options, std::vector<std::string> &files, std::vector<std::string> *dirs)
+{
+	fprintf(stderr, "recursive compiles are not supported on this platform\n");
+	return false;
+}
+
+bool walk_matches(const WalkOptions &options, const std::string &path, bool dir)
+{
+	return false;
+}
+
+#else
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// the kernel's record layout, glibc only wraps getdents64 in newer versions
+struct linux_dirent64 {
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+
+static bool glob_matches(const std::vector<std::string> &globs, const std::string &path, const char *name)
+{
+	for (size_t i = 0; i < globs.size(); i++) {
+		const char *subject = globs[i].find('/') != std::string::npos ? path.c_str() : name;
+		if (fnmatch(globs[i].c_str(), subject, FNM_PERIOD) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+bool walk_matches(const WalkOptions &options, const std::string &path, bool dir)
+{
+	size_t slash = path.find_last_of('/');
+	const char *name = path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+
+	if (glob_matches(options.exclude, path, name))
+		return false;
+
+	if (dir)
+		return true;
+
+	return options.include.empty() ? fnmatch("*.lua", name, 0) == 0 : glob_matches(options.include, path, name);
+}
+
+// directories are shared out to idle threads while there are few of them
+// queued, past that a thread just descends into them itself so the number
+// of open descriptors stays bounded by how deep the tree goes
+class TreeWalker
+{
+public:
+	TreeWalker(const WalkOptions &options, size_t threads) :
+		m_Options(options),
+		m_iThreads(threads),
+		m_iActive(0),
+		m_bFailed(false)
+	{
+	}
+
+	bool Run(int rootfd, std::vector<std::string> &files, std::vector<std::string> &dirs)
+	{
+		PendingDir root = { rootfd, "" };
+		m_Queue.push_back(root);
+
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < m_iThreads; i++)
+			threads.push_back(std::thread(&TreeWalker::Work, this));
+
+		Work();
+
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+
+		files.swap(m_Files);
+		dirs.swap(m_Dirs);
+		return !m_bFailed;
+	}
+
+private:
+	typedef struct {
+		int fd;
+		std::string path;	// relative to the root, empty or ending in a slash
+	} PendingDir;
+
+	void Work()
+	{
+		std::vector<std::string> found;
+		std::vector<std::string> founddirs;
+		std::unique_lock<std::mutex> lock(m_Mutex);
+
+		for (;;) {
+			while (m_Queue.empty() && m_iActive > 0)
+				m_Changed.wait(lock);
+
+			if (m_Queue.empty())
+				break;
+
+			PendingDir dir = m_Queue.front();
+			m_Queue.pop_front();
+			m_iActive++;
+
+			lock.unlock();
+			Walk(dir.fd, dir.path, found, founddirs);
+			lock.lock();
+
+			// the last thread to go idle with nothing queued wakes the rest to finish
+			if (--m_iActive == 0 && m_Queue.empty())
+				m_Changed.notify_all();
+		}
+
+		m_Files.insert(m_Files.end(), found.begin(), found.end());
+		m_Dirs.insert(m_Dirs.end(), founddirs.begin(), founddirs.end());
+	}
+
+	void Walk(int fd, const std::string &path, std::vector<std::string> &found, std::vector<std::string> &founddirs)
+	{
+		char buffer[32768];
+		long n;
+
+		while ((n = syscall(SYS_getdents64, fd, buffer, sizeof(buffer))) > 0) {
+			for (long offset = 0; offset < n;) {
+				struct linux_dirent64 *entry = (struct linux_dirent64 *)(buffer + offset);
+				offset += entry->d_reclen;
+
+				const char *name = entry->d_name;
+				if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+					continue;
+
+				unsigned char type = entry->d_type;
+				if (type == DT_UNKNOWN || type == DT_LNK) {
+					// symlinks are followed to files but never into directories, so there
+					// are no loops. filesystems that leave d_type unset get the same rule
+					struct stat st;
+					bool link = type == DT_LNK;
+					if (!link) {
+						if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+							continue;
+						link = S_ISLNK(st.st_mode);
+					}
+
+					if (link && fstatat(fd, name, &st, 0) != 0)
+						continue;
+
+					if (S_ISREG(st.st_mode))
+						type = DT_REG;
+					else if (S_ISDIR(st.st_mode) && !link)
+						type = DT_DIR;
+				}
+
+				std::string child = path + name;
+
+				if (type == DT_REG) {
+					if (walk_matches(m_Options, child, false))
+						found.push_back(child);
+				} else if (type == DT_DIR) {
+					if (!walk_matches(m_Options, child, true))
+						continue;
+
+					int subfd = openat(fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+					if (subfd < 0) {
+						fprintf(stderr, "cannot open %s: %s\n", child.c_str(), strerror(errno));
+						m_bFailed = true;
+						continue;
+					}
+
+					founddirs.push_back(child);
+					if (!Share(subfd, child + "/"))
+						Walk(subfd, child + "/", found, founddirs);
+				}
+			}
+		}
+
+		if (n < 0) {
+			fprintf(stderr, "cannot read %s: %s\n", path.empty() ? "." : path.c_str(), strerror(errno));
+			m_bFailed = true;
+		}
+
+		close(fd);
+	}
+
+	// hands a directory to another thread if they're running short of work
+	bool Share(int fd, const std::string &path)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_Queue.size() >= m_iThreads)
+			return false;
+
+		PendingDir dir = { fd, path };
+		m_Queue.push_back(dir);
+		m_Changed.notify_one();
+		return true;
+	}
+
+	const WalkOptions &m_Options;
+	size_t m_iThreads;
+	size_t m_iActive;
+	std::atomic<bool> m_bFailed;
+
+	std::deque<PendingDir> m_Queue;
+	std::vector<std::string> m_Files;
+	std::vector<std::string> m_Dirs;
+	std::mutex m_Mutex;
+	std::condition_variable m_Changed;
+};
+
+bool walk_tree(const char *root, const WalkOptions &options, std::vector<std::string> &files, std::vector<std::string> *dirs)
+{
+	int rootfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (rootfd < 0) {
+		fprintf(stderr, "cannot open %s: %s\n", root, strerror(errno));
+		return false;
+	}
+
+	size_t threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+
+	std::vector<std::string> founddirs;
+	TreeWalker walker(options, threads);
+	bool ok = walker.Run(rootfd, files, founddirs);
+
+	// sorted so builds list and compile files in the same order every time
+	std::sort(files.begin(), files.end());
+
+	if (dirs != nullptr) {
+		std::sort(founddirs.begin(), founddirs.end());
+		dirs->swap(founddirs);
+	}
+
+	return ok;
+}
+
+#endif
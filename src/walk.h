@@ -0,0 +1,25 @@
+#ifndef GLUAC_WALK_H
+#define GLUAC_WALK_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+typedef struct {
+	// globs matched against paths relative to the root, or just the file name
+	// when the glob has no slash in it. no includes takes every .lua file and
+	// a directory matching an exclude isn't descended into
+	std::vector<std::string> include;
+	std::vector<std::string> exclude;
+	size_t threads;		// 0 uses one per core
+} WalkOptions;
+
+// lists every file under root the globs allow, as sorted paths relative to
+// root. dirs, if given, gets every directory that was descended into in the
+// same form. prints an error and returns false if root can't be read
+bool walk_tree(const char *root, const WalkOptions &options, std::vector<std::string> &files, std::vector<std::string> *dirs = nullptr);
+
+// whether the walk would take the file, or descend into the directory, at path relative to the root
+bool walk_matches(const WalkOptions &options, const std::string &path, bool dir);
+
+#endif
@@ -0,0 +1,419 @@
+#include "watch.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+
+int watch_main(const char *srcdir, const char *outdir, const WatchOptions &options)
+{
+	fprintf(stderr, "watch mode is not supported on this platform\n");
+	return 1;
+}
+
+#else
+
+#include "compiler.h"
+#include "lexer.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <map>
+#include <set>
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | IN_DELETE_SELF)
+
+// an editor save is usually a burst of events (write a temporary, rename it
+// over, touch a backup), this waits for a short quiet spell so each touched
+// file is compiled once per save. a steady stream of events is still flushed
+// after a few debounce periods so nothing waits on it forever
+class Watcher
+{
+public:
+	Watcher(const std::string &srcdir, const std::string &outdir, const WatchOptions &options) :
+		m_sSrcDir(srcdir),
+		m_sOutDir(outdir),
+		m_Options(options),
+		m_iFd(-1),
+		m_pState(nullptr)
+	{
+	}
+
+	~Watcher()
+	{
+		if (m_pState != nullptr)
+			compiler_close(m_pState);
+		if (m_iFd >= 0)
+			close(m_iFd);
+	}
+
+	bool Start()
+	{
+		m_iFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+		if (m_iFd < 0) {
+			fprintf(stderr, "inotify: %s\n", strerror(errno));
+			return false;
+		}
+
+		m_pState = compiler_newstate(&m_Options.batch.limits);
+		return m_pState != nullptr;
+	}
+
+	// watches the directory and everything under it, returning the files found
+	bool AddTree(const std::string &dir, std::vector<std::string> &files)
+	{
+		if (!AddWatch(dir))
+			return false;
+
+		std::vector<std::string> found;
+		std::vector<std::string> dirs;
+		if (!walk_tree((m_sSrcDir + dir).c_str(), m_Options.walk, found, &dirs))
+			return false;
+
+		// the walk matched globs against paths inside dir, check them again from srcdir
+		for (size_t i = 0; i < dirs.size(); i++) {
+			if (walk_matches(m_Options.walk, dir + dirs[i], true))
+				AddWatch(dir + dirs[i] + "/");
+		}
+
+		for (size_t i = 0; i < found.size(); i++) {
+			if (walk_matches(m_Options.walk, dir + found[i], false))
+				files.push_back(dir + found[i]);
+		}
+
+		return true;
+	}
+
+	int Run()
+	{
+		typedef std::chrono::steady_clock clock;
+		clock::time_point first, last;
+		bool pending = false;
+
+		for (;;) {
+			int timeout = -1;
+			if (pending) {
+				clock::time_point due = last + std::chrono::milliseconds(m_Options.debounce);
+				clock::time_point latest = first + std::chrono::milliseconds(m_Options.debounce * 4);
+				if (latest < due)
+					due = latest;
+
+				long long wait = std::chrono::duration_cast<std::chrono::milliseconds>(due - clock::now()).count();
+				timeout = wait > 0 ? (int)wait : 0;
+			}
+
+			struct pollfd pfd = { m_iFd, POLLIN, 0 };
+			int n = poll(&pfd, 1, timeout);
+			if (n < 0 && errno != EINTR) {
+				fprintf(stderr, "poll: %s\n", strerror(errno));
+				return 1;
+			}
+
+			if (n > 0) {
+				if (!ReadEvents())
+					return 1;
+
+				if (!m_Changed.empty() || !m_Removed.empty() || !m_RemovedDirs.empty()) {
+					last = clock::now();
+					if (!pending)
+						first = last;
+					pending = true;
+				}
+				continue;
+			}
+
+			if (pending) {
+				Flush();
+				pending = false;
+			}
+		}
+	}
+
+private:
+	bool AddWatch(const std::string &dir)
+	{
+		int wd = inotify_add_watch(m_iFd, (m_sSrcDir + dir).c_str(), WATCH_EVENTS | IN_ONLYDIR | IN_DONT_FOLLOW);
+		if (wd < 0) {
+			fprintf(stderr, "cannot watch %s%s: %s\n", m_sSrcDir.c_str(), dir.c_str(), strerror(errno));
+			return false;
+		}
+
+		m_Dirs[wd] = dir;
+		return true;
+	}
+
+	bool ReadEvents()
+	{
+		alignas(struct inotify_event) char buffer[65536];
+
+		for (;;) {
+			ssize_t n = read(m_iFd, buffer, sizeof(buffer));
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0 && errno == EAGAIN)
+				return true;
+			if (n <= 0) {
+				fprintf(stderr, "inotify: %s\n", n < 0 ? strerror(errno) : "closed");
+				return false;
+			}
+
+			for (ssize_t offset = 0; offset < n;) {
+				struct inotify_event *event = (struct inotify_event *)(buffer + offset);
+				offset += sizeof(struct inotify_event) + event->len;
+
+				if (event->mask & IN_Q_OVERFLOW)
+					return Rescan();
+
+				Handle(event);
+			}
+		}
+	}
+
+	// events were dropped so anything might have changed, starts over with fresh watches
+	bool Rescan()
+	{
+		fprintf(stderr, "watch: event queue overflowed, rescanning\n");
+
+		m_Dirs.clear();
+		close(m_iFd);
+		m_iFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+		if (m_iFd < 0) {
+			fprintf(stderr, "inotify: %s\n", strerror(errno));
+			return false;
+		}
+
+		std::vector<std::string> files;
+		if (!AddTree("", files))
+			return false;
+
+		m_Changed.insert(files.begin(), files.end());
+		return true;
+	}
+
+	void Handle(const struct inotify_event *event)
+	{
+		std::map<int, std::string>::iterator it = m_Dirs.find(event->wd);
+		if (it == m_Dirs.end())
+			return;
+
+		if (event->mask & IN_IGNORED) {
+			m_Dirs.erase(it);
+			return;
+		}
+
+		// the parent's watch reports this too, except for srcdir itself
+		if (event->mask & IN_DELETE_SELF) {
+			RemoveDir(it->second);
+			return;
+		}
+
+		if (event->len == 0)
+			return;
+
+		std::string path = it->second + event->name;
+
+		if (event->mask & IN_ISDIR) {
+			// a new or moved in directory may already have files in it
+			if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && walk_matches(m_Options.walk, path, true)) {
+				std::vector<std::string> files;
+				AddTree(path + "/", files);
+				m_Changed.insert(files.begin(), files.end());
+			} else if ((event->mask & (IN_DELETE | IN_MOVED_FROM)) && walk_matches(m_Options.walk, path, true)) {
+				RemoveDir(path + "/");
+			}
+			return;
+		}
+
+		if (!walk_matches(m_Options.walk, path, false))
+			return;
+
+		if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+			m_Changed.insert(path);
+			m_Removed.erase(path);
+		} else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			m_Removed.insert(path);
+			m_Changed.erase(path);
+		}
+	}
+
+	// a directory (empty or ending in a slash) went away along with everything
+	// in it, which only gets an event of its own when it's deleted file by file
+	void RemoveDir(const std::string &dir)
+	{
+		// a moved out directory keeps its watches, which would now report under the old path
+		for (std::map<int, std::string>::iterator it = m_Dirs.begin(); it != m_Dirs.end();) {
+			if (it->second.compare(0, dir.size(), dir) == 0) {
+				inotify_rm_watch(m_iFd, it->first);
+				m_Dirs.erase(it++);
+			} else {
+				++it;
+			}
+		}
+
+		erase_prefix(m_Changed, dir);
+		erase_prefix(m_Removed, dir);
+		for (std::map<std::string, uint64_t>::iterator it = m_Built.lower_bound(dir); it != m_Built.end() && it->first.compare(0, dir.size(), dir) == 0;)
+			m_Built.erase(it++);
+		m_RemovedDirs.insert(dir);
+	}
+
+	static void erase_prefix(std::set<std::string> &paths, const std::string &prefix)
+	{
+		std::set<std::string>::iterator it = paths.lower_bound(prefix);
+		while (it != paths.end() && it->compare(0, prefix.size(), prefix) == 0)
+			paths.erase(it++);
+	}
+
+	// removes the outputs under a removed directory, and the directories
+	// left empty. this goes by what's in outdir rather than m_Built, which
+	// doesn't know about anything from the first build
+	void RemoveOutputs(const std::string &dir)
+	{
+		std::string outdir = m_sOutDir + dir;
+		struct stat st;
+		if (stat(outdir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+			return;
+
+		// the globs are matched against the path from srcdir below, so take everything here
+		WalkOptions all;
+		all.include.push_back("*");
+		all.include.push_back(".*");
+		all.threads = m_Options.walk.threads;
+
+		std::vector<std::string> files;
+		std::vector<std::string> dirs;
+		if (!walk_tree(outdir.c_str(), all, files, &dirs))
+			return;
+
+		for (size_t i = 0; i < files.size(); i++) {
+			std::string path = dir + files[i];
+			if (walk_matches(m_Options.walk, path, false) && remove((m_sOutDir + path).c_str()) == 0)
+				printf("removed %s\n", path.c_str());
+		}
+
+		// deepest first, anything still holding other files stays
+		for (size_t i = dirs.size(); i-- > 0;)
+			rmdir((outdir + dirs[i]).c_str());
+		if (!dir.empty())
+			rmdir(outdir.c_str());
+	}
+
+	void Flush()
+	{
+		const BatchOptions &batch = m_Options.batch;
+
+		// before the compiles, a directory removed and made again keeps its new files
+		for (std::set<std::string>::iterator it = m_RemovedDirs.begin(); it != m_RemovedDirs.end(); ++it)
+			RemoveOutputs(*it);
+
+		for (std::set<std::string>::iterator it = m_Changed.begin(); it != m_Changed.end(); ++it) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			std::string input = m_sSrcDir + *it;
+			std::string output = m_sOutDir + *it;
+			std::string chunkname = make_chunkname(input.c_str(), m_Options.chunknames);
+			std::string source;
+			std::string err;
+
+			if (!read_file(input.c_str(), source)) {
+				fprintf(stderr, "cannot open %s\n", input.c_str());
+				continue;
+			}
+
+			// a save that only touched comments or spacing can't change the output
+			uint64_t hash = token_hash(source.data(), source.size(), batch.strip);
+			std::map<std::string, uint64_t>::iterator built = m_Built.find(*it);
+			if (built != m_Built.end() && built->second == hash) {
+				printf("unchanged %s\n", it->c_str());
+				continue;
+			}
+
+			m_Built.erase(*it);
+
+			std::string bytecode;
+			CompileJob job = { input.c_str(), source.data(), source.size(), chunkname.c_str(), batch.strip, batch.parseonly, write_dump_string, &bytecode };
+
+			if (!compile(m_pState, &job, err)) {
+				fprintf(stderr, "%s\n", err.c_str());
+			} else if (!batch.parseonly && !(make_parent_dirs(output.c_str()) && write_file_atomic(output.c_str(), bytecode.data(), bytecode.size()))) {
+				fprintf(stderr, "cannot write %s\n", output.c_str());
+			} else {
+				m_Built[*it] = hash;
+
+				std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+				printf("compiled %s (%.1f ms)\n", it->c_str(), elapsed.count() * 1000.0);
+			}
+
+			if (compiler_exhausted(m_pState)) {
+				lua_State *fresh = compiler_newstate(&batch.limits);
+				if (fresh != nullptr) {
+					compiler_close(m_pState);
+					m_pState = fresh;
+				}
+			}
+		}
+
+		for (std::set<std::string>::iterator it = m_Removed.begin(); it != m_Removed.end(); ++it) {
+			std::string output = m_sOutDir + *it;
+			m_Built.erase(*it);
+			if (remove(output.c_str()) == 0)
+				printf("removed %s\n", it->c_str());
+		}
+
+		fflush(stdout);
+		m_Changed.clear();
+		m_Removed.clear();
+		m_RemovedDirs.clear();
+	}
+
+	std::string m_sSrcDir;
+	std::string m_sOutDir;
+	const WatchOptions &m_Options;
+	int m_iFd;
+	lua_State *m_pState;
+
+	std::map<int, std::string> m_Dirs;		// watch descriptor to its directory, relative to srcdir
+	std::set<std::string> m_Changed;
+	std::set<std::string> m_Removed;
+	std::set<std::string> m_RemovedDirs;	// relative to srcdir, ending in a slash (or empty for srcdir itself)
+	std::map<std::string, uint64_t> m_Built;	// token hash of what each output was last compiled from
+};
+
+int watch_main(const char *srcdir, const char *outdir, const WatchOptions &options)
+{
+	std::string src = srcdir;
+	if (src.empty() || src[src.size() - 1] != '/')
+		src += '/';
+
+	std::string out = outdir;
+	if (out.empty() || out[out.size() - 1] != '/')
+		out += '/';
+
+	Watcher watcher(src, out, options);
+	if (!watcher.Start())
+		return 1;
+
+	// watches go in before the first build so edits made during it aren't missed
+	std::vector<std::string> files;
+	if (!watcher.AddTree("", files))
+		return 1;
+
+	if (!files.empty()) {
+		std::vector<BatchItem> items;
+		for (size_t i = 0; i < files.size(); i++) {
+			BatchItem item = { src + files[i], out + files[i], make_chunkname((src + files[i]).c_str(), options.chunknames) };
+			items.push_back(item);
+		}
+
+		batch_main(items, options.batch);
+	}
+
+	fprintf(stderr, "watching %s for changes\n", srcdir);
+	return watcher.Run();
+}
+
+#endif
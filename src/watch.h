@@ -0,0 +1,18 @@
+#ifndef GLUAC_WATCH_H
+#define GLUAC_WATCH_H
+
+#include "batch.h"
+#include "walk.h"
+
+typedef struct {
+	BatchOptions batch;		// used for the first full build and every recompile
+	WalkOptions walk;
+	unsigned int debounce;	// quiet milliseconds after an event before compiling
+	ChunknameOptions chunknames;
+} WatchOptions;
+
+// builds srcdir into outdir as -r would, then keeps recompiling the files
+// that change (and removing the outputs of ones deleted) until interrupted
+int watch_main(const char *srcdir, const char *outdir, const WatchOptions &options);
+
+#endif
@@ -0,0 +1,167 @@
+#include "workpool.h"
+
+#include <string.h>
+
+static size_t state_memory(lua_State *L)
+{
+	return (size_t)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+WorkPool::WorkPool(size_t workers, size_t maxqueued, size_t reserved, const CompileLimits &limits) :
+	m_iWorkers(workers > 0 ? workers : 1),
+	m_iMaxQueued(maxqueued > 0 ? maxqueued : 1),
+	m_iReserved(reserved < m_iWorkers ? reserved : m_iWorkers - 1),
+	m_iRunning(0),
+	m_bStopping(false),
+	m_Limits(limits)
+{
+	memset(m_Stats, 0, sizeof(m_Stats));
+}
+
+WorkPool::~WorkPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_bStopping = true;
+	}
+
+	m_JobReady.notify_all();
+
+	for (size_t i = 0; i < m_Threads.size(); i++)
+		m_Threads[i].join();
+
+	for (size_t i = 0; i < m_States.size(); i++)
+		compiler_close(m_States[i]);
+}
+
+bool WorkPool::Start()
+{
+	for (size_t i = 0; i < m_iWorkers; i++) {
+		lua_State *L = compiler_newstate(&m_Limits);
+		if (L == nullptr)
+			return false;
+
+		WorkerStatus status = { state_memory(L), false, i < m_iReserved, 0 };
+		m_States.push_back(L);
+		m_Workers.push_back(status);
+	}
+
+	for (size_t i = 0; i < m_States.size(); i++)
+		m_Threads.push_back(std::thread(&WorkPool::Run, this, i));
+
+	return true;
+}
+
+void WorkPool::Push(Job job, int priority)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	std::deque<QueuedJob> &queue = m_Queues[priority];
+
+	while (queue.size() >= m_iMaxQueued)
+		m_SlotFree.wait(lock);
+
+	QueuedJob queued = { std::move(job), std::chrono::steady_clock::now() };
+	queue.push_back(std::move(queued));
+
+	// reserved workers ignore batch jobs, so wake everyone rather than risk
+	// the one notification landing on a worker that won't take the job
+	m_JobReady.notify_all();
+}
+
+void WorkPool::Wait()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	while (!m_Queues[PRIORITY_INTERACTIVE].empty() || !m_Queues[PRIORITY_BATCH].empty() || m_iRunning > 0)
+		m_Idle.wait(lock);
+}
+
+LaneStats WorkPool::GetStats(int priority)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Stats[priority];
+}
+
+size_t WorkPool::QueueDepth(int priority)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Queues[priority].size();
+}
+
+std::vector<WorkerStatus> WorkPool::GetWorkers()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Workers;
+}
+
+void WorkPool::Run(size_t index)
+{
+	lua_State *L = m_States[index];
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	int lanes = m_Workers[index].reserved ? PRIORITY_INTERACTIVE + 1 : PRIORITY_COUNT;
+
+	for (;;) {
+		int lane = -1;
+		for (;;) {
+			for (int i = 0; i < lanes && lane < 0; i++) {
+				if (!m_Queues[i].empty())
+					lane = i;
+			}
+
+			if (lane >= 0 || m_bStopping)
+				break;
+
+			m_JobReady.wait(lock);
+		}
+
+		if (lane < 0)
+			return;
+
+		QueuedJob queued = std::move(m_Queues[lane].front());
+		m_Queues[lane].pop_front();
+		m_iRunning++;
+		m_Workers[index].busy = true;
+		m_SlotFree.notify_all();
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::chrono::duration<double> waited = start - queued.queued;
+
+		lock.unlock();
+		queued.job(L);
+
+		// keep the old state if a new one can't be made, it is most likely still usable
+		bool recycled = false;
+		if (compiler_exhausted(L)) {
+			lua_State *fresh = compiler_newstate(&m_Limits);
+			if (fresh != nullptr) {
+				compiler_close(L);
+				L = fresh;
+				recycled = true;
+			}
+		}
+
+		// the state is only safe to query from its own thread
+		size_t memory = state_memory(L);
+		lock.lock();
+
+		if (recycled) {
+			m_States[index] = L;
+			m_Workers[index].recycled++;
+		}
+
+		m_Workers[index].memory = memory;
+		m_Workers[index].busy = false;
+
+		std::chrono::duration<double> ran = std::chrono::steady_clock::now() - start;
+		LaneStats &stats = m_Stats[lane];
+		stats.jobs++;
+		stats.waitseconds += waited.count();
+		stats.runseconds += ran.count();
+		if (waited.count() > stats.maxwaitseconds)
+			stats.maxwaitseconds = waited.count();
+
+		m_iRunning--;
+		if (m_Queues[PRIORITY_INTERACTIVE].empty() && m_Queues[PRIORITY_BATCH].empty() && m_iRunning == 0)
+			m_Idle.notify_all();
+	}
+}
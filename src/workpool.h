@@ -0,0 +1,92 @@
+#ifndef GLUAC_WORKPOOL_H
+#define GLUAC_WORKPOOL_H
+
+#include "compiler.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum {
+	PRIORITY_INTERACTIVE = 0,	// someone is waiting on this file right now
+	PRIORITY_BATCH,
+	PRIORITY_COUNT
+};
+
+typedef struct {
+	unsigned long long jobs;
+	double waitseconds;		// time spent queued, summed over every job
+	double maxwaitseconds;
+	double runseconds;		// time spent compiling once a worker picked it up
+} LaneStats;
+
+typedef struct {
+	size_t memory;		// bytes used by the worker's state as of its last job
+	bool busy;
+	bool reserved;
+	unsigned long long recycled;	// states thrown away after a compile went over its limits
+} WorkerStatus;
+
+// a fixed set of threads that each own a warm lua_State, jobs are run on
+// whichever worker is free and get that worker's state to compile with.
+// interactive jobs are always taken before batch ones, and the first
+// reserved workers only ever take interactive jobs so one is free for them
+// even while a long batch is running. a worker whose compile goes over the
+// limits gets a fresh state before its next job
+class WorkPool
+{
+public:
+	typedef std::function<void(lua_State *L)> Job;
+
+	// maxqueued bounds how many jobs may wait in each lane, Push blocks once it is reached
+	WorkPool(size_t workers, size_t maxqueued, size_t reserved = 0, const CompileLimits &limits = CompileLimits());
+
+	// runs whatever is still queued then joins the workers
+	~WorkPool();
+
+	// creates the worker states and threads, false if a state couldn't be made
+	bool Start();
+
+	void Push(Job job, int priority = PRIORITY_BATCH);
+
+	// blocks until every pushed job has finished
+	void Wait();
+
+	size_t Size() const { return m_States.size(); }
+
+	LaneStats GetStats(int priority);
+	size_t QueueDepth(int priority);
+	std::vector<WorkerStatus> GetWorkers();
+
+private:
+	typedef struct {
+		Job job;
+		std::chrono::steady_clock::time_point queued;
+	} QueuedJob;
+
+	void Run(size_t index);
+
+	size_t m_iWorkers;
+	size_t m_iMaxQueued;
+	size_t m_iReserved;
+	size_t m_iRunning;
+	bool m_bStopping;
+	CompileLimits m_Limits;
+
+	std::vector<lua_State *> m_States;
+	std::vector<WorkerStatus> m_Workers;
+	std::vector<std::thread> m_Threads;
+	std::deque<QueuedJob> m_Queues[PRIORITY_COUNT];
+	LaneStats m_Stats[PRIORITY_COUNT];
+
+	std::mutex m_Mutex;
+	std::condition_variable m_JobReady;
+	std::condition_variable m_SlotFree;
+	std::condition_variable m_Idle;
+};
+
+#endif
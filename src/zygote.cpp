@@ -0,0 +1,133 @@
+#include "batch.h"
+#include "compiler.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+
+int zygote_main(const std::vector<BatchItem> &items, const BatchOptions &options)
+{
+	fprintf(stderr, "zygote mode is not supported on this platform\n");
+	return 1;
+}
+
+#else
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <map>
+#include <thread>
+
+// waits for one child and reports how its file went, returns false if it failed
+static bool reap_child(const std::vector<BatchItem> &items, std::map<pid_t, size_t> &children, const CompileLimits &limits)
+{
+	int status;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, &status, 0)) < 0) {
+		if (errno != EINTR) {
+			children.clear();
+			return false;
+		}
+	}
+
+	std::map<pid_t, size_t>::iterator it = children.find(pid);
+	if (it == children.end())
+		return true;
+
+	const BatchItem &item = items[it->second];
+	children.erase(it);
+
+	if (WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM && limits.milliseconds != 0) {
+		fprintf(stderr, "%s: exceeded the %u ms time limit\n", item.input.c_str(), limits.milliseconds);
+		return false;
+	}
+
+	if (WIFSIGNALED(status)) {
+		fprintf(stderr, "%s: compiler crashed (%s)\n", item.input.c_str(), strsignal(WTERMSIG(status)));
+		return false;
+	}
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int zygote_main(const std::vector<BatchItem> &items, const BatchOptions &options)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	size_t failed = 0;
+
+	size_t jobs = options.workers ? options.workers : std::thread::hardware_concurrency();
+	if (jobs == 0)
+		jobs = 1;
+
+	// the watchdog thread wouldn't survive the fork, so children get a timer
+	// signal instead and only the memory limit is left to the state
+	CompileLimits limits = options.limits;
+	limits.milliseconds = 0;
+
+	// everything a child needs is set up once here and shared copy-on-write
+	lua_State *L = compiler_newstate(&limits);
+	if (L == nullptr)
+		return 1;
+
+	std::map<pid_t, size_t> children;
+
+	for (size_t i = 0; i < items.size(); i++) {
+		while (children.size() >= jobs) {
+			if (!reap_child(items, children, options.limits))
+				failed++;
+		}
+
+		fflush(stdout);
+		fflush(stderr);
+
+		pid_t pid = fork();
+		if (pid == 0) {
+			if (options.limits.milliseconds != 0) {
+				struct itimerval timer;
+				memset(&timer, 0, sizeof(timer));
+				timer.it_value.tv_sec = options.limits.milliseconds / 1000;
+				timer.it_value.tv_usec = (options.limits.milliseconds % 1000) * 1000;
+				setitimer(ITIMER_REAL, &timer, nullptr);
+			}
+
+			std::string err;
+			bool ok = compile_to_file(L, items[i].input.c_str(), items[i].output.c_str(), options.strip, options.parseonly, err, items[i].chunkname.c_str());
+			if (!ok)
+				fprintf(stderr, "%s\n", err.c_str());
+
+			fflush(stderr);
+			_exit(ok ? 0 : 1);
+		}
+
+		if (pid < 0) {
+			fprintf(stderr, "%s: fork failed: %s\n", items[i].input.c_str(), strerror(errno));
+			failed++;
+			continue;
+		}
+
+		children[pid] = i;
+	}
+
+	while (!children.empty()) {
+		if (!reap_child(items, children, options.limits))
+			failed++;
+	}
+
+	compiler_close(L);
+
+	if (options.stats) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		batch_report("zygote", items.size(), failed, elapsed.count());
+	}
+
+	return failed ? 1 : 0;
+}
+
+#endif